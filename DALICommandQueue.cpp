@@ -0,0 +1,436 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALICommandQueue.h"
+
+#define QUEUE_POSTED_FLAG (1UL << 0)
+#define QUEUE_DONE_FLAG (1UL << 1)
+
+// update_kind() values
+#define UPDATE_LEVEL 1
+#define UPDATE_COLOUR 2
+
+DALICommandQueue::DALICommandQueue(DALIDriver &dali)
+    : _dali(dali), _seq(0), _coalescing(false), _coalesced(0)
+{
+    for (int i = 0; i < DALI_COMMAND_QUEUE_SIZE; i++) {
+        _slots[i].state = SLOT_FREE;
+        _slots[i].generation = 0;
+        _slots[i].coalesced = false;
+    }
+#if MBED_CONF_RTOS_PRESENT
+    _thread_started = false;
+#endif
+}
+
+DALICommandQueue::~DALICommandQueue()
+{
+#if MBED_CONF_RTOS_PRESENT
+    if (_thread_started) {
+        _thread.terminate();
+    }
+#endif
+}
+
+DALIHandle DALICommandQueue::handle_of(int index)
+{
+    return ((DALIHandle)_slots[index].generation << 8) | (index + 1);
+}
+
+DALICommandQueue::Slot *DALICommandQueue::find(DALIHandle handle)
+{
+    int index = (int)(handle & 0xFF) - 1;
+    if (index < 0 || index >= DALI_COMMAND_QUEUE_SIZE) {
+        return NULL;
+    }
+    Slot &slot = _slots[index];
+    if (slot.state == SLOT_FREE || slot.generation != (handle >> 8)) {
+        return NULL;
+    }
+    return &slot;
+}
+
+DALIHandle DALICommandQueue::post(const DALICommand &command,
+                                  DALIPriority priority,
+                                  mbed::Callback<void(DALIHandle, int)> done)
+{
+    core_util_critical_section_enter();
+    int replaced = -1;
+    int kind = _coalescing ? update_kind(command.type) : 0;
+    for (int i = 0; kind && i < DALI_COMMAND_QUEUE_SIZE; i++) {
+        if (_slots[i].state == SLOT_QUEUED && !_slots[i].coalesced &&
+            _slots[i].command.addr == command.addr &&
+            update_kind(_slots[i].command.type) == kind) {
+            replaced = i;
+            break;
+        }
+    }
+    // A user update replacing a background one keeps going first, and the
+    // other way round
+    if (replaced >= 0 && _slots[replaced].priority < priority) {
+        priority = (DALIPriority)_slots[replaced].priority;
+    }
+    int index = -1;
+    if (replaced >= 0 && !_slots[replaced].done) {
+        // Nobody waits for the update this one replaces, take over its slot
+        index = replaced;
+        replaced = -1;
+        _coalesced++;
+    } else {
+        // A free slot, otherwise the oldest result nobody took
+        int available = 0;
+        for (int i = 0; i < DALI_COMMAND_QUEUE_SIZE; i++) {
+            uint8_t state = _slots[i].state;
+            if (state != SLOT_FREE && state != SLOT_DONE) {
+                continue;
+            }
+            available++;
+            if (index < 0 ||
+                (_slots[index].state == SLOT_DONE &&
+                 (state == SLOT_FREE ||
+                  (int32_t)(_slots[i].seq - _slots[index].seq) < 0))) {
+                index = i;
+            }
+        }
+        if (index < 0 || (priority == DALI_PRIORITY_BACKGROUND &&
+                          available <= DALI_COMMAND_QUEUE_RESERVED)) {
+            core_util_critical_section_exit();
+            return 0;
+        }
+    }
+    if (replaced >= 0) {
+        // The bus thread completes it with DALI_COALESCED
+        _slots[replaced].coalesced = true;
+        _coalesced++;
+    }
+    Slot &slot = _slots[index];
+    slot.command = command;
+    slot.done = done;
+    slot.priority = priority;
+    slot.seq = _seq++;
+    slot.generation++;
+    slot.state = SLOT_QUEUED;
+    slot.coalesced = false;
+    DALIHandle handle = handle_of(index);
+    core_util_critical_section_exit();
+    _flags.set(QUEUE_POSTED_FLAG);
+    return handle;
+}
+
+DALIHandle DALICommandQueue::set_level(uint8_t addr, uint8_t level,
+                                       DALIPriority priority,
+                                       mbed::Callback<void(DALIHandle, int)> done)
+{
+    DALICommand command;
+    command.type = DALI_CMD_SET_LEVEL;
+    command.addr = addr;
+    command.data = level;
+    return post(command, priority, done);
+}
+
+DALIHandle DALICommandQueue::set_color(uint8_t addr, uint16_t kelvin,
+                                       DALIPriority priority,
+                                       mbed::Callback<void(DALIHandle, int)> done)
+{
+    DALICommand command;
+    command.type = DALI_CMD_SET_COLOUR_TC;
+    command.addr = addr;
+    command.kelvin = kelvin;
+    return post(command, priority, done);
+}
+
+DALIHandle DALICommandQueue::set_color(uint8_t addr, uint8_t r, uint8_t g,
+                                       uint8_t b, uint8_t dim,
+                                       DALIPriority priority,
+                                       mbed::Callback<void(DALIHandle, int)> done)
+{
+    DALICommand command;
+    command.type = DALI_CMD_SET_COLOUR_RGB;
+    command.addr = addr;
+    command.rgb[0] = r;
+    command.rgb[1] = g;
+    command.rgb[2] = b;
+    command.rgb[3] = dim;
+    return post(command, priority, done);
+}
+
+DALIHandle DALICommandQueue::go_to_scene(uint8_t addr, uint8_t scene,
+                                         DALIPriority priority,
+                                         mbed::Callback<void(DALIHandle, int)> done)
+{
+    DALICommand command;
+    command.type = DALI_CMD_GO_TO_SCENE;
+    command.addr = addr;
+    command.data = scene;
+    return post(command, priority, done);
+}
+
+DALIHandle DALICommandQueue::query(uint8_t addr, uint8_t opcode,
+                                   DALIPriority priority,
+                                   mbed::Callback<void(DALIHandle, int)> done)
+{
+    DALICommand command;
+    command.type = DALI_CMD_QUERY;
+    command.addr = addr;
+    command.data = opcode;
+    return post(command, priority, done);
+}
+
+DALIHandle DALICommandQueue::call(mbed::Callback<int()> func,
+                                  DALIPriority priority,
+                                  mbed::Callback<void(DALIHandle, int)> done)
+{
+    DALICommand command;
+    command.type = DALI_CMD_CALL;
+    command.func = func;
+    return post(command, priority, done);
+}
+
+void DALICommandQueue::set_coalescing(bool on)
+{
+    _coalescing = on;
+}
+
+uint32_t DALICommandQueue::coalesced()
+{
+    return _coalesced;
+}
+
+int DALICommandQueue::update_kind(DALICommandType type)
+{
+    switch (type) {
+        case DALI_CMD_SET_LEVEL:
+        case DALI_CMD_TURN_OFF:
+            return UPDATE_LEVEL;
+        case DALI_CMD_SET_COLOUR_TC:
+        case DALI_CMD_SET_COLOUR_RGB:
+            return UPDATE_COLOUR;
+        default:
+            return 0;
+    }
+}
+
+bool DALICommandQueue::cancel(DALIHandle handle)
+{
+    core_util_critical_section_enter();
+    Slot *slot = find(handle);
+    if (!slot || slot->state != SLOT_QUEUED || slot->coalesced) {
+        core_util_critical_section_exit();
+        return false;
+    }
+    mbed::Callback<void(DALIHandle, int)> done = slot->done;
+    if (done) {
+        slot->state = SLOT_FREE;
+    } else {
+        slot->result = DALI_CANCELLED;
+        slot->seq = _seq++;
+        slot->state = SLOT_DONE;
+    }
+    core_util_critical_section_exit();
+    if (done) {
+        done(handle, DALI_CANCELLED);
+    }
+    _flags.set(QUEUE_DONE_FLAG);
+    return true;
+}
+
+int DALICommandQueue::result(DALIHandle handle)
+{
+    core_util_critical_section_enter();
+    Slot *slot = find(handle);
+    int result = DALI_EXPIRED;
+    if (slot && slot->state == SLOT_DONE) {
+        result = slot->result;
+        slot->state = SLOT_FREE;
+    } else if (slot) {
+        result = DALI_PENDING;
+    }
+    core_util_critical_section_exit();
+    return result;
+}
+
+int DALICommandQueue::wait(DALIHandle handle, uint32_t timeout_ms)
+{
+#if MBED_CONF_RTOS_PRESENT
+    Timer timer;
+    timer.start();
+#endif
+    while (true) {
+        int ret = result(handle);
+        if (ret != DALI_PENDING) {
+            return ret;
+        }
+#if MBED_CONF_RTOS_PRESENT
+        if (_thread_started) {
+            uint32_t elapsed = timer.read_ms();
+            if (timeout_ms != osWaitForever && elapsed >= timeout_ms) {
+                return DALI_PENDING;
+            }
+            // The bus thread clears the flag when it starts a command
+            _flags.wait_any(QUEUE_DONE_FLAG,
+                            timeout_ms == osWaitForever ? osWaitForever
+                                                        : timeout_ms - elapsed,
+                            false);
+            continue;
+        }
+#endif
+        if (!step()) {
+            return DALI_PENDING;
+        }
+    }
+}
+
+bool DALICommandQueue::step()
+{
+    core_util_critical_section_enter();
+    int next = -1;
+    for (int i = 0; i < DALI_COMMAND_QUEUE_SIZE; i++) {
+        if (_slots[i].state != SLOT_QUEUED) {
+            continue;
+        }
+        // Replaced updates take no bus time, they complete first
+        if (_slots[i].coalesced) {
+            next = i;
+            break;
+        }
+        if (next < 0 || _slots[i].priority < _slots[next].priority ||
+            (_slots[i].priority == _slots[next].priority &&
+             (int32_t)(_slots[i].seq - _slots[next].seq) < 0)) {
+            next = i;
+        }
+    }
+    if (next >= 0) {
+        // Nothing else touches a running slot
+        _slots[next].state = SLOT_RUNNING;
+    }
+    core_util_critical_section_exit();
+    if (next < 0) {
+        return false;
+    }
+    _flags.clear(QUEUE_DONE_FLAG);
+    if (_slots[next].coalesced) {
+        complete(next, DALI_COALESCED);
+    } else {
+        complete(next, execute(_slots[next].command));
+    }
+    return true;
+}
+
+int DALICommandQueue::run()
+{
+    int count = 0;
+    while (step()) {
+        count++;
+    }
+    return count;
+}
+
+int DALICommandQueue::pending()
+{
+    int count = 0;
+    core_util_critical_section_enter();
+    for (int i = 0; i < DALI_COMMAND_QUEUE_SIZE; i++) {
+        if (_slots[i].state == SLOT_QUEUED && !_slots[i].coalesced) {
+            count++;
+        }
+    }
+    core_util_critical_section_exit();
+    return count;
+}
+
+int DALICommandQueue::execute(const DALICommand &command)
+{
+    switch (command.type) {
+        case DALI_CMD_SET_LEVEL:
+            _dali.set_level(command.addr, command.data);
+            break;
+        case DALI_CMD_TURN_OFF:
+            _dali.turn_off(command.addr);
+            break;
+        case DALI_CMD_TURN_ON:
+            _dali.turn_on(command.addr);
+            break;
+        case DALI_CMD_GO_TO_SCENE:
+            _dali.go_to_scene(command.addr, command.data);
+            break;
+        case DALI_CMD_SET_COLOUR_TC:
+            _dali.set_color(command.addr, command.kelvin);
+            break;
+        case DALI_CMD_SET_COLOUR_RGB:
+            _dali.set_color(command.addr, command.rgb[0], command.rgb[1],
+                            command.rgb[2], command.rgb[3]);
+            break;
+        case DALI_CMD_STANDARD:
+            _dali.send_command_standard(command.addr, command.data);
+            break;
+        case DALI_CMD_QUERY:
+            _dali.send_command_standard(command.addr, command.data);
+            return (int)_dali.recv();
+        case DALI_CMD_INPUT:
+            _dali.send_command_standard_input(command.addr, command.instance,
+                                              command.data);
+            break;
+        case DALI_CMD_INPUT_QUERY:
+            _dali.send_command_standard_input(command.addr, command.instance,
+                                              command.data);
+            return (int)_dali.recv();
+        case DALI_CMD_CALL:
+            return command.func ? command.func() : 0;
+    }
+    return 0;
+}
+
+void DALICommandQueue::complete(int index, int result)
+{
+    Slot &slot = _slots[index];
+    DALIHandle handle = handle_of(index);
+    mbed::Callback<void(DALIHandle, int)> done = slot.done;
+    core_util_critical_section_enter();
+    if (done) {
+        // Free before the callback so it can queue the next command
+        slot.state = SLOT_FREE;
+    } else {
+        slot.result = result;
+        slot.seq = _seq++;
+        slot.state = SLOT_DONE;
+    }
+    core_util_critical_section_exit();
+    if (done) {
+        done(handle, result);
+    }
+    _flags.set(QUEUE_DONE_FLAG);
+}
+
+#if MBED_CONF_RTOS_PRESENT
+osStatus DALICommandQueue::start(osPriority priority)
+{
+    osStatus status =
+        _thread.start(callback(this, &DALICommandQueue::thread_main));
+    if (status == osOK) {
+        _thread.set_priority(priority);
+        _thread_started = true;
+    }
+    return status;
+}
+
+void DALICommandQueue::thread_main()
+{
+    while (true) {
+        _flags.wait_any(QUEUE_POSTED_FLAG);
+        run();
+    }
+}
+#endif
@@ -0,0 +1,268 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_COMMAND_QUEUE_H
+#define DALI_COMMAND_QUEUE_H
+
+#include "DALIDriver.h"
+#include "mbed.h"
+
+// Commands queued or holding a result, at most 255
+#ifndef DALI_COMMAND_QUEUE_SIZE
+#define DALI_COMMAND_QUEUE_SIZE 16
+#endif
+
+// Slots background commands cannot take, so they cannot fill the queue
+#ifndef DALI_COMMAND_QUEUE_RESERVED
+#define DALI_COMMAND_QUEUE_RESERVED 4
+#endif
+
+// Results besides the backward frame (and RECV_NO_RESPONSE or
+// RECV_FRAME_ERROR) of a query, or 0 for a command
+// Not run yet
+#define DALI_PENDING (-10)
+// Cancelled before it ran
+#define DALI_CANCELLED (-11)
+// Unknown handle, or the result was already taken or dropped
+#define DALI_EXPIRED (-12)
+// Replaced by a newer update before it ran, see set_coalescing()
+#define DALI_COALESCED (-13)
+
+// Handle of a queued command, 0 if it could not be queued
+typedef uint32_t DALIHandle;
+
+// Priority classes, a higher one runs first
+enum DALIPriority {
+    // Someone is waiting for the light, e.g. a switch
+    DALI_PRIORITY_USER,
+    // Timed scene changes
+    DALI_PRIORITY_SCENE,
+    // Status polling
+    DALI_PRIORITY_BACKGROUND,
+    DALI_NUM_PRIORITIES
+};
+
+enum DALICommandType {
+    // DALIDriver::set_level(addr, data)
+    DALI_CMD_SET_LEVEL,
+    // DALIDriver::turn_off(addr)
+    DALI_CMD_TURN_OFF,
+    // DALIDriver::turn_on(addr)
+    DALI_CMD_TURN_ON,
+    // DALIDriver::go_to_scene(addr, data)
+    DALI_CMD_GO_TO_SCENE,
+    // DALIDriver::set_color(addr, kelvin)
+    DALI_CMD_SET_COLOUR_TC,
+    // DALIDriver::set_color(addr, rgb[0], rgb[1], rgb[2], rgb[3])
+    DALI_CMD_SET_COLOUR_RGB,
+    // Control gear command data to addr
+    DALI_CMD_STANDARD,
+    // Control gear query data to addr, the result is the answer
+    DALI_CMD_QUERY,
+    // Input device command data to instance of addr
+    DALI_CMD_INPUT,
+    // Input device query data to instance of addr, the result is the answer
+    DALI_CMD_INPUT_QUERY,
+    // Run func on the bus thread, the result is what it returns
+    DALI_CMD_CALL
+};
+
+struct DALICommand {
+    DALICommandType type;
+    uint8_t addr;
+    uint8_t instance;
+    // Opcode, level or scene
+    uint8_t data;
+    // Colour temperature in Kelvin
+    uint16_t kelvin;
+    // Red, green, blue and dim level
+    uint8_t rgb[4];
+    mbed::Callback<int()> func;
+};
+
+/** Bounded queue of DALI commands run one at a time by the thread that owns
+ * the bus
+ *
+ * Any thread can queue a command without waiting for the bus. The bus thread
+ * runs the queued command of the highest priority next (the oldest of them
+ * first), so a user action waits for at most the command already on the
+ * bus. The result of a command goes to its completion callback, which runs
+ * on the bus thread, or is kept until result() or wait() takes it.
+ *
+ * Once the queue has a bus thread, nothing else may use the DALIDriver.
+ * Without RTOS (or on the host simulator) call step() or run() from the
+ * thread that owns the bus instead.
+ */
+class DALICommandQueue {
+public:
+    /** Constructor
+     *
+     *   @param dali    Driver to run the commands on
+     */
+    DALICommandQueue(DALIDriver &dali);
+
+    ~DALICommandQueue();
+
+    /** Queue a command
+     *
+     *   @param command     The command
+     *   @param priority    Priority class
+     *   @param done        Called on the bus thread with the handle and the
+     * result once the command ran or was replaced (see set_coalescing()),
+     * or by cancel() on the thread that cancelled it. The result is not
+     * kept then.
+     *   @returns           Handle of the command, 0 if the queue is full
+     */
+    DALIHandle post(const DALICommand &command,
+                    DALIPriority priority = DALI_PRIORITY_USER,
+                    mbed::Callback<void(DALIHandle, int)> done = NULL);
+
+    // Shorthands for post()
+    DALIHandle set_level(uint8_t addr, uint8_t level,
+                         DALIPriority priority = DALI_PRIORITY_USER,
+                         mbed::Callback<void(DALIHandle, int)> done = NULL);
+    DALIHandle set_color(uint8_t addr, uint16_t kelvin,
+                         DALIPriority priority = DALI_PRIORITY_USER,
+                         mbed::Callback<void(DALIHandle, int)> done = NULL);
+    DALIHandle set_color(uint8_t addr, uint8_t r, uint8_t g, uint8_t b,
+                         uint8_t dim = 0,
+                         DALIPriority priority = DALI_PRIORITY_USER,
+                         mbed::Callback<void(DALIHandle, int)> done = NULL);
+    DALIHandle go_to_scene(uint8_t addr, uint8_t scene,
+                           DALIPriority priority = DALI_PRIORITY_USER,
+                           mbed::Callback<void(DALIHandle, int)> done = NULL);
+    DALIHandle query(uint8_t addr, uint8_t opcode,
+                     DALIPriority priority = DALI_PRIORITY_BACKGROUND,
+                     mbed::Callback<void(DALIHandle, int)> done = NULL);
+    DALIHandle call(mbed::Callback<int()> func,
+                    DALIPriority priority = DALI_PRIORITY_USER,
+                    mbed::Callback<void(DALIHandle, int)> done = NULL);
+
+    /** Replace queued level and colour updates with newer ones
+     *
+     *   @param on  When on, a level (set_level, turn_off) or colour update
+     * to an address drops the one still queued for that address, so a fast
+     * stream of updates (e.g. from a slider) only sends the newest value
+     * once the bus is free. The dropped update completes with
+     * DALI_COALESCED.
+     *
+     *   NOTE: The newer update is queued behind the commands queued since
+     *   the one it replaces, so commands to overlapping addresses (e.g. a
+     *   group and one of its members) keep their order. It takes the higher
+     *   priority of the two. The completion callback of the dropped update
+     *   runs on the bus thread like any other. Until then the dropped
+     *   update holds its slot.
+     */
+    void set_coalescing(bool on);
+
+    /** Number of updates dropped by coalescing
+     */
+    uint32_t coalesced();
+
+    /** Cancel a command that has not started
+     *
+     *   @returns   true if it was cancelled
+     */
+    bool cancel(DALIHandle handle);
+
+    /** Take the result of a command
+     *
+     *   @returns   The result, DALI_PENDING if the command has not run (the
+     * result can be taken later), or DALI_EXPIRED
+     */
+    int result(DALIHandle handle);
+
+    /** Wait for a command and take its result
+     *
+     *   @param timeout_ms  How long to wait
+     *   @returns           As result()
+     *
+     *   NOTE: Without a bus thread this runs the queue itself
+     */
+    int wait(DALIHandle handle, uint32_t timeout_ms = osWaitForever);
+
+    /** Run the next queued command on the calling thread
+     *
+     *   @returns   false if nothing was queued
+     */
+    bool step();
+
+    /** Run queued commands until the queue is empty
+     *
+     *   @returns   Number of commands run
+     */
+    int run();
+
+    /** Number of commands waiting to run
+     */
+    int pending();
+
+#if MBED_CONF_RTOS_PRESENT
+    /** Start a thread that owns the bus and runs the queue
+     *
+     *   @param priority    Thread priority
+     *   @returns           osOK on success
+     */
+    osStatus start(osPriority priority = osPriorityAboveNormal);
+#endif
+
+private:
+    enum SlotState { SLOT_FREE, SLOT_QUEUED, SLOT_RUNNING, SLOT_DONE };
+
+    struct Slot {
+        DALICommand command;
+        mbed::Callback<void(DALIHandle, int)> done;
+        // Order of posting while queued, of completion once done
+        uint32_t seq;
+        int result;
+        uint16_t generation;
+        uint8_t state;
+        uint8_t priority;
+        // Replaced by a newer update, completes with DALI_COALESCED
+        bool coalesced;
+    };
+
+    // Slot of a handle, NULL if the handle is stale
+    Slot *find(DALIHandle handle);
+
+    DALIHandle handle_of(int index);
+
+    // Run a command on the bus
+    int execute(const DALICommand &command);
+
+    // Finish a slot taken off the queue
+    void complete(int index, int result);
+
+    // Updates that replace each other when coalescing, 0 for other commands
+    static int update_kind(DALICommandType type);
+
+#if MBED_CONF_RTOS_PRESENT
+    void thread_main();
+
+    Thread _thread;
+    bool _thread_started;
+#endif
+
+    DALIDriver &_dali;
+    Slot _slots[DALI_COMMAND_QUEUE_SIZE];
+    uint32_t _seq;
+    bool _coalescing;
+    uint32_t _coalesced;
+    // QUEUE_POSTED_FLAG wakes the bus thread, QUEUE_DONE_FLAG the waiters
+    EventFlags _flags;
+};
+
+#endif
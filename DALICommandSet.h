@@ -0,0 +1,150 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_COMMAND_SET_H
+#define DALI_COMMAND_SET_H
+
+#include "DALIDriver.h"
+
+/* Command set policies for the commissioning engine in DALIDriver
+ *
+ * Each policy maps the commissioning steps onto the frames of one standard,
+ * so the search and addressing code is written once and instantiated for
+ * both. Everything is resolved at compile time.
+ */
+
+/** iec62386-102 control gear, 16 bit forward frames
+ */
+struct GearCommands {
+    enum {
+        TERMINATE = ::TERMINATE,
+        INITIALISE = ::INITIALISE,
+        RANDOMISE = ::RANDOMISE,
+        COMPARE = ::COMPARE,
+        WITHDRAW = ::WITHDRAW,
+        SEARCHADDRH = ::SEARCHADDRH,
+        SEARCHADDRM = ::SEARCHADDRM,
+        SEARCHADDRL = ::SEARCHADDRL,
+        PROGRAM_SHORT_ADDR = ::PROGRAM_SHORT_ADDR,
+        QUERY_SHORT_ADDR = ::QUERY_SHORT_ADDR,
+        QUERY_RANDOM_ADDR_H = ::QUERY_RANDOM_ADDR_H,
+        QUERY_RANDOM_ADDR_M = ::QUERY_RANDOM_ADDR_M,
+        QUERY_RANDOM_ADDR_L = ::QUERY_RANDOM_ADDR_L,
+        // INITIALISE data selecting every unit / units without an address
+        SELECT_ALL = 0x00,
+        SELECT_UNADDRESSED = 0xFF
+    };
+
+    // INITIALISE data selecting the units at a short address
+    static uint8_t select(uint8_t addr)
+    {
+        return (addr << 1) | 1;
+    }
+
+    // PROGRAM SHORT ADDRESS data for a short address
+    static uint8_t short_addr(uint8_t addr)
+    {
+        return (addr << 1) | 1;
+    }
+
+    static void special(DALIDriver &dali, uint8_t cmd, uint8_t data)
+    {
+        dali.send_command_special(cmd, data);
+    }
+
+    static void special_twice(DALIDriver &dali, uint8_t cmd, uint8_t data)
+    {
+        dali.send_twice_special(cmd, data);
+    }
+
+    static void query(DALIDriver &dali, uint8_t addr, uint8_t opcode)
+    {
+        dali.send_command_standard(addr, opcode);
+    }
+
+    static uint32_t &search_addr(DALIDriver &dali)
+    {
+        return dali._search_addr;
+    }
+
+    static uint8_t &search_addr_known(DALIDriver &dali)
+    {
+        return dali._search_addr_known;
+    }
+};
+
+/** iec62386-103 control devices (input devices), 24 bit forward frames
+ */
+struct DeviceCommands {
+    enum {
+        TERMINATE = 0x00,
+        INITIALISE = 0x01,
+        RANDOMISE = 0x02,
+        COMPARE = 0x03,
+        WITHDRAW = 0x04,
+        SEARCHADDRH = 0x05,
+        SEARCHADDRM = 0x06,
+        SEARCHADDRL = 0x07,
+        PROGRAM_SHORT_ADDR = 0x08,
+        QUERY_SHORT_ADDR = 0x0A,
+        QUERY_RANDOM_ADDR_H = 0x39,
+        QUERY_RANDOM_ADDR_M = 0x3A,
+        QUERY_RANDOM_ADDR_L = 0x3B,
+        // INITIALISE data selecting every unit / units without an address
+        SELECT_ALL = 0xFF,
+        SELECT_UNADDRESSED = 0x7F
+    };
+
+    // INITIALISE data selecting the units at a short address
+    static uint8_t select(uint8_t addr)
+    {
+        return addr;
+    }
+
+    // PROGRAM SHORT ADDRESS data for a short address
+    static uint8_t short_addr(uint8_t addr)
+    {
+        return addr;
+    }
+
+    static void special(DALIDriver &dali, uint8_t cmd, uint8_t data)
+    {
+        dali.send_command_special_input(cmd, data);
+    }
+
+    static void special_twice(DALIDriver &dali, uint8_t cmd, uint8_t data)
+    {
+        dali.send_twice_special_input(cmd, data);
+    }
+
+    // Device commands go to instance 0xFE, the device itself
+    static void query(DALIDriver &dali, uint8_t addr, uint8_t opcode)
+    {
+        dali.send_command_standard_input(addr, 0xFE, opcode);
+    }
+
+    static uint32_t &search_addr(DALIDriver &dali)
+    {
+        return dali._search_addr_input;
+    }
+
+    static uint8_t &search_addr_known(DALIDriver &dali)
+    {
+        return dali._search_addr_input_known;
+    }
+};
+
+#endif
@@ -0,0 +1,101 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALICommissioner.h"
+#include <string.h>
+
+DALICommissioner::DALICommissioner(DALICommandQueue &queue, DALIDriver &dali)
+    : _queue(queue), _dali(dali), _queued(false), _started(false),
+      _paused(false), _begun(false), _resumed(false), _finished(false),
+      _due_us(0), _steps(0)
+{
+    memset(&_state, 0, sizeof(_state));
+}
+
+void DALICommissioner::start()
+{
+    _started = true;
+    _begun = false;
+    _resumed = false;
+    _finished = false;
+    _due_us = us_ticker_read();
+    _steps = 0;
+}
+
+void DALICommissioner::pause()
+{
+    _paused = true;
+}
+
+void DALICommissioner::resume()
+{
+    _paused = false;
+}
+
+bool DALICommissioner::poll()
+{
+    if (!_started || _paused || _queued || _finished) {
+        return false;
+    }
+    if ((int32_t)(us_ticker_read() - _due_us) < 0) {
+        return false;
+    }
+    _queued = true;
+    if (!_queue.call(mbed::callback(this, &DALICommissioner::step),
+                     DALI_PRIORITY_BACKGROUND,
+                     mbed::callback(this, &DALICommissioner::stepped))) {
+        _queued = false;
+        return false;
+    }
+    return true;
+}
+
+bool DALICommissioner::done()
+{
+    return _finished;
+}
+
+DALICommissionProgress DALICommissioner::progress()
+{
+    DALICommissionProgress progress;
+    progress.phase = (DALICommissionPhase)_state.phase;
+    progress.addr = _state.addr;
+    progress.added = _state.added;
+    progress.resumed = _resumed;
+    progress.steps = _steps;
+    return progress;
+}
+
+int DALICommissioner::step()
+{
+    if (!_begun) {
+        _resumed = _dali.commission_begin(_state);
+        _begun = true;
+    }
+    int hold = _dali.commission_step(_state);
+    _steps++;
+    if (hold == DALI_COMMISSION_FINISHED) {
+        _finished = true;
+        return hold;
+    }
+    _due_us = us_ticker_read() + hold * 1000;
+    return hold;
+}
+
+void DALICommissioner::stepped(DALIHandle handle, int result)
+{
+    _queued = false;
+}
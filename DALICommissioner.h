@@ -0,0 +1,106 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_COMMISSIONER_H
+#define DALI_COMMISSIONER_H
+
+#include "DALICommandQueue.h"
+#include "DALIDriver.h"
+#include "mbed.h"
+
+// Where a commissioning run is
+struct DALICommissionProgress {
+    DALICommissionPhase phase;
+    // Short address the phase is at
+    uint8_t addr;
+    // Units given a short address so far
+    uint8_t added;
+    // The run picked up from the checkpoint of an earlier one
+    bool resumed;
+    // Steps run since start()
+    uint32_t steps;
+};
+
+/** Commissions the bus one step at a time between other commands
+ *
+ * Each step of DALIDriver::commission_step() goes through a DALICommandQueue
+ * at DALI_PRIORITY_BACKGROUND, so a user command waits for at most the one
+ * step on the bus, and the lights that already have an address stay
+ * controllable while new ones are addressed. With storage set on the
+ * driver, a run stopped by a reboot picks up from its last checkpoint on
+ * the next start().
+ */
+class DALICommissioner {
+public:
+    /** Constructor
+     *
+     *   @param queue   Queue to run the steps on
+     *   @param dali    The driver of the queue
+     */
+    DALICommissioner(DALICommandQueue &queue, DALIDriver &dali);
+
+    /** Start commissioning, or pick up the run a checkpoint was saved by
+     *
+     *   NOTE: The checkpoint is read on the bus thread, with the first step
+     */
+    void start();
+
+    /** Stop queuing steps until resume(), the step on the bus completes
+     */
+    void pause();
+
+    void resume();
+
+    /** Queue the next step if it is due
+     *
+     *   @returns   true if a step was queued
+     *
+     *   NOTE: Call it every few milliseconds, e.g. from an EventQueue. Only
+     *   one step is queued at a time.
+     */
+    bool poll();
+
+    /** Check if the run has finished
+     */
+    bool done();
+
+    /** Get where the run is
+     */
+    DALICommissionProgress progress();
+
+private:
+    // Run the next step, runs on the bus thread
+    int step();
+
+    // Completion of step()
+    void stepped(DALIHandle handle, int result);
+
+    DALICommandQueue &_queue;
+    DALIDriver &_dali;
+    DALICommissionState _state;
+    volatile bool _queued;
+    bool _started;
+    bool _paused;
+    // The bus thread has read the checkpoint
+    volatile bool _begun;
+    volatile bool _resumed;
+    volatile bool _finished;
+    // us_ticker_read() when the next step is due
+    volatile uint32_t _due_us;
+    uint32_t _steps;
+};
+
+#endif
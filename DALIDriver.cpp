@@ -15,11 +15,80 @@
  */
 
 #include "DALIDriver.h"
+#include "DALICommandSet.h"
+#include <stddef.h>
+#include <string.h>
+
+// Steps of commission_scan()
+enum { SCAN_START, SCAN_L, SCAN_M, SCAN_H };
+
+// Steps of search_step()
+enum {
+    SEARCH_RESTART,
+    SEARCH_INITIALISE,
+    SEARCH_RANDOMISE,
+    SEARCH_NEXT,
+    SEARCH_FIRST_YES,
+    SEARCH_TOP,
+    SEARCH_BISECT,
+    SEARCH_POINT,
+    SEARCH_VERIFY,
+    SEARCH_WITHDRAW,
+    SEARCH_TERMINATE
+};
+
+// Steps of commission_search()
+enum {
+    SEARCH_START,
+    SEARCH_RUN,
+    SEARCH_RESUME,
+    SEARCH_RESUME_M,
+    SEARCH_RESUME_H,
+    SEARCH_RESUME_WITHDRAW
+};
+
+// Steps of commission_configure()
+enum { CONFIGURE_SCHEME, CONFIGURE_UNITS };
+
+// Steps of configure_input_step() per instance
+enum {
+    CONFIGURE_TYPE,
+    CONFIGURE_DISABLE,
+    CONFIGURE_ENABLE,
+    CONFIGURE_ENABLE_FILTERED,
+    CONFIGURE_FILTER,
+    CONFIGURE_STEPS
+};
+
+// A commissioning phase sent nothing, the next one runs at once
+#define COMMISSION_AGAIN (-2)
+// search_step() gave a unit a short address, or sent TERMINATE
+#define SEARCH_FOUND (-3)
+#define SEARCH_DONE (-4)
+// Time units take to pick a random address, and to take the event scheme
+#define COMMISSION_RANDOMISE_MS 100
+#define COMMISSION_SCHEME_MS 1000
+// Addresses scanned between checkpoints
+#define COMMISSION_SCAN_SAVE 8
 
 DALIDriver::DALIDriver(PinName out_pin, PinName in_pin, int baud,
                        bool idle_state)
-    : encoder(out_pin, in_pin, baud, idle_state)
+    : encoder(out_pin, in_pin, baud, idle_state), _search_addr(0),
+      _search_addr_known(0), _search_addr_input(0), _search_addr_input_known(0),
+      _incremental_search(true), _foreign_frames(0), _quiet(false),
+      _storage(NULL), _shadow(NULL)
 {
+    num_lights = 0;
+    num_inputs = 0;
+    memset(&_map, 0, sizeof(_map));
+    forget_dtrs();
+#if MBED_CONF_DALI_STATS
+    memset(&_stats, 0, sizeof(_stats));
+    _half_bit_us = 1000000 / (2 * baud);
+    _last_class = DALI_CLASS_STANDARD;
+    _last_send = 0;
+    _twice_pending = false;
+#endif
 }
 
 DALIDriver::~DALIDriver()
@@ -28,6 +97,10 @@ DALIDriver::~DALIDriver()
 
 bool DALIDriver::add_to_group(uint8_t addr, uint8_t group)
 {
+    bool member;
+    if (_shadow && _shadow->in_group(addr, group, member) && member) {
+        return true;
+    }
     // Send the command to add to group
     send_twice(addr, ADD_TO_GROUP + group);
     // Query upper or lower bits of gearGroups 16 bit variable
@@ -35,7 +108,9 @@ bool DALIDriver::add_to_group(uint8_t addr, uint8_t group)
     // Send query command
     send_command_standard(addr, cmd);
     // Receive gearGroups variable
-    uint8_t resp = encoder.recv();
+    int groups = recv_frame();
+    shadow_groups(addr, group, true, groups);
+    uint8_t resp = groups;
     // Group bit will be set if this light is a memeber of that group
     uint8_t mask = 1 << (group % 8);
     bool contained = resp & mask;
@@ -45,6 +120,10 @@ bool DALIDriver::add_to_group(uint8_t addr, uint8_t group)
 
 bool DALIDriver::remove_from_group(uint8_t addr, uint8_t group)
 {
+    bool member;
+    if (_shadow && _shadow->in_group(addr, group, member) && !member) {
+        return true;
+    }
     // Send the command to remove from group
     send_twice(addr, REMOVE_FROM_GROUP + group);
     // Query upper or lower bits of gearGroups 16 bit variable
@@ -52,7 +131,9 @@ bool DALIDriver::remove_from_group(uint8_t addr, uint8_t group)
     // Send query command
     send_command_standard(addr, cmd);
     // Receive gearGroups variable
-    uint8_t resp = encoder.recv();
+    int groups = recv_frame();
+    shadow_groups(addr, group, false, groups);
+    uint8_t resp = groups;
     // Group bit will be set if this light is a memeber of that group
     uint8_t mask = 1 << (group % 8);
     bool contained = resp & mask;
@@ -60,49 +141,250 @@ bool DALIDriver::remove_from_group(uint8_t addr, uint8_t group)
     return !contained;
 }
 
+int DALIDriver::query_groups(uint8_t addr, bool cached)
+{
+    bool member;
+    if (cached && _shadow && _shadow->in_group(addr, 0, member) &&
+        _shadow->in_group(addr, 8, member)) {
+        return _shadow->state(addr).groups;
+    }
+    send_command_standard(addr, QUERY_GEAR_GROUPS_L);
+    int low = recv_frame();
+    if (low < 0) {
+        return low;
+    }
+    send_command_standard(addr, QUERY_GEAR_GROUPS_H);
+    int high = recv_frame();
+    if (high < 0) {
+        return high;
+    }
+    if (_shadow) {
+        _shadow->set_groups(addr, false, low);
+        _shadow->set_groups(addr, true, high);
+    }
+    return (high << 8) | low;
+}
+
+// Record the groups of a luminaire in a table
+static void index_groups(DALIGroupTable &table, int addr, uint16_t groups)
+{
+    table.groups[addr] = groups;
+    for (int g = 0; g < DALI_GROUPS; g++) {
+        if (groups & (1 << g)) {
+            table.members[g] |= (uint64_t)1 << addr;
+        }
+    }
+}
+
+int DALIDriver::read_groups(DALIGroupTable &table)
+{
+    int missing = 0;
+    memset(&table, 0, sizeof(table));
+    for (int addr = 0; addr < num_lights; addr++) {
+        int groups = query_groups(addr);
+        if (groups < 0) {
+            missing++;
+            continue;
+        }
+        index_groups(table, addr, groups);
+    }
+    return missing;
+}
+
+int DALIDriver::set_groups(const DALIGroupTable &desired,
+                           DALIGroupTable &actual)
+{
+    // Copy in case actual is desired
+    uint16_t wanted[64];
+    memcpy(wanted, desired.groups, sizeof(wanted));
+    int mismatched = 0;
+    memset(&actual, 0, sizeof(actual));
+    for (int addr = 0; addr < num_lights; addr++) {
+        int groups = query_groups(addr);
+        if (groups < 0) {
+            mismatched++;
+            continue;
+        }
+        uint16_t add = wanted[addr] & ~groups;
+        uint16_t remove = groups & ~wanted[addr];
+        for (int g = 0; g < DALI_GROUPS; g++) {
+            if (add & (1 << g)) {
+                send_twice(addr, ADD_TO_GROUP + g);
+            } else if (remove & (1 << g)) {
+                send_twice(addr, REMOVE_FROM_GROUP + g);
+            }
+        }
+        if (add | remove) {
+            // Read back what the luminaire actually holds now
+            groups = query_groups(addr, false);
+        }
+        if (groups < 0) {
+            mismatched++;
+            continue;
+        }
+        if (groups != wanted[addr]) {
+            mismatched++;
+        }
+        index_groups(actual, addr, groups);
+    }
+    return mismatched;
+}
+
+static int count_bits(uint64_t bits)
+{
+    int count = 0;
+    for (; bits; bits &= bits - 1) {
+        count++;
+    }
+    return count;
+}
+
+bool DALIDriver::query_yes(uint8_t addr, uint8_t opcode)
+{
+    send_command_standard(addr, opcode);
+    return check_response(YES);
+}
+
+uint64_t DALIDriver::find_yes(uint8_t opcode, const DALIGroupTable *table)
+{
+    if (!query_yes(broadcast_addr, opcode)) {
+        return 0;
+    }
+    int lights = num_lights ? num_lights : 64;
+    uint64_t candidates =
+        lights < 64 ? ((uint64_t)1 << lights) - 1 : ~(uint64_t)0;
+    uint16_t yes_groups = 0;
+    if (table) {
+        for (int g = 0; g < DALI_GROUPS; g++) {
+            // A group of one costs as much as asking the luminaire
+            if (count_bits(table->members[g] & candidates) < 2) {
+                continue;
+            }
+            if (query_yes(get_group_addr(g), opcode)) {
+                yes_groups |= 1 << g;
+            } else {
+                candidates &= ~table->members[g];
+            }
+        }
+    }
+    uint64_t found = 0;
+    for (int g = 0; g < DALI_GROUPS; g++) {
+        if (!(yes_groups & (1 << g))) {
+            continue;
+        }
+        // The only luminaire left of a group that answered
+        uint64_t members = table->members[g] & candidates;
+        if (count_bits(members) == 1) {
+            found |= members;
+        }
+    }
+    for (int addr = 0; addr < lights; addr++) {
+        uint64_t bit = (uint64_t)1 << addr;
+        if ((candidates & bit) && !(found & bit) && query_yes(addr, opcode)) {
+            found |= bit;
+        }
+    }
+    return found;
+}
+
+void DALIDriver::find_faults(DALIFaults &faults, const DALIGroupTable *table,
+                             bool power_failure)
+{
+    faults.lamp_failure = find_yes(QUERY_LAMP_FAILURE, table);
+    faults.power_failure =
+        power_failure ? find_yes(QUERY_POWER_FAILURE, table) : 0;
+}
+
+void DALIDriver::shadow_groups(uint8_t addr, uint8_t group, bool member,
+                               int groups)
+{
+    if (!_shadow) {
+        return;
+    }
+    _shadow->set_group(addr, group, member);
+    if (groups >= 0) {
+        _shadow->set_groups(addr, group >= 8, groups);
+    }
+}
+
 void DALIDriver::set_level(uint8_t addr, uint8_t level)
 {
+    uint8_t current;
+    if (_shadow && _shadow->level(addr, current) && current == level) {
+        return;
+    }
     send_command_direct(addr, level);
+    if (_shadow) {
+        _shadow->set_level(addr, level);
+    }
 }
 
 void DALIDriver::turn_off(uint8_t addr)
 {
+    uint8_t current;
+    if (_shadow && _shadow->level(addr, current) && current == 0) {
+        return;
+    }
     send_command_standard(addr, OFF);
+    if (_shadow) {
+        _shadow->set_level(addr, 0);
+    }
 }
 
 uint8_t DALIDriver::get_level(uint8_t addr)
 {
+    uint8_t level;
+    if (_shadow && _shadow->level(addr, level)) {
+        return level;
+    }
     send_command_standard(addr, QUERY_ACTUAL_LEVEL);
-    uint8_t resp = encoder.recv();
+    int resp = recv_frame();
+    if (_shadow && resp >= 0) {
+        _shadow->set_actual_level(addr, resp);
+    }
     return resp;
 }
 
 uint8_t DALIDriver::get_error(uint8_t addr)
 {
     send_command_standard(addr, QUERY_ERROR);
-    uint8_t resp = encoder.recv();
+    uint8_t resp = recv_frame();
     return resp & 0x03;
 }
 
 uint8_t DALIDriver::get_phm(uint8_t addr)
 {
+    uint8_t phm;
+    if (_shadow && _shadow->phm(addr, phm)) {
+        return phm;
+    }
     send_command_standard(addr, QUERY_PHM);
-    uint8_t resp = encoder.recv();
+    int resp = recv_frame();
+    if (_shadow && resp >= 0) {
+        _shadow->set_phm(addr, resp);
+    }
     return resp;
 }
 
 uint8_t DALIDriver::get_fade(uint8_t addr)
 {
+    uint8_t fade;
+    if (_shadow && _shadow->fade(addr, fade)) {
+        return fade;
+    }
     send_command_standard(addr, QUERY_FADE);
-    uint8_t resp = encoder.recv();
+    int resp = recv_frame();
+    if (_shadow && resp >= 0 && addr < DALI_SHADOW_GEAR) {
+        _shadow->set_fade(addr, resp);
+    }
     return resp;
 }
 
 ColorType DALIDriver::get_color_type(uint8_t addr) {
-    uint8_t channels = query_rgbwaf_channels(addr);
-    if (channels == 4) {
+    uint8_t features = query_color_type_features(addr);
+    if ((features & 0xE0) >> 5 == 4) {
         return RGB;
-    } else if (query_temperature_capable(addr)) {
+    } else if (features & 0x02) {
         return TEMPERATURE;
     }
     return UNSUPPORTED;
@@ -110,11 +392,14 @@ ColorType DALIDriver::get_color_type(uint8_t addr) {
 
 uint8_t DALIDriver::query_color_type_features(uint8_t addr)
 {
+    if (addr < DALI_MAP_UNITS) {
+        return get_capabilities(addr).colour_features;
+    }
     encoder.set_recv_frame_length(8);
     //send command to enable device type 8
     send_command_special(ENABLE_DEVICE_TYPE, 0x08);
     send_command_standard(addr, QUERY_COLOR_TYPE_FEATURES);
-    uint8_t resp = encoder.recv();
+    uint8_t resp = recv_frame();
     return resp;
 }
 
@@ -134,7 +419,7 @@ bool DALIDriver::query_temperature_capable(uint8_t addr)
 void DALIDriver::set_color_temp(uint8_t addr, uint16_t temp)
 {
     // Calculate Mirek from Kelvin
-    temp = 1000000/temp;
+    temp = colour_mirek(addr, temp);
     // Set Temp
     send_command_special(DTR0, temp & 0x00FF);
     send_command_special(DTR1, temp >> 8);
@@ -146,10 +431,12 @@ void DALIDriver::set_color_temp(uint8_t addr, uint16_t temp)
 
 void DALIDriver::set_color_scene(uint8_t addr, uint8_t scene, uint16_t temp)
 {
+    if (!colour_capable(addr)) {
+        return;
+    }
     set_color_temp(addr, temp);    
     // Get the current scene level
-    send_command_standard(addr, QUERY_SCENE_LEVEL + scene);
-    uint8_t scene_level = encoder.recv();
+    uint8_t scene_level = get_scene_level(addr, scene);
     send_command_special(DTR0, scene_level);
 
     // Store what is in the temperorary color as scene color and also scene level to DTR0
@@ -158,11 +445,22 @@ void DALIDriver::set_color_scene(uint8_t addr, uint8_t scene, uint16_t temp)
 
 void DALIDriver::set_color(uint8_t addr, uint16_t temp)
 {
+    if (!colour_capable(addr)) {
+        return;
+    }
+    uint16_t mirek;
+    if (_shadow && _shadow->colour_tc(addr, mirek) &&
+        mirek == colour_mirek(addr, temp)) {
+        return;
+    }
     set_color_temp(addr, temp);    
     // Activate color
     //send command to enable device type 8
     send_command_special(ENABLE_DEVICE_TYPE, 0x08);
     send_command_standard(addr, COLOR_ACTIVATE); 
+    if (_shadow) {
+        _shadow->set_colour_tc(addr, colour_mirek(addr, temp));
+    }
 }
 
 void DALIDriver::set_color_temp(uint8_t addr, uint8_t r, uint8_t g, uint8_t b, uint8_t dim)
@@ -184,10 +482,12 @@ void DALIDriver::set_color_temp(uint8_t addr, uint8_t r, uint8_t g, uint8_t b, u
     
 void DALIDriver::set_color_scene(uint8_t addr, uint8_t scene, uint8_t r, uint8_t g, uint8_t b, uint8_t dim)
 {
+    if (!colour_capable(addr)) {
+        return;
+    }
     set_color_temp(addr, r, g, b, dim);
     // Get the current scene level
-    send_command_standard(addr, QUERY_SCENE_LEVEL + scene);
-    uint8_t scene_level = encoder.recv();
+    uint8_t scene_level = get_scene_level(addr, scene);
     send_command_special(DTR0, scene_level);
 
     // Store what is in the temperorary color as scene color and also scene level to DTR0
@@ -196,71 +496,232 @@ void DALIDriver::set_color_scene(uint8_t addr, uint8_t scene, uint8_t r, uint8_t
     
 void DALIDriver::set_color(uint8_t addr, uint8_t r, uint8_t g, uint8_t b, uint8_t dim)
 {
+    if (!colour_capable(addr)) {
+        return;
+    }
+    uint8_t rgb[4] = {r, g, b, dim};
+    uint8_t current[4];
+    if (_shadow && _shadow->colour_rgb(addr, current) &&
+        memcmp(current, rgb, sizeof(rgb)) == 0) {
+        return;
+    }
     set_color_temp(addr, r, g, b, dim);
     // Activate color
     //send command to enable device type 8
     send_command_special(ENABLE_DEVICE_TYPE, 0x08);
     send_command_standard(addr, COLOR_ACTIVATE); 
+    if (_shadow) {
+        _shadow->set_colour_rgb(addr, rgb);
+    }
 }
     
 
 uint32_t DALIDriver::recv()
 {
-    return encoder.recv();
+    return recv_frame();
+}
+
+int DALIDriver::recv_frame()
+{
+    uint32_t start = stats_now();
+    int response = encoder.recv();
+    record_recv(response, start);
+    return response;
+}
+
+const DALIStats &DALIDriver::get_stats()
+{
+#if MBED_CONF_DALI_STATS
+    return _stats;
+#else
+    static const DALIStats none = DALIStats();
+    return none;
+#endif
+}
+
+void DALIDriver::reset_stats()
+{
+#if MBED_CONF_DALI_STATS
+    memset(&_stats, 0, sizeof(_stats));
+#endif
+}
+
+uint32_t DALIDriver::stats_now()
+{
+#if MBED_CONF_DALI_STATS
+    return us_ticker_read();
+#else
+    return 0;
+#endif
+}
+
+void DALIDriver::record_send(DALIFrameClass cls, BusScheduler::FrameKind kind,
+                             int bits, uint32_t start)
+{
+#if MBED_CONF_DALI_STATS
+    // Both frames of a pair count as send-twice
+    if (kind == BusScheduler::SEND_TWICE) {
+        cls = DALI_CLASS_SEND_TWICE;
+        _twice_pending = true;
+    } else if (_twice_pending) {
+        cls = DALI_CLASS_SEND_TWICE;
+        _twice_pending = false;
+    }
+    DALIClassStats &stats = _stats.classes[cls];
+    stats.frames++;
+    // Start bit and two half bits per data bit
+    stats.wire_us += (1 + bits) * 2 * _half_bit_us;
+    uint32_t now = us_ticker_read();
+    stats.wait_us += now - start;
+    _last_class = cls;
+    _last_send = now;
+#endif
+}
+
+void DALIDriver::record_recv(int response, uint32_t start)
+{
+#if MBED_CONF_DALI_STATS
+    uint32_t now = us_ticker_read();
+    DALIClassStats &stats = _stats.classes[_last_class];
+    if (response == RECV_NO_RESPONSE) {
+        stats.timeouts++;
+    } else {
+        if (response == RECV_FRAME_ERROR) {
+            stats.errors++;
+        } else {
+            stats.replies++;
+        }
+        // Start bit and 8 data bits
+        stats.wire_us += (1 + 8) * 2 * _half_bit_us;
+    }
+    stats.wait_us += now - start;
+    _stats.latency[dali_latency_bucket(now - _last_send)]++;
+#endif
 }
 
 uint32_t DALIDriver::query_instances(uint8_t addr)
 {
     encoder.set_recv_frame_length(8);
     send_command_standard_input(addr, 0xFE, 0x35);
-    uint32_t resp = encoder.recv();
+    uint32_t resp = recv_frame();
     return resp;
 }
 
 void DALIDriver::turn_on(uint8_t addr)
 {
     send_command_standard(addr, ON_AND_STEP_UP);
+    if (_shadow) {
+        // Goes to the last active level, which is not kept
+        _shadow->forget_level(addr);
+    }
 }
 
 void DALIDriver::send_twice(uint8_t addr, uint8_t opcode)
 {
+    send_command_standard(addr, opcode, BusScheduler::SEND_TWICE);
     send_command_standard(addr, opcode);
-    send_command_standard(addr, opcode);
+}
+
+void DALIDriver::send_twice_special(uint8_t address, uint8_t opcode)
+{
+    send_command_special(address, opcode, BusScheduler::SEND_TWICE);
+    send_command_special(address, opcode);
+}
+
+void DALIDriver::send_twice_input(uint8_t addr, uint8_t inst, uint8_t opcode)
+{
+    send_command_standard_input(addr, inst, opcode, BusScheduler::SEND_TWICE);
+    send_command_standard_input(addr, inst, opcode);
+}
+
+void DALIDriver::send_twice_special_input(uint8_t instance, uint8_t opcode)
+{
+    send_command_special_input(instance, opcode, BusScheduler::SEND_TWICE);
+    send_command_special_input(instance, opcode);
 }
 
 void DALIDriver::set_fade_time(uint8_t addr, uint8_t time)
 {
+    uint8_t fade;
+    if (_shadow && _shadow->fade(addr, fade) && (fade >> 4) == time) {
+        return;
+    }
     // Send twice command
     send_command_special(DTR0, time);
     send_twice(addr, SET_FADE_TIME);
+    if (_shadow) {
+        _shadow->set_fade_time(addr, time);
+    }
 }
 
 void DALIDriver::set_fade_rate(uint8_t addr, uint8_t rate)
 {
+    uint8_t fade;
+    if (_shadow && _shadow->fade(addr, fade) && (fade & 0x0F) == rate) {
+        return;
+    }
     // Send twice command
     send_command_special(DTR0, rate);
     send_twice(addr, SET_FADE_RATE);
+    if (_shadow) {
+        _shadow->set_fade_rate(addr, rate);
+    }
 }
 
 void DALIDriver::set_scene(uint8_t addr, uint8_t scene, uint8_t level)
 {
+    uint8_t current;
+    if (_shadow && _shadow->scene_level(addr, scene, current) &&
+        current == level) {
+        return;
+    }
     send_command_special(DTR0, level);
     // Send twice command
     send_twice(addr, SET_SCENE + scene);
+    if (_shadow) {
+        _shadow->set_scene_level(addr, scene, level);
+    }
 }
 
 void DALIDriver::remove_from_scene(uint8_t addr, uint8_t scene)
 {
+    uint8_t current;
+    if (_shadow && _shadow->scene_level(addr, scene, current) &&
+        current == 0xFF) {
+        return;
+    }
     send_twice(addr, REMOVE_FROM_SCENE + scene);
+    if (_shadow) {
+        _shadow->set_scene_level(addr, scene, 0xFF);
+    }
+}
+
+uint8_t DALIDriver::get_scene_level(uint8_t addr, uint8_t scene)
+{
+    uint8_t level;
+    if (_shadow && _shadow->scene_level(addr, scene, level)) {
+        return level;
+    }
+    send_command_standard(addr, QUERY_SCENE_LEVEL + scene);
+    int resp = recv_frame();
+    if (_shadow && resp >= 0 && addr < DALI_SHADOW_GEAR) {
+        _shadow->set_scene_level(addr, scene, resp);
+    }
+    return resp;
 }
 
 void DALIDriver::go_to_scene(uint8_t addr, uint8_t scene)
 {
     send_twice(addr, GO_TO_SCENE + scene);
-    //send command to enable device type 8
-    send_command_special(ENABLE_DEVICE_TYPE, 0x08);
-    // Activate color scene
-    send_command_standard(addr, COLOR_ACTIVATE); 
+    if (colour_capable(addr)) {
+        //send command to enable device type 8
+        send_command_special(ENABLE_DEVICE_TYPE, 0x08);
+        // Activate color scene
+        send_command_standard(addr, COLOR_ACTIVATE); 
+    }
+    if (_shadow) {
+        _shadow->go_to_scene(addr, scene);
+    }
 }
 
 event_msg DALIDriver::parse_event(uint32_t data)
@@ -272,53 +733,223 @@ event_msg DALIDriver::parse_event(uint32_t data)
     return msg;
 }
 
-void DALIDriver::attach(mbed::Callback<void(uint32_t)> status_cb)
+void DALIDriver::attach(mbed::Callback<void(uint32_t)> status_cb,
+                        EventQueue *queue)
 {
-    quiet_mode(false);
-    encoder.attach(status_cb);
+    if (_quiet) {
+        quiet_mode(false);
+    }
+    encoder.attach(status_cb, queue);
 }
 
 void DALIDriver::detach()
 {
-    quiet_mode(true);
     encoder.detach();
 }
 
 void DALIDriver::reattach()
 {
-    quiet_mode(false);
     encoder.reattach();
 }
 
-void DALIDriver::send_command_special(uint8_t address, uint8_t opcode)
+void DALIDriver::send_command_special(uint8_t address, uint8_t opcode,
+                                      BusScheduler::FrameKind kind)
+{
+    send_frame(((uint16_t)address << 8) | opcode, 16, kind);
+}
+
+void DALIDriver::send_command_special_input(uint8_t instance, uint8_t opcode,
+                                            BusScheduler::FrameKind kind)
+{
+    send_frame(((uint32_t)0xC1 << 16) | ((uint16_t)instance << 8) | opcode, 24,
+               kind);
+}
+
+void DALIDriver::send_frame(uint32_t frame, int bits,
+                            BusScheduler::FrameKind kind)
+{
+    uint32_t foreign = encoder.foreign_frames();
+    if (foreign != _foreign_frames) {
+        // Another control device may have loaded the DTRs or moved the
+        // search address
+        _foreign_frames = foreign;
+        forget_dtrs();
+        _search_addr_known = 0;
+        _search_addr_input_known = 0;
+    }
+    DALIFrameClass cls;
+    if (bits == 24) {
+        cls = DALI_CLASS_INPUT;
+        if (!track_input(frame)) {
+            return;
+        }
+    } else {
+        uint8_t address = frame >> 8;
+        if ((address & 0xE1) == 0xA1 || (address & 0xE1) == 0xC1) {
+            cls = DALI_CLASS_SPECIAL;
+        } else if (address & 0x01) {
+            cls = DALI_CLASS_STANDARD;
+        } else {
+            cls = DALI_CLASS_DIRECT;
+        }
+        if (!track_gear(cls, frame)) {
+            return;
+        }
+    }
+    uint32_t start = stats_now();
+    if (bits == 24) {
+        encoder.send_24(frame, kind);
+    } else {
+        encoder.send(frame, kind);
+    }
+    record_send(cls, kind, bits, start);
+}
+
+bool DALIDriver::track_gear(DALIFrameClass cls, uint16_t frame)
+{
+    uint8_t address = frame >> 8;
+    uint8_t opcode = frame & 0xFF;
+    if (cls == DALI_CLASS_STANDARD) {
+        switch (opcode) {
+            case STORE_ACTUAL_LEVEL_IN_DTR0:
+            case READ_MEM_LOC:
+                // Set DTR0, or move it on to the next memory location
+                _dtr.known &= ~1;
+                break;
+            case QUERY_COLOR_VALUE:
+                // DT8 gear puts the colour value in DTR0 and DTR1
+                _dtr.known &= ~3;
+                break;
+        }
+        return true;
+    }
+    if (cls != DALI_CLASS_SPECIAL) {
+        return true;
+    }
+    switch (address) {
+        case SEARCHADDRH:
+            track_search_byte(_search_addr, _search_addr_known, 2, opcode);
+            break;
+        case SEARCHADDRM:
+            track_search_byte(_search_addr, _search_addr_known, 1, opcode);
+            break;
+        case SEARCHADDRL:
+            track_search_byte(_search_addr, _search_addr_known, 0, opcode);
+            break;
+        case INITIALISE:
+        case TERMINATE:
+            // Gear entering or leaving initialisation may hold anything
+            _search_addr_known = 0;
+            break;
+        case DTR0:
+            return load_dtr(_dtr, 0, opcode);
+        case DTR1:
+            return load_dtr(_dtr, 1, opcode);
+        case DTR2:
+            return load_dtr(_dtr, 2, opcode);
+    }
+    return true;
+}
+
+bool DALIDriver::track_input(uint32_t frame)
+{
+    uint8_t address = frame >> 16;
+    uint8_t instance = (frame >> 8) & 0xFF;
+    uint8_t opcode = frame & 0xFF;
+    if (address != 0xC1) {
+        if (instance == 0xFE && opcode == 0x3C) {
+            // READ MEMORY LOCATION moves DTR0 on
+            _dtr_input.known &= ~1;
+        }
+        return true;
+    }
+    switch (instance) {
+        case 0x05:
+            track_search_byte(_search_addr_input, _search_addr_input_known, 2,
+                              opcode);
+            break;
+        case 0x06:
+            track_search_byte(_search_addr_input, _search_addr_input_known, 1,
+                              opcode);
+            break;
+        case 0x07:
+            track_search_byte(_search_addr_input, _search_addr_input_known, 0,
+                              opcode);
+            break;
+        case 0x00:
+        case 0x01:
+            // TERMINATE and INITIALISE
+            _search_addr_input_known = 0;
+            break;
+        case 0x30:
+        case 0x31:
+        case 0x32:
+            // DTR0-2
+            return load_dtr(_dtr_input, instance - 0x30, opcode);
+    }
+    return true;
+}
+
+void DALIDriver::track_search_byte(uint32_t &addr, uint8_t &known, int byte,
+                                   uint8_t value)
+{
+    int shift = byte * 8;
+    addr = (addr & ~((uint32_t)0xFF << shift)) | ((uint32_t)value << shift);
+    known |= 1 << byte;
+}
+
+void DALIDriver::forget_dtrs()
+{
+    _dtr.known = 0;
+    _dtr_input.known = 0;
+}
+
+void DALIDriver::set_incremental_search(bool on)
+{
+    _incremental_search = on;
+}
+
+bool DALIDriver::load_dtr(DTRState &dtr, int n, uint8_t value)
 {
-    encoder.send(((uint16_t)address << 8) | opcode);
+    uint32_t now = us_ticker_read();
+    if ((dtr.known & (1 << n)) && dtr.value[n] == value &&
+        now - dtr.time[n] < DALI_DTR_HOLD_MS * 1000) {
+        return false;
+    }
+    dtr.value[n] = value;
+    dtr.known |= 1 << n;
+    dtr.time[n] = now;
+    return true;
 }
 
-void DALIDriver::send_command_special_input(uint8_t instance, uint8_t opcode)
+bool DALIDriver::search_byte_matches(uint32_t addr, uint8_t known, int byte,
+                                     uint32_t val)
 {
-    encoder.send_24(((uint32_t)0xC1 << 16) | ((uint16_t)instance << 8) |
-                    opcode);
+    int shift = byte * 8;
+    return (known & (1 << byte)) &&
+           ((addr >> shift) & 0xFF) == ((val >> shift) & 0xFF);
 }
 
 void DALIDriver::send_command_standard_input(uint8_t address, uint8_t instance,
-                                             uint8_t opcode)
+                                             uint8_t opcode,
+                                             BusScheduler::FrameKind kind)
 {
     // Get the upper bit
     uint8_t mask = address & 0x80;
     // Change address to have 1 in LSb to signify 'standard command'
     address = mask | ((address << 1) + 1);
-    encoder.send_24(((uint32_t)address << 16) | ((uint16_t)instance << 8) |
-                    opcode);
+    send_frame(((uint32_t)address << 16) | ((uint16_t)instance << 8) | opcode,
+               24, kind);
 }
 
-void DALIDriver::send_command_standard(uint8_t address, uint8_t opcode)
+void DALIDriver::send_command_standard(uint8_t address, uint8_t opcode,
+                                       BusScheduler::FrameKind kind)
 {
     // Get the upper bit
     uint8_t mask = address & 0x80;
     // Change address to have 1 in LSb to signify 'standard command'
     address = mask | ((address << 1) + 1);
-    encoder.send(((uint16_t)address << 8) | opcode);
+    send_frame(((uint16_t)address << 8) | opcode, 16, kind);
 }
 
 void DALIDriver::send_command_direct(uint8_t address, uint8_t opcode)
@@ -327,12 +958,16 @@ void DALIDriver::send_command_direct(uint8_t address, uint8_t opcode)
     uint8_t mask = address & 0x80;
     // Change address to have 0 in LSb to signify 'direct arc power'
     address = mask | (address << 1);
-    encoder.send(((uint16_t)address << 8) | opcode);
+    send_frame(((uint16_t)address << 8) | opcode, 16);
 }
 
 bool DALIDriver::check_response(uint8_t expected)
 {
-    int response = encoder.recv();
+    int response = recv_frame();
+    // Several devices answering at once garble the frame, or overlap into
+    // one that looks longer, but for yes/no queries that still means yes
+    if (expected == YES)
+        return response != RECV_NO_RESPONSE;
     if (response < 0)
         return false;
     return (response == expected);
@@ -343,21 +978,41 @@ int DALIDriver::getIndexOfLogicalUnit(uint8_t addr)
     send_command_special(DTR1, 0x00);
     send_command_special(DTR0, 0x1A);
     send_command_special(READ_MEM_LOC, (addr << 1) + 1);
-    return encoder.recv();
+    return recv_frame();
 }
 
+template <class Commands>
 void DALIDriver::set_search_address(uint32_t val)
 {
-    send_command_special(SEARCHADDRH, val >> 16);
-    send_command_special(SEARCHADDRM, (val >> 8) & (0x00FF));
-    send_command_special(SEARCHADDRL, val & 0x0000FF);
+    while (search_address_step<Commands>(val)) {
+    }
 }
 
-void DALIDriver::set_search_address_input(uint32_t val)
+template <class Commands>
+bool DALIDriver::search_address_step(uint32_t val)
 {
-    send_command_special_input(0x05, val >> 16);
-    send_command_special_input(0x06, (val >> 8) & (0x00FF));
-    send_command_special_input(0x07, val & 0x0000FF);
+    uint32_t addr = Commands::search_addr(*this);
+    uint8_t &known = Commands::search_addr_known(*this);
+    if (!_incremental_search) {
+        // A new search address is sent whole
+        for (int byte = 0; byte < 3; byte++) {
+            if ((known & (1 << byte)) &&
+                !search_byte_matches(addr, known, byte, val)) {
+                known = 0;
+            }
+        }
+    }
+    // Only send the bytes the units don't already hold
+    if (!search_byte_matches(addr, known, 2, val)) {
+        Commands::special(*this, Commands::SEARCHADDRH, val >> 16);
+    } else if (!search_byte_matches(addr, known, 1, val)) {
+        Commands::special(*this, Commands::SEARCHADDRM, (val >> 8) & (0x00FF));
+    } else if (!search_byte_matches(addr, known, 0, val)) {
+        Commands::special(*this, Commands::SEARCHADDRL, val & 0x0000FF);
+    } else {
+        return false;
+    }
+    return true;
 }
 
 uint8_t DALIDriver::get_group_addr(uint8_t group_number)
@@ -369,6 +1024,7 @@ uint8_t DALIDriver::get_group_addr(uint8_t group_number)
 
 void DALIDriver::quiet_mode(bool on)
 {
+    _quiet = on;
     if (on) {
         send_command_standard_input(0xFF, 0xFE, 0x1D);
     } else {
@@ -379,9 +1035,9 @@ void DALIDriver::quiet_mode(bool on)
 float DALIDriver::get_temperature(uint8_t addr, uint8_t instance)
 {
     send_command_standard_input(addr, instance, 0x8C);
-    int temp = encoder.recv();
+    int temp = recv_frame();
     send_command_standard_input(addr, instance, 0x8D);
-    int temp2 = encoder.recv();
+    int temp2 = recv_frame();
     // Temperature, 10 bit, resolution 0.1C, -5C - 60C (value of 0 = -5C, 1 =
     // -4.9C, etc.)
     return ((float)((temp << 2) | (temp2 >> 6)) - 50.0f) * 0.1f;
@@ -390,7 +1046,7 @@ float DALIDriver::get_temperature(uint8_t addr, uint8_t instance)
 float DALIDriver::get_humidity(uint8_t addr, uint8_t instance)
 {
     send_command_standard_input(addr, instance, 0x8C);
-    int humidity = encoder.recv();
+    int humidity = recv_frame();
     // Humidity, 8 bit, resolution 0.5%, 0-100%
     return ((float)humidity) / 2.0f;
 }
@@ -398,7 +1054,8 @@ float DALIDriver::get_humidity(uint8_t addr, uint8_t instance)
 int DALIDriver::init_lights()
 {
     quiet_mode(true);
-    // TODO: does this need to happen every time controller boots?
+    // Searching takes long on a full bus, init() skips this when the saved
+    // bus map still holds
     num_lights = assign_addresses();
     return num_lights;
 }
@@ -412,30 +1069,339 @@ int DALIDriver::init_inputs()
 
 int DALIDriver::init()
 {
-    num_logical_units = num_lights + num_inputs;
+    if (load_map() && validate_map()) {
+        num_lights = _map.num_lights;
+        num_inputs = _map.num_inputs;
+        num_logical_units = num_lights + num_inputs;
+        shadow_limits();
+        return num_logical_units;
+    }
+    memset(&_map, 0, sizeof(_map));
+    if (_shadow) {
+        _shadow->invalidate();
+    }
     init_lights();
     init_inputs();
+    num_logical_units = num_lights + num_inputs;
+    for (int i = 0; i < num_lights; i++) {
+        record_light(i);
+    }
     // Set the event scheme for all events to be address / instance id / event
     // info
     set_event_scheme(0xFF, 0xFF, 0x01);
     wait(1);
     for (int i = num_lights; i < num_inputs + num_lights; i++) {
-        int inst = query_instances(i);
-        for (int j = 0; j < inst; j++) {
-            int inst_type = get_instance_type(i, j);
+        configure_input(i);
+    }
+    save_map();
+    return num_lights + num_inputs;
+}
+
+void DALIDriver::record_light(uint8_t addr)
+{
+    int step = 0;
+    do {
+        step = record_light_step(addr, step);
+    } while (step);
+}
+
+int DALIDriver::record_light_step(uint8_t addr, int step)
+{
+    DALIUnitRecord &unit = _map.units[addr];
+    switch (step) {
+        case 0:
+            send_command_standard(addr, QUERY_DEVICE_TYPE);
+            unit.device_type = recv_frame();
+            return 1;
+        case 1: {
+            send_command_standard(addr, QUERY_MIN_LEVEL);
+            int min_level = recv_frame();
+            unit.min_level = min_level > 0 && min_level < 0xFF ? min_level : 0;
+            return 2;
+        }
+        case 2: {
+            send_command_standard(addr, QUERY_MAX_LEVEL);
+            int max_level = recv_frame();
+            // Not known unless both were read
+            if (!unit.min_level || max_level < unit.min_level ||
+                max_level == 0xFF) {
+                max_level = 0;
+            }
+            unit.max_level = max_level;
+            if (_shadow) {
+                _shadow->set_limits(addr, unit.min_level, unit.max_level);
+            }
+            return 3;
+        }
+        case 3: {
+            // Only DT8 gear answers, also when it has several device types
+            send_command_special(ENABLE_DEVICE_TYPE, 0x08);
+            send_command_standard(addr, QUERY_COLOR_TYPE_FEATURES);
+            int features = recv_frame();
+            if (features == RECV_FRAME_ERROR) {
+                // Ask again when the capabilities are needed
+                return 0;
+            }
+            unit.capabilities = DALI_CAP_KNOWN;
+            unit.colour_features = 0;
+            unit.tc_coolest = 0;
+            unit.tc_warmest = 0;
+            if (features < 0) {
+                return 0;
+            }
+            unit.capabilities |= DALI_CAP_COLOUR;
+            unit.colour_features = features;
+            return (features & 0x02) ? 4 : 0;
+        }
+        case 4: {
+            int coolest = query_colour_value(addr, COLOUR_VALUE_TC_COOLEST);
+            // MASK if the gear does not know
+            unit.tc_coolest = coolest > 0 && coolest != 0xFFFF ? coolest : 0;
+            return 5;
+        }
+        default: {
+            int warmest = query_colour_value(addr, COLOUR_VALUE_TC_WARMEST);
+            unit.tc_warmest = warmest > 0 && warmest != 0xFFFF ? warmest : 0;
+            return 0;
+        }
+    }
+}
+
+int DALIDriver::query_colour_value(uint8_t addr, uint8_t selector)
+{
+    send_command_special(DTR0, selector);
+    send_command_special(ENABLE_DEVICE_TYPE, 0x08);
+    send_command_standard(addr, QUERY_COLOR_VALUE);
+    int msb = recv_frame();
+    if (msb < 0) {
+        return msb;
+    }
+    // The gear leaves the LSB in DTR0. Read it back at once: a step of its
+    // own would let queued commands, or another controller, load DTR0 first.
+    send_command_standard(addr, QUERY_CONTENT_DTR0);
+    int lsb = recv_frame();
+    if (lsb < 0) {
+        return lsb;
+    }
+    return (msb << 8) | lsb;
+}
+
+const DALIUnitRecord &DALIDriver::get_capabilities(uint8_t addr)
+{
+    addr %= DALI_MAP_UNITS;
+    // Input devices are recorded when they are configured
+    if (!(_map.units[addr].capabilities & DALI_CAP_KNOWN) &&
+        (addr < num_lights || addr >= num_lights + num_inputs)) {
+        record_light(addr);
+    }
+    return _map.units[addr];
+}
+
+bool DALIDriver::colour_capable(uint8_t addr)
+{
+    if (addr < DALI_MAP_UNITS) {
+        return get_capabilities(addr).capabilities & DALI_CAP_COLOUR;
+    }
+    // A group or broadcast, unless every luminaire is known not to be DT8
+    for (int i = 0; i < num_lights; i++) {
+        uint8_t caps = _map.units[i].capabilities;
+        if (!(caps & DALI_CAP_KNOWN) || (caps & DALI_CAP_COLOUR)) {
+            return true;
+        }
+    }
+    return num_lights == 0;
+}
+
+uint16_t DALIDriver::colour_mirek(uint8_t addr, uint16_t kelvin)
+{
+    // Below 16 Kelvin the value does not fit, 0xFFFF is MASK
+    uint16_t mirek = kelvin > 15 ? 1000000 / kelvin : 0xFFFE;
+    if (addr < DALI_MAP_UNITS) {
+        const DALIUnitRecord &unit = get_capabilities(addr);
+        if (unit.tc_coolest && mirek < unit.tc_coolest) {
+            mirek = unit.tc_coolest;
+        }
+        if (unit.tc_warmest && mirek > unit.tc_warmest) {
+            mirek = unit.tc_warmest;
+        }
+    }
+    return mirek;
+}
+
+void DALIDriver::configure_input(uint8_t addr)
+{
+    int step = 0;
+    do {
+        step = configure_input_step(addr, step);
+    } while (step);
+}
+
+int DALIDriver::configure_input_step(uint8_t addr, int step)
+{
+    DALIUnitRecord &unit = _map.units[addr];
+    if (step == 0) {
+        int inst = query_instances(addr);
+        unit.num_instances = inst;
+        memset(unit.instance_types, UNKNOWN_INSTANCE_TYPE, DALI_MAP_INSTANCES);
+        return inst > 0 ? 1 : 0;
+    }
+    // The steps of instance j start at 1 + j * CONFIGURE_STEPS
+    int j = (step - 1) / CONFIGURE_STEPS;
+    int base = 1 + j * CONFIGURE_STEPS;
+    int next = j + 1 < unit.num_instances ? base + CONFIGURE_STEPS : 0;
+    switch (step - base) {
+        case CONFIGURE_TYPE: {
+            int inst_type = get_instance_type(addr, j);
+            if (j < DALI_MAP_INSTANCES) {
+                unit.instance_types[j] = inst_type;
+            }
+            // Disable lumen
             if (inst_type == 4) {
-                // Disable lumen
-                disable_instance(i, j);
-                continue;
+                return base + CONFIGURE_DISABLE;
             }
-            enable_instance(i, j);
             // Filter events for PIR, only movement/no movement
-            if (inst_type == 3) {
-                set_event_filter(i, j, 0x1C);
+            return base + (inst_type == 3 ? CONFIGURE_ENABLE_FILTERED
+                                          : CONFIGURE_ENABLE);
+        }
+        case CONFIGURE_DISABLE:
+            disable_instance(addr, j);
+            return next;
+        case CONFIGURE_ENABLE:
+            enable_instance(addr, j);
+            return next;
+        case CONFIGURE_ENABLE_FILTERED:
+            enable_instance(addr, j);
+            return base + CONFIGURE_FILTER;
+        default:
+            set_event_filter(addr, j, 0x1C);
+            return next;
+    }
+}
+
+void DALIDriver::set_storage(DALIStorage *storage)
+{
+    _storage = storage;
+}
+
+void DALIDriver::set_shadow(DALIShadow *shadow)
+{
+    _shadow = shadow;
+    shadow_limits();
+}
+
+void DALIDriver::shadow_limits()
+{
+    for (int i = 0; _shadow && i < num_lights; i++) {
+        _shadow->set_limits(i, _map.units[i].min_level,
+                            _map.units[i].max_level);
+    }
+}
+
+int DALIDriver::forget_bus_map()
+{
+    if (!_storage) {
+        return -1;
+    }
+    return _storage->remove("dali_map");
+}
+
+bool DALIDriver::load_map()
+{
+    if (!_storage) {
+        return false;
+    }
+    size_t actual = 0;
+    if (_storage->get("dali_map", &_map, sizeof(_map), &actual) != 0 ||
+        actual != sizeof(_map)) {
+        return false;
+    }
+    return _map.magic == DALI_MAP_MAGIC && _map.version == DALI_MAP_VERSION &&
+           _map.checksum == map_checksum() &&
+           _map.num_lights + _map.num_inputs <= DALI_MAP_UNITS;
+}
+
+void DALIDriver::save_map()
+{
+    if (!_storage) {
+        return;
+    }
+    _map.magic = DALI_MAP_MAGIC;
+    _map.version = DALI_MAP_VERSION;
+    _map.num_lights = num_lights;
+    _map.num_inputs = num_inputs;
+    _map.checksum = map_checksum();
+    _storage->set("dali_map", &_map, sizeof(_map));
+}
+
+uint32_t DALIDriver::map_checksum()
+{
+    return checksum(&_map, offsetof(DALIBusMap, checksum));
+}
+
+uint32_t DALIDriver::checksum(const void *data, size_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum = (sum << 1 | sum >> 31) + p[i];
+    }
+    return sum;
+}
+
+bool DALIDriver::validate_map()
+{
+    int lights = _map.num_lights;
+    int inputs = _map.num_inputs;
+    if (!validate_units<GearCommands>(0, lights) ||
+        !validate_units<DeviceCommands>(lights, inputs)) {
+        return false;
+    }
+    // No unit was added without an address
+    return !any_unaddressed<GearCommands>() &&
+           !any_unaddressed<DeviceCommands>();
+}
+
+template <class Commands>
+bool DALIDriver::validate_units(int first, int count)
+{
+    for (int i = 0; i < DALI_MAP_UNITS; i++) {
+        Commands::query(*this, i, Commands::QUERY_RANDOM_ADDR_L);
+        int resp = recv_frame();
+        if (i < first || i >= first + count) {
+            // No unit was added with an address, wherever it got it
+            if (resp != RECV_NO_RESPONSE) {
+                return false;
             }
+            continue;
+        }
+        // Every unit still has the random address it was addressed with,
+        // which catches swapped and replaced units. The low byte alone
+        // would miss one swap in 256.
+        uint32_t random_addr = _map.units[i].random_addr;
+        if (resp != (int)(random_addr & 0xFF)) {
+            return false;
+        }
+        Commands::query(*this, i, Commands::QUERY_RANDOM_ADDR_M);
+        if (recv_frame() != (int)((random_addr >> 8) & 0xFF)) {
+            return false;
+        }
+        Commands::query(*this, i, Commands::QUERY_RANDOM_ADDR_H);
+        if (recv_frame() != (int)((random_addr >> 16) & 0xFF)) {
+            return false;
         }
     }
-    return num_lights + num_inputs;
+    return true;
+}
+
+template <class Commands>
+bool DALIDriver::any_unaddressed()
+{
+    // Only units without a short address enter initialisation
+    Commands::special_twice(*this, Commands::INITIALISE,
+                            Commands::SELECT_UNADDRESSED);
+    bool found = search_compare<Commands>(0xFFFFFF);
+    Commands::special(*this, Commands::TERMINATE, 0x00);
+    return found;
 }
 
 void DALIDriver::set_event_scheme(uint8_t addr, uint8_t inst, uint8_t scheme)
@@ -443,8 +1409,7 @@ void DALIDriver::set_event_scheme(uint8_t addr, uint8_t inst, uint8_t scheme)
     // Put scheme in DTR0
     send_command_special_input(0x30, scheme);
     // Set the event scheme
-    send_command_standard_input(addr, inst, 0x67);
-    send_command_standard_input(addr, inst, 0x67);
+    send_twice_input(addr, inst, 0x67);
 }
 
 void DALIDriver::set_event_filter(uint8_t addr, uint8_t inst, uint8_t filter)
@@ -452,273 +1417,841 @@ void DALIDriver::set_event_filter(uint8_t addr, uint8_t inst, uint8_t filter)
     // Put filter in DTR0
     send_command_special_input(0x30, filter);
     // Set the event filter
-    send_command_standard_input(addr, inst, 0x68);
-    send_command_standard_input(addr, inst, 0x68);
+    send_twice_input(addr, inst, 0x68);
 }
 
 uint8_t DALIDriver::get_instance_type(uint8_t addr, uint8_t inst)
 {
     send_command_standard_input(addr, inst, 0x80);
-    return encoder.recv();
+    return recv_frame();
 }
 uint8_t DALIDriver::get_instance_status(uint8_t addr, uint8_t inst)
 {
     send_command_standard_input(addr, inst, 0x86);
-    return encoder.recv();
+    return recv_frame();
 }
 
 void DALIDriver::disable_instance(uint8_t addr, uint8_t inst)
 {
-    send_command_standard_input(addr, inst, 0x63);
-    send_command_standard_input(addr, inst, 0x63);
+    send_twice_input(addr, inst, 0x63);
 }
 
 void DALIDriver::enable_instance(uint8_t addr, uint8_t inst)
 {
-    send_command_standard_input(addr, inst, 0x62);
-    send_command_standard_input(addr, inst, 0x62);
+    send_twice_input(addr, inst, 0x62);
 }
 
-int DALIDriver::get_highest_address()
+template <class Commands>
+uint64_t DALIDriver::scan(uint64_t &duplicates)
 {
-    int highestAssigned = -1;
-    // Start initialization phase
-    send_command_special(INITIALISE, 0x00);
-    send_command_special(INITIALISE, 0x00);
-    // Assign all units a random address
-    send_command_special(RANDOMISE, 0x00);
-    send_command_special(RANDOMISE, 0x00);
-    wait_ms(100);
-
-    while (true) {
-        // Set the search address to the highest range
-        set_search_address(0xFFFFFF);
-        // Compare logical units search address to global search address
-        send_command_special(COMPARE, 0x00);
-        // Check if any device responds yes
-        bool yes = check_response(YES);
-        // If no devices are unassigned (all withdrawn), we are done
-        if (!yes) {
-            break;
+    uint64_t used = 0;
+    duplicates = 0;
+    for (int i = 0; i < DALI_MAP_UNITS; i++) {
+        Commands::query(*this, i, Commands::QUERY_RANDOM_ADDR_L);
+        int resp = recv_frame();
+        if (resp == RECV_NO_RESPONSE) {
+            continue;
         }
-        uint32_t searchAddr = 0xFFFFFF;
-        for (int i = 23; i >= 0; i--) {
-            uint32_t mask = 1 << i;
-            searchAddr = searchAddr & (~mask);
-            // Set a new search address
-            set_search_address(searchAddr);
-            send_command_special(COMPARE, 0x00);
-            // Check if any devices match
-            bool yes = check_response(YES);
-            if (!yes) {
-                // No unit here, revert the mask
-                searchAddr = searchAddr | mask;
-            }
-            // If yes, then we found at least one device
-        }
-        set_search_address(searchAddr);
-        send_command_special(COMPARE, 0x00);
-        yes = check_response(YES);
-        if (yes) {
-            // Get the current short address
-            send_command_special(QUERY_SHORT_ADDR, 0x00);
-            uint8_t short_addr = encoder.recv();
-            if (short_addr != 0xFF) {
-                short_addr = short_addr >> 1;
-                if (short_addr > highestAssigned) {
-                    highestAssigned = short_addr;
-                }
-            }
-            // Tell unit to withdraw (no longer respond to search queries)
-            send_command_special(WITHDRAW, 0x00);
+        used |= (uint64_t)1 << i;
+        // Several units answering at once garble the frame
+        if (resp == RECV_FRAME_ERROR) {
+            duplicates |= (uint64_t)1 << i;
+            continue;
         }
-        // Refresh initialization state
-        send_command_special(INITIALISE, 0x00);
-        send_command_special(INITIALISE, 0x00);
+        uint32_t random_addr = resp;
+        if (_storage) {
+            Commands::query(*this, i, Commands::QUERY_RANDOM_ADDR_M);
+            random_addr |= (uint32_t)(recv_frame() & 0xFF) << 8;
+            Commands::query(*this, i, Commands::QUERY_RANDOM_ADDR_H);
+            random_addr |= (uint32_t)(recv_frame() & 0xFF) << 16;
+        }
+        _map.units[i].random_addr = random_addr;
     }
+    return used;
+}
 
-    send_command_special(TERMINATE, 0x00);
-    return highestAssigned;
+int DALIDriver::lowest_free(uint64_t used)
+{
+    for (int i = 0; i < DALI_MAP_UNITS; i++) {
+        if (!(used & ((uint64_t)1 << i))) {
+            return i;
+        }
+    }
+    return -1;
 }
 
-// Return number of logical units on the bus
-int DALIDriver::assign_addresses(bool reset)
+int DALIDriver::highest_used(uint64_t used)
 {
-    uint8_t numAssignedShortAddresses = 0;
-    int assignedAddresses[63] = {false};
-    int highestAssigned = -1;
-
-    if (!reset) {
-        // Get the highest address already assigned
-        int highest_addr = get_highest_address();
-        if (highest_addr >= 0) {
-            numAssignedShortAddresses = highest_addr + 1;
-            for (int i = 0; i < numAssignedShortAddresses; i++) {
-                assignedAddresses[i] = true;
-            }
+    for (int i = DALI_MAP_UNITS - 1; i >= 0; i--) {
+        if (used & ((uint64_t)1 << i)) {
+            return i;
         }
     }
-    // Start initialization phase for devices w/o a short address
-    uint8_t opcode = reset ? 0x00 : 0xFF;
-    send_command_special(INITIALISE, opcode);
-    send_command_special(INITIALISE, opcode);
-    // Assign all units a random address
-    send_command_special(RANDOMISE, 0x00);
-    send_command_special(RANDOMISE, 0x00);
-    wait_ms(100);
+    return -1;
+}
+
+int DALIDriver::count_units(uint64_t units)
+{
+    int count = 0;
+    while (units) {
+        units &= units - 1;
+        count++;
+    }
+    return count;
+}
 
+template <class Commands>
+uint64_t DALIDriver::commission(uint8_t selector, uint64_t &used)
+{
+    uint64_t added = 0;
+    // The search commission_step() runs, without other frames in between
+    SearchRun run;
+    search_begin(run, selector);
     while (true) {
-        // Set the search address to the highest range
-        set_search_address(0xFFFFFF);
-        // Compare logical units search address to global search address
-        send_command_special(COMPARE, 0x00);
-        // Check if any device responds yes
-        bool yes = check_response(YES);
-        // If no devices are unassigned (all withdrawn), we are done
-        if (!yes) {
+        int hold = search_step<Commands>(run, used);
+        if (hold == SEARCH_DONE) {
             break;
         }
-        if (numAssignedShortAddresses < 63) {
-            uint32_t searchAddr = 0xFFFFFF;
-            for (int i = 23; i >= 0; i--) {
-                uint32_t mask = 1 << i;
-                searchAddr = searchAddr & (~mask);
-                // Set a new search address
-                set_search_address(searchAddr);
-                send_command_special(COMPARE, 0x00);
-                // Check if any devices match
-                bool yes = check_response(YES);
-                if (!yes) {
-                    // No unit here, revert the mask
-                    searchAddr = searchAddr | mask;
-                }
-                // If yes, then we found at least one device
-            }
-            set_search_address(searchAddr);
-            send_command_special(COMPARE, 0x00);
-            bool yes = check_response(YES);
-            if (yes) {
-                // We found a unit, let's program the short address with a new
-                // address Give it a temporary short address
-                uint8_t new_addr = numAssignedShortAddresses;
-                if (new_addr < 63) {
-                    if (assignedAddresses[new_addr] == true) {
-                        // Duplicate addr?
-                    } else {
-                        // Program new address as short address
-                        send_command_special(PROGRAM_SHORT_ADDR,
-                                             (new_addr << 1) + 1);
-                        // Tell unit to withdraw (no longer respond to search
-                        // queries)
-                        send_command_special(WITHDRAW, 0x00);
-                        numAssignedShortAddresses++;
-                        assignedAddresses[new_addr] = true;
-                        if (new_addr > highestAssigned)
-                            highestAssigned = new_addr;
-                    }
-                } else {
-                    // expected < 63 ?
-                }
-            } else {
-                // No device found
-            }
+        if (hold == SEARCH_FOUND) {
+            _map.units[run.addr].random_addr = run.hi;
+            added |= (uint64_t)1 << run.addr;
+        } else if (hold > 0) {
+            wait_ms(hold);
         }
-        // Refresh initialization state
-        send_command_special(INITIALISE, 0x00);
-        send_command_special(INITIALISE, 0x00);
     }
+    return added;
+}
 
-    send_command_special(TERMINATE, 0x00);
-    return numAssignedShortAddresses;
+template <class Commands>
+uint64_t DALIDriver::resolve_duplicates(uint64_t duplicates, uint64_t &used)
+{
+    uint64_t added = 0;
+    for (int i = 0; i < DALI_MAP_UNITS; i++) {
+        if (duplicates & ((uint64_t)1 << i)) {
+            // Only the units sharing the address enter initialisation, and
+            // all of them move to a free one
+            added |= commission<Commands>(Commands::select(i), used);
+            used &= ~((uint64_t)1 << i);
+        }
+    }
+    return added;
+}
+
+// Return number of logical units on the bus
+int DALIDriver::assign_addresses(bool reset)
+{
+    uint64_t used = 0;
+    if (reset) {
+        commission<GearCommands>(GearCommands::SELECT_ALL, used);
+    } else {
+        // Keep the addresses in use and only search units without one
+        uint64_t duplicates;
+        used = scan<GearCommands>(duplicates);
+        resolve_duplicates<GearCommands>(duplicates, used);
+        commission<GearCommands>(GearCommands::SELECT_UNADDRESSED, used);
+    }
+    return highest_used(used) + 1;
 }
 
 // Return number of logical units on the bus
 int DALIDriver::assign_addresses_input(bool reset, int num_found)
 {
     send_command_special(TERMINATE, 0x00);
-    uint8_t numAssignedShortAddresses = num_found;
-    int assignedAddresses[63] = {false};
-    int highestAssigned = -1;
 
     // Put 0x00 in DTR0
     send_command_special_input(0x30, 0x00);
     // Set operating mode to DTR0
-    send_command_standard_input(0xFF, 0xFE, 0x18);
-    send_command_standard_input(0xFF, 0xFE, 0x18);
-
-    // DTR0 MASK
-    send_command_special_input(0x30, 0xFF);
-    // Set short address to DTR0
-    send_command_standard_input(0x7F, 0xFE, 0x14);
-    send_command_standard_input(0x7F, 0xFE, 0x14);
-    // Start initialization phase for devices
-    send_command_special_input(0x01, 0xFF);
-    send_command_special_input(0x01, 0xFF);
-    // Assign all units a random address
-    send_command_special_input(0x02, 0x00);
-    send_command_special_input(0x02, 0x00);
-    wait_ms(100);
+    send_twice_input(0xFF, 0xFE, 0x18);
 
-    while (true) {
-        // Set the search address to the highest range
-        set_search_address_input(0xFFFFFF);
-        // Compare logical units search address to global search address
-        send_command_special_input(0x03, 0x00);
-        // Check if any device responds yes
-        bool yes = check_response(YES);
-        // If no devices are unassigned (all withdrawn), we are done
-        if (!yes) {
+    // Addresses below num_found belong to the luminaires
+    uint64_t reserved = 0;
+    for (int i = 0; i < num_found && i < DALI_MAP_UNITS; i++) {
+        reserved |= (uint64_t)1 << i;
+    }
+    uint64_t used = reserved;
+    if (reset) {
+        // DTR0 MASK
+        send_command_special_input(0x30, 0xFF);
+        // Set short address to DTR0
+        send_twice_input(0x7F, 0xFE, 0x14);
+        commission<DeviceCommands>(DeviceCommands::SELECT_ALL, used);
+    } else {
+        // Keep the addresses in use and only search devices without one
+        uint64_t duplicates;
+        used |= scan<DeviceCommands>(duplicates);
+        resolve_duplicates<DeviceCommands>(duplicates, used);
+        commission<DeviceCommands>(DeviceCommands::SELECT_UNADDRESSED, used);
+    }
+    int highest = highest_used(used & ~reserved);
+    return highest < num_found ? num_found : highest + 1;
+}
+
+int DALIDriver::add_new_units()
+{
+    quiet_mode(true);
+    uint64_t duplicates;
+    uint64_t used = scan<GearCommands>(duplicates);
+    uint64_t added_lights = resolve_duplicates<GearCommands>(duplicates, used);
+    added_lights |= commission<GearCommands>(GearCommands::SELECT_UNADDRESSED, used);
+    for (int i = 0; _shadow && i < DALI_SHADOW_GEAR; i++) {
+        // New gear, and the addresses gear was moved off
+        if ((added_lights | duplicates) & ((uint64_t)1 << i)) {
+            _shadow->invalidate(i);
+        }
+    }
+    if (highest_used(used) + 1 > num_lights) {
+        num_lights = highest_used(used) + 1;
+    }
+    for (int i = 0; i < num_lights; i++) {
+        if (added_lights & ((uint64_t)1 << i)) {
+            record_light(i);
+        }
+    }
+
+    uint64_t reserved = 0;
+    for (int i = 0; i < num_lights; i++) {
+        reserved |= (uint64_t)1 << i;
+    }
+    used = reserved | scan<DeviceCommands>(duplicates);
+    uint64_t added_inputs = resolve_duplicates<DeviceCommands>(duplicates, used);
+    added_inputs |= commission<DeviceCommands>(DeviceCommands::SELECT_UNADDRESSED, used);
+    int highest = highest_used(used & ~reserved);
+    num_inputs = highest < num_lights ? 0 : highest + 1 - num_lights;
+    if (added_inputs) {
+        set_event_scheme(0xFF, 0xFF, 0x01);
+    }
+    for (int i = num_lights; i < num_lights + num_inputs; i++) {
+        if (added_inputs & ((uint64_t)1 << i)) {
+            configure_input(i);
+        }
+    }
+    quiet_mode(false);
+
+    num_logical_units = num_lights + num_inputs;
+    save_map();
+    return count_units(added_lights) + count_units(added_inputs);
+}
+
+bool DALIDriver::commission_begin(DALICommissionState &state)
+{
+    bool resumed = load_checkpoint(state);
+    if (load_map()) {
+        num_lights = _map.num_lights;
+        num_inputs = _map.num_inputs;
+        num_logical_units = num_lights + num_inputs;
+    } else if (resumed) {
+        // The checkpoint is no use without the map it was saved with
+        resumed = false;
+    }
+    if (resumed) {
+        // Checkpoints are only taken between units, but the units may have
+        // left initialisation since
+        if ((state.phase == DALI_COMMISSION_SEARCH_GEAR ||
+             state.phase == DALI_COMMISSION_SEARCH_INPUTS) &&
+            state.step == SEARCH_RUN) {
+            state.step = SEARCH_RESUME;
+        }
+        return true;
+    }
+    // Units the saved map holds are only read again if they changed
+    memset(&state, 0, sizeof(state));
+    state.phase = DALI_COMMISSION_SCAN_GEAR;
+    return false;
+}
+
+int DALIDriver::commission_step(DALICommissionState &state)
+{
+    int hold = COMMISSION_AGAIN;
+    while (hold == COMMISSION_AGAIN) {
+        switch (state.phase) {
+            case DALI_COMMISSION_SCAN_GEAR:
+                hold = commission_scan<GearCommands>(state);
+                break;
+            case DALI_COMMISSION_SEARCH_GEAR:
+                hold = commission_search<GearCommands>(state);
+                break;
+            case DALI_COMMISSION_RECORD_GEAR:
+                hold = commission_record(state);
+                break;
+            case DALI_COMMISSION_SCAN_INPUTS:
+                hold = commission_scan<DeviceCommands>(state);
+                break;
+            case DALI_COMMISSION_SEARCH_INPUTS:
+                hold = commission_search<DeviceCommands>(state);
+                break;
+            case DALI_COMMISSION_CONFIGURE_INPUTS:
+                hold = commission_configure(state);
+                break;
+            default:
+                return DALI_COMMISSION_FINISHED;
+        }
+    }
+    return hold;
+}
+
+void DALIDriver::commission_phase(DALICommissionState &state, uint8_t phase)
+{
+    state.phase = phase;
+    state.step = 0;
+    state.addr = 0;
+    state.unit_step = 0;
+    state.searched = 0;
+    save_checkpoint(state);
+}
+
+template <class Commands>
+int DALIDriver::commission_scan(DALICommissionState &state)
+{
+    bool inputs = state.phase == DALI_COMMISSION_SCAN_INPUTS;
+    if (state.step == SCAN_START) {
+        state.step = SCAN_L;
+        if (inputs) {
+            // Put 0x00 in DTR0 and set the operating mode to it
+            send_command_special_input(0x30, 0x00);
+            send_twice_input(0xFF, 0xFE, 0x18);
+            return 0;
+        }
+    }
+    if (state.addr >= DALI_MAP_UNITS) {
+        commission_phase(state, inputs ? DALI_COMMISSION_SEARCH_INPUTS
+                                       : DALI_COMMISSION_SEARCH_GEAR);
+        return COMMISSION_AGAIN;
+    }
+    uint8_t addr = state.addr;
+    uint64_t bit = (uint64_t)1 << addr;
+    switch (state.step) {
+        case SCAN_L: {
+            Commands::query(*this, addr, Commands::QUERY_RANDOM_ADDR_L);
+            int resp = recv_frame();
+            if (resp == RECV_NO_RESPONSE) {
+                commission_scanned(state);
+                return 0;
+            }
+            state.used |= bit;
+            // Several units answering at once garble the frame, and input
+            // devices must not sit in the luminaire range
+            if (resp == RECV_FRAME_ERROR || (inputs && addr < num_lights)) {
+                state.moves |= bit;
+                commission_scanned(state);
+                return 0;
+            }
+            state.random_addr = resp;
+            if (_storage) {
+                state.step = SCAN_M;
+                return 0;
+            }
             break;
         }
-        if (numAssignedShortAddresses < 63) {
-            uint32_t searchAddr = 0xFFFFFF;
-            for (int i = 23; i >= 0; i--) {
-                uint32_t mask = 1 << i;
-                searchAddr = searchAddr & (~mask);
-                // Set a new search address
-                set_search_address_input(searchAddr);
-                send_command_special_input(0x03, 0x00);
-                // Check if any devices match
-                bool yes = check_response(YES);
-                if (!yes) {
-                    // No unit here, revert the mask
-                    searchAddr = searchAddr | mask;
-                }
-                // If yes, then we found at least one device
+        case SCAN_M:
+            Commands::query(*this, addr, Commands::QUERY_RANDOM_ADDR_M);
+            state.random_addr |= (uint32_t)(recv_frame() & 0xFF) << 8;
+            state.step = SCAN_H;
+            return 0;
+        default:
+            Commands::query(*this, addr, Commands::QUERY_RANDOM_ADDR_H);
+            state.random_addr |= (uint32_t)(recv_frame() & 0xFF) << 16;
+            break;
+    }
+    // A unit the map does not know, or not as this one, is read again
+    DALIUnitRecord &unit = _map.units[addr];
+    uint32_t mask = _storage ? 0xFFFFFF : 0xFF;
+    if ((unit.random_addr & mask) != state.random_addr ||
+        (!inputs && !(unit.capabilities & DALI_CAP_KNOWN))) {
+        memset(&unit, 0, sizeof(unit));
+        unit.random_addr = state.random_addr;
+        state.todo |= bit;
+    }
+    state.step = SCAN_L;
+    commission_scanned(state);
+    return 0;
+}
+
+void DALIDriver::commission_scanned(DALICommissionState &state)
+{
+    state.addr++;
+    if (state.addr % COMMISSION_SCAN_SAVE == 0) {
+        save_checkpoint(state);
+    }
+}
+
+template <class Commands>
+int DALIDriver::commission_search(DALICommissionState &state)
+{
+    bool gear = state.phase == DALI_COMMISSION_SEARCH_GEAR;
+    int new_addr = lowest_free(state.used);
+    switch (state.step) {
+        case SEARCH_START: {
+            // Units sharing an address first, then units without one
+            uint8_t selector =
+                state.moves ? Commands::select(lowest_free(~state.moves))
+                            : (uint8_t)Commands::SELECT_UNADDRESSED;
+            search_begin(state.run, selector);
+            state.step = SEARCH_RUN;
+            return COMMISSION_AGAIN;
+        }
+        case SEARCH_RUN: {
+            int hold = search_step<Commands>(state.run, state.used);
+            if (hold == SEARCH_FOUND) {
+                commission_added(state, state.run.addr, state.run.hi);
+                save_checkpoint(state);
+                return 0;
+            }
+            if (hold == 0 && state.run.step == SEARCH_INITIALISE) {
+                // The search of units that shared a random address starts
+                // after TERMINATE, a run picking up from here selects them
+                save_checkpoint(state);
+            }
+            if (hold != SEARCH_DONE) {
+                return hold;
+            }
+            break;
+        }
+        case SEARCH_RESUME: {
+            // The run may have stopped after PROGRAM SHORT ADDRESS and
+            // before the checkpoint
+            state.step = SEARCH_RUN;
+            state.run.step = SEARCH_RESTART;
+            if (new_addr < 0) {
+                return COMMISSION_AGAIN;
+            }
+            Commands::query(*this, new_addr, Commands::QUERY_RANDOM_ADDR_L);
+            int resp = recv_frame();
+            if (resp >= 0) {
+                state.run.hi = resp;
+                state.step = SEARCH_RESUME_M;
+            }
+            return 0;
+        }
+        case SEARCH_RESUME_M:
+            Commands::query(*this, new_addr, Commands::QUERY_RANDOM_ADDR_M);
+            state.run.hi |= (uint32_t)(recv_frame() & 0xFF) << 8;
+            state.step = SEARCH_RESUME_H;
+            return 0;
+        case SEARCH_RESUME_H:
+            Commands::query(*this, new_addr, Commands::QUERY_RANDOM_ADDR_H);
+            state.run.hi |= (uint32_t)(recv_frame() & 0xFF) << 16;
+            state.step = SEARCH_RESUME_WITHDRAW;
+            return 0;
+        default:
+            // SEARCH_RESUME_WITHDRAW: the unit may still be in the search,
+            // and would be found and moved again
+            if (search_address_step<Commands>(state.run.hi)) {
+                return 0;
             }
-            set_search_address_input(searchAddr);
-            send_command_special_input(0x03, 0x00);
-            bool yes = check_response(YES);
-            if (yes) {
-                // We found a unit, let's program the short address with a new
-                // address Give it a temporary short address
-                uint8_t new_addr = numAssignedShortAddresses;
-                if (new_addr < 63) {
-                    if (assignedAddresses[new_addr] == true) {
-                        // Duplicate addr?
-                    } else {
-                        // Program new address as short address
-                        send_command_special_input(0x08, new_addr);
-                        // Tell unit to withdraw (no longer respond to search
-                        // queries)
-                        send_command_special_input(0x04, 0x00);
-                        numAssignedShortAddresses++;
-                        assignedAddresses[new_addr] = true;
-                        if (new_addr > highestAssigned)
-                            highestAssigned = new_addr;
+            Commands::special(*this, Commands::WITHDRAW, 0x00);
+            search_found(state.run.search, state.run.hi);
+            commission_added(state, new_addr, state.run.hi);
+            state.step = SEARCH_RESUME;
+            save_checkpoint(state);
+            return 0;
+    }
+    // The search ended with TERMINATE
+    if (state.moves) {
+        // Every unit at the address moved to a free one
+        int from = lowest_free(~state.moves);
+        uint64_t bit = (uint64_t)1 << from;
+        state.moves &= ~bit;
+        if (gear || from >= num_lights) {
+            state.used &= ~bit;
+            state.todo &= ~bit;
+        }
+        if (gear && _shadow) {
+            _shadow->invalidate(from);
+        }
+    } else {
+        state.searched = 1;
+    }
+    if (!gear && !state.moves && state.searched) {
+        // Input devices follow the luminaires without gaps, as after init(),
+        // so the highest one moves down
+        int highest = highest_used(state.used & ~lights_mask());
+        int gap = lowest_free(state.used);
+        if (gap >= 0 && gap < highest) {
+            state.moves = (uint64_t)1 << highest;
+        }
+    }
+    if (state.moves || !state.searched) {
+        state.step = SEARCH_START;
+        save_checkpoint(state);
+    } else if (gear) {
+        num_lights = highest_used(state.used) + 1;
+        num_logical_units = num_lights + num_inputs;
+        commission_phase(state, DALI_COMMISSION_RECORD_GEAR);
+    } else {
+        int highest = highest_used(state.used & ~lights_mask());
+        num_inputs = highest < num_lights ? 0 : highest + 1 - num_lights;
+        num_logical_units = num_lights + num_inputs;
+        commission_phase(state, DALI_COMMISSION_CONFIGURE_INPUTS);
+    }
+    return 0;
+}
+
+void DALIDriver::commission_added(DALICommissionState &state, uint8_t addr,
+                                  uint32_t random_addr)
+{
+    uint64_t bit = (uint64_t)1 << addr;
+    memset(&_map.units[addr], 0, sizeof(_map.units[addr]));
+    _map.units[addr].random_addr = random_addr;
+    // Units that shared a random address are found at it again
+    if (!(state.todo & bit)) {
+        state.added++;
+    }
+    state.used |= bit;
+    state.todo |= bit;
+    if (state.phase == DALI_COMMISSION_SEARCH_GEAR && _shadow) {
+        _shadow->invalidate(addr);
+    }
+}
+
+int DALIDriver::commission_record(DALICommissionState &state)
+{
+    while (state.addr < num_lights &&
+           !(state.todo & ((uint64_t)1 << state.addr))) {
+        state.addr++;
+    }
+    if (state.addr >= num_lights) {
+        // Input devices start after the luminaires
+        state.used = lights_mask();
+        state.moves = 0;
+        state.todo = 0;
+        commission_phase(state, DALI_COMMISSION_SCAN_INPUTS);
+        return COMMISSION_AGAIN;
+    }
+    state.unit_step = record_light_step(state.addr, state.unit_step);
+    if (!state.unit_step) {
+        state.addr++;
+        save_checkpoint(state);
+    }
+    return 0;
+}
+
+int DALIDriver::commission_configure(DALICommissionState &state)
+{
+    int end = num_lights + num_inputs;
+    if (state.step == CONFIGURE_SCHEME) {
+        state.step = CONFIGURE_UNITS;
+        if (state.todo & ~lights_mask()) {
+            // Set the event scheme for all events to be address / instance
+            // id / event info, and give the devices time to take it
+            set_event_scheme(0xFF, 0xFF, 0x01);
+            return COMMISSION_SCHEME_MS;
+        }
+    }
+    while (state.addr < end && !(state.todo & ((uint64_t)1 << state.addr))) {
+        state.addr++;
+    }
+    if (state.addr >= end) {
+        state.phase = DALI_COMMISSION_DONE;
+        save_map();
+        if (_storage) {
+            _storage->remove("dali_commission");
+        }
+        return COMMISSION_AGAIN;
+    }
+    state.unit_step = configure_input_step(state.addr, state.unit_step);
+    if (!state.unit_step) {
+        state.addr++;
+        save_checkpoint(state);
+    }
+    return 0;
+}
+
+uint64_t DALIDriver::lights_mask()
+{
+    return num_lights >= DALI_MAP_UNITS ? ~(uint64_t)0
+                                        : ((uint64_t)1 << num_lights) - 1;
+}
+
+bool DALIDriver::load_checkpoint(DALICommissionState &state)
+{
+    if (!_storage) {
+        return false;
+    }
+    size_t actual = 0;
+    if (_storage->get("dali_commission", &state, sizeof(state), &actual) != 0 ||
+        actual != sizeof(state)) {
+        return false;
+    }
+    return state.magic == DALI_COMMISSION_MAGIC &&
+           state.version == DALI_COMMISSION_VERSION &&
+           state.checksum ==
+               checksum(&state, offsetof(DALICommissionState, checksum)) &&
+           state.phase < DALI_COMMISSION_DONE;
+}
+
+void DALIDriver::save_checkpoint(DALICommissionState &state)
+{
+    if (!_storage) {
+        return;
+    }
+    // The map first, the checkpoint refers to it
+    save_map();
+    state.magic = DALI_COMMISSION_MAGIC;
+    state.version = DALI_COMMISSION_VERSION;
+    state.checksum = checksum(&state, offsetof(DALICommissionState, checksum));
+    _storage->set("dali_commission", &state, sizeof(state));
+}
+
+void DALIDriver::search_reset(SearchState &state)
+{
+    state.lo = 0;
+    state.num_hints = 0;
+}
+
+void DALIDriver::search_add_hint(SearchState &state, uint32_t addr)
+{
+    int i = state.num_hints;
+    if (i == SEARCH_HINTS) {
+        // Full, the highest hint is the least useful one
+        if (addr >= state.hints[i - 1]) {
+            return;
+        }
+        i--;
+    } else {
+        state.num_hints++;
+    }
+    // Insert keeping the hints sorted
+    while (i > 0 && state.hints[i - 1] > addr) {
+        state.hints[i] = state.hints[i - 1];
+        i--;
+    }
+    state.hints[i] = addr;
+}
+
+void DALIDriver::search_found(SearchState &state, uint32_t addr)
+{
+    // Every device at addr has been withdrawn
+    search_drop_below(state, addr + 1);
+}
+
+void DALIDriver::search_drop_below(SearchState &state, uint32_t lo)
+{
+    state.lo = lo;
+    int drop = 0;
+    while (drop < state.num_hints && state.hints[drop] < lo) {
+        drop++;
+    }
+    for (int i = drop; i < state.num_hints; i++) {
+        state.hints[i - drop] = state.hints[i];
+    }
+    state.num_hints -= drop;
+}
+
+void DALIDriver::search_begin(SearchRun &run, uint8_t selector)
+{
+    memset(&run, 0, sizeof(run));
+    run.step = SEARCH_INITIALISE;
+    run.selector = selector;
+    search_reset(run.search);
+}
+
+template <class Commands>
+int DALIDriver::search_step(SearchRun &run, uint64_t &used)
+{
+    while (true) {
+        switch (run.step) {
+            case SEARCH_RESTART:
+                run.step = SEARCH_INITIALISE;
+                if (run.rounds && run.randomised) {
+                    // Selecting the shared address again brings back the
+                    // unit that kept it, and the units found since would
+                    // pick new random addresses, so its search starts over
+                    used &= ~((uint64_t)1 << run.shared);
+                    run.randomised = 0;
+                    Commands::special(*this, Commands::TERMINATE, 0x00);
+                    return 0;
+                }
+                break;
+            case SEARCH_INITIALISE:
+                // Start initialization phase for the selected units
+                Commands::special_twice(*this, Commands::INITIALISE,
+                                        run.selector);
+                run.initialised_us = us_ticker_read();
+                run.step = run.randomised ? SEARCH_NEXT : SEARCH_RANDOMISE;
+                return 0;
+            case SEARCH_RANDOMISE:
+                // Assign them a random address
+                Commands::special_twice(*this, Commands::RANDOMISE, 0x00);
+                run.randomised = 1;
+                search_reset(run.search);
+                run.step = SEARCH_NEXT;
+                encoder.flush();
+                return COMMISSION_RANDOMISE_MS;
+            case SEARCH_NEXT:
+                // Fill the gaps first
+                if (lowest_free(used) < 0) {
+                    run.step = SEARCH_TERMINATE;
+                } else if (us_ticker_read() - run.initialised_us >
+                           DALI_COMMISSION_REFRESH_MS * 1000UL) {
+                    // Units leave initialisation after 15 minutes, the
+                    // addressed ones are not selected again
+                    run.step = SEARCH_RESTART;
+                } else {
+                    // COMPARE answers yes for every address at or above
+                    // the lowest device, so find the first hint that still
+                    // does
+                    run.hint_lo = 0;
+                    run.hint_hi = run.search.num_hints;
+                    run.step = SEARCH_FIRST_YES;
+                }
+                break;
+            case SEARCH_FIRST_YES: {
+                if (run.hint_lo < run.hint_hi) {
+                    int m = (run.hint_lo + run.hint_hi) / 2;
+                    int yes =
+                        search_compare_step<Commands>(run.search.hints[m]);
+                    if (yes > 0) {
+                        run.hint_hi = m;
+                    } else if (yes == 0) {
+                        run.hint_lo = m + 1;
                     }
+                    return 0;
+                }
+                // Hints below the first yes answered no, nobody is at or
+                // below them
+                int first_yes = run.hint_lo;
+                SearchState &search = run.search;
+                run.lo = first_yes > 0 ? search.hints[first_yes - 1] + 1
+                                       : search.lo;
+                if (first_yes < search.num_hints) {
+                    run.hi = search.hints[first_yes];
+                    search_drop_below(search, run.lo);
+                    run.step = SEARCH_BISECT;
+                } else if (search.num_hints > 0 &&
+                           search.hints[search.num_hints - 1] == 0xFFFFFF) {
+                    // Even the top of the range answered no
+                    run.step = SEARCH_TERMINATE;
                 } else {
-                    // expected < 63 ?
+                    run.step = SEARCH_TOP;
                 }
-            } else {
-                // No device found
+                break;
+            }
+            case SEARCH_TOP: {
+                int yes = search_compare_step<Commands>(0xFFFFFF);
+                if (yes > 0) {
+                    run.hi = 0xFFFFFF;
+                    search_add_hint(run.search, run.hi);
+                    search_drop_below(run.search, run.lo);
+                    run.step = SEARCH_BISECT;
+                } else if (yes == 0) {
+                    // If no devices are unassigned (all withdrawn), we are
+                    // done
+                    run.step = SEARCH_TERMINATE;
+                }
+                return 0;
+            }
+            case SEARCH_BISECT: {
+                if (run.lo >= run.hi) {
+                    run.step = SEARCH_POINT;
+                    break;
+                }
+                // Split on the highest bit where lo and hi differ, so
+                // consecutive search addresses only differ in one byte
+                uint32_t lo = run.lo;
+                uint32_t hi = run.hi;
+                int bit = 23;
+                while (!((lo ^ hi) & (1UL << bit))) {
+                    bit--;
+                }
+                uint32_t below = (1UL << bit) - 1;
+                uint32_t mid = (hi & ~((below << 1) | 1)) | below;
+                int yes = search_compare_step<Commands>(mid);
+                if (yes > 0) {
+                    run.hi = mid;
+                    search_add_hint(run.search, mid);
+                } else if (yes == 0) {
+                    run.lo = mid + 1;
+                }
+                return 0;
+            }
+            case SEARCH_POINT:
+                // The last COMPARE may have been below the device, point
+                // the search address back at it
+                if (search_address_step<Commands>(run.hi)) {
+                    return 0;
+                }
+                // Program new address as short address
+                run.addr = lowest_free(used);
+                Commands::special(*this, Commands::PROGRAM_SHORT_ADDR,
+                                  Commands::short_addr(run.addr));
+                run.checks = 0;
+                run.step = SEARCH_VERIFY;
+                return 0;
+            case SEARCH_VERIFY: {
+                // Check the unit took it
+                Commands::special(*this, Commands::QUERY_SHORT_ADDR, 0x00);
+                int resp = recv_frame();
+                if (resp == RECV_NO_RESPONSE) {
+                    // A bus error during the search left us at an address
+                    // nobody has
+                    search_reset(run.search);
+                    run.step = ++run.retries > SEARCH_RETRIES
+                                   ? SEARCH_TERMINATE
+                                   : SEARCH_NEXT;
+                    return 0;
+                }
+                run.retries = 0;
+                if (resp != Commands::short_addr(run.addr)) {
+                    // Units sharing the random address answer together,
+                    // which garbles the answer or overlaps into a
+                    // different one
+                    run.collided |= (uint64_t)1 << run.addr;
+                } else if (++run.checks < DALI_COLLISION_CHECKS) {
+                    return 0;
+                }
+                run.step = SEARCH_WITHDRAW;
+                return 0;
+            }
+            case SEARCH_WITHDRAW:
+                // Tell unit to withdraw (no longer respond to search
+                // queries)
+                Commands::special(*this, Commands::WITHDRAW, 0x00);
+                search_found(run.search, run.hi);
+                used |= (uint64_t)1 << run.addr;
+                run.step = SEARCH_NEXT;
+                return SEARCH_FOUND;
+            default: {
+                // SEARCH_TERMINATE
+                if (run.redo == 0 && run.collided &&
+                    run.rounds < DALI_COLLISION_RETRIES) {
+                    run.redo = run.collided;
+                    run.collided = 0;
+                    run.rounds++;
+                }
+                if (run.redo == 0) {
+                    Commands::special(*this, Commands::TERMINATE, 0x00);
+                    return SEARCH_DONE;
+                }
+                // Only the units at the address pick new random addresses,
+                // and the first one found keeps it
+                run.shared = lowest_free(~run.redo);
+                run.redo &= ~((uint64_t)1 << run.shared);
+                used &= ~((uint64_t)1 << run.shared);
+                Commands::special(*this, Commands::TERMINATE, 0x00);
+                run.selector = Commands::select(run.shared);
+                run.randomised = 0;
+                run.step = SEARCH_INITIALISE;
+                return 0;
             }
         }
-        // Refresh initialization state
-        send_command_special_input(0x01, 0x7F);
-        send_command_special_input(0x01, 0x7F);
     }
+}
 
-    send_command_special_input(0x00, 0x00);
-    return numAssignedShortAddresses;
+template <class Commands>
+bool DALIDriver::search_compare(uint32_t addr)
+{
+    set_search_address<Commands>(addr);
+    // Compare logical units search address to global search address
+    Commands::special(*this, Commands::COMPARE, 0x00);
+    return check_response(YES);
+}
+
+template <class Commands>
+int DALIDriver::search_compare_step(uint32_t addr)
+{
+    if (search_address_step<Commands>(addr)) {
+        return -1;
+    }
+    Commands::special(*this, Commands::COMPARE, 0x00);
+    return check_response(YES);
 }
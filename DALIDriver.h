@@ -17,6 +17,9 @@
 #ifndef DALI_DRIVER_H
 #define DALI_DRIVER_H
 
+#include "DALIShadow.h"
+#include "DALIStats.h"
+#include "DALIStorage.h"
 #include "manchester/encoder.h"
 #include "mbed.h"
 
@@ -47,10 +50,21 @@ enum CommandOpCodes {
     QUERY_GEAR_GROUPS_L = 0xC0, // get lower byte of gear groups status
     QUERY_GEAR_GROUPS_H = 0xC1, // get upper byte of gear groups status
     QUERY_ACTUAL_LEVEL = 0xA0,
+    QUERY_MAX_LEVEL = 0xA1,
+    QUERY_MIN_LEVEL = 0xA2,
     QUERY_ERROR = 0x90,
+    QUERY_CONTROL_GEAR_PRESENT = 0x91,
+    QUERY_LAMP_FAILURE = 0x92,
+    QUERY_POWER_FAILURE = 0x9B,
+    QUERY_DEVICE_TYPE = 0x99,
+    QUERY_RANDOM_ADDR_H = 0xC2,
+    QUERY_RANDOM_ADDR_M = 0xC3,
+    QUERY_RANDOM_ADDR_L = 0xC4,
     QUERY_PHM = 0x9A,
     QUERY_FADE = 0xA5,
     QUERY_COLOR_TYPE_FEATURES = 0xF9,
+    QUERY_COLOR_VALUE = 0xFA,
+    QUERY_CONTENT_DTR0 = 0x98,
     QUERY_SCENE_LEVEL = 0xB0,
     READ_MEM_LOC = 0xC5,
     SET_TEMP_RGB_DIM = 0xEB,
@@ -68,7 +82,8 @@ enum CommandOpCodes {
     STORE_DTR_AS_SCENE =0x40,
     ADD_TO_GROUP = 0x60,
     SET_SHORT_ADDR = 0x80,
-    SET_MAX_LEVEL = 0x2A
+    SET_MAX_LEVEL = 0x2A,
+    STORE_ACTUAL_LEVEL_IN_DTR0 = 0x21
 };
 
 enum InstanceType { GENERIC = 0, OCCUPANCY = 3, LIGHT = 4, BUTTON = 1 };
@@ -76,7 +91,186 @@ enum ColorType { RGB, TEMPERATURE, UNSUPPORTED };
 
 #define YES 0xFF
 
+// QUERY COLOUR VALUE selectors (loaded into DTR0), iec62386-209
+#define COLOUR_VALUE_TC_COOLEST 0x80
+#define COLOUR_VALUE_TC_WARMEST 0x82
+
+// Luminaire groups
+#define DALI_GROUPS 16
+
+/** Group membership of the luminaires, both ways round
+ */
+struct DALIGroupTable {
+    // Groups of the luminaire at each short address, bit n for group n
+    uint16_t groups[64];
+    // Luminaires in each group, bit n for short address n
+    uint64_t members[DALI_GROUPS];
+};
+
+/** Luminaires reporting a fault, bit n for short address n
+ */
+struct DALIFaults {
+    uint64_t lamp_failure;
+    // No arc power command since the luminaire powered up, only swept on
+    // request
+    uint64_t power_failure;
+};
+
+// How long the values loaded into the DTRs are trusted. Units that power
+// up or join the bus in the meantime hold other values.
+#ifndef DALI_DTR_HOLD_MS
+#define DALI_DTR_HOLD_MS 1000
+#endif
+
+/** Values last loaded into DTR0-2, which every unit of one standard
+ * (iec62386-102 or -103) receives
+ */
+struct DTRState {
+    uint8_t value[3];
+    // Bit n set if DTRn holds value[n]
+    uint8_t known;
+    // us_ticker_read() when each was loaded
+    uint32_t time[3];
+};
+
+// COMPARE results kept between devices during a search
+#define SEARCH_HINTS 32
+
+// Searches of units that picked the same random address before they are
+// left sharing a short address
+#ifndef DALI_COLLISION_RETRIES
+#define DALI_COLLISION_RETRIES 3
+#endif
+
+// QUERY SHORT ADDRESS answers that must come back clean before a found
+// unit is taken to be alone at its random address. Units sharing it answer
+// together, which only decodes cleanly when the answers line up.
+#ifndef DALI_COLLISION_CHECKS
+#define DALI_COLLISION_CHECKS 2
+#endif
+
+// Times a found unit may fail to answer QUERY SHORT ADDRESS before the
+// search gives up
+#define SEARCH_RETRIES 3
+
+/** Progress of a random address search, kept between devices so the next
+ * search resumes where the last one ended instead of starting from the top
+ */
+struct SearchState {
+    // Every device still in the search has a random address >= lo
+    uint32_t lo;
+    // Addresses that answered COMPARE with yes, ascending
+    uint32_t hints[SEARCH_HINTS];
+    int num_hints;
+};
+
+/** A search of the selected units that sends one frame at a time, see
+ * DALIDriver::search_step()
+ */
+struct SearchRun {
+    // Step of search_step()
+    uint8_t step;
+    // INITIALISE data of the units searched
+    uint8_t selector;
+    // The units searched have picked their random addresses
+    uint8_t randomised;
+    // Clean QUERY SHORT ADDRESS answers from the unit found
+    uint8_t checks;
+    // Times in a row a unit found did not answer
+    uint8_t retries;
+    // Searches of the units sharing a random address so far
+    uint8_t rounds;
+    // Short address of the units searched again, once rounds is set
+    uint8_t shared;
+    // Short address given to the unit found
+    uint8_t addr;
+    // Short addresses given to several units at once, to search again
+    uint64_t collided;
+    // Of those, the ones still to search again this round
+    uint64_t redo;
+    // COMPARE answers, and the range being bisected
+    SearchState search;
+    int hint_lo;
+    int hint_hi;
+    uint32_t lo;
+    uint32_t hi;
+    // us_ticker_read() of the last INITIALISE, not kept across boots
+    uint32_t initialised_us;
+};
+
+// Units stay in initialisation for 15 minutes, a commissioning run that
+// takes longer than this selects the remaining ones again
+#ifndef DALI_COMMISSION_REFRESH_MS
+#define DALI_COMMISSION_REFRESH_MS 600000
+#endif
+
+#define DALI_COMMISSION_MAGIC 0x44414C43
+#define DALI_COMMISSION_VERSION 2
+
+// DALIDriver::commission_step() once the run is complete
+#define DALI_COMMISSION_FINISHED (-1)
+
+// Phases of a commissioning run, in order
+enum DALICommissionPhase {
+    // Finding the short addresses in use by luminaires
+    DALI_COMMISSION_SCAN_GEAR,
+    // Addressing luminaires without an address or sharing one
+    DALI_COMMISSION_SEARCH_GEAR,
+    // Reading what the new luminaires can do
+    DALI_COMMISSION_RECORD_GEAR,
+    DALI_COMMISSION_SCAN_INPUTS,
+    DALI_COMMISSION_SEARCH_INPUTS,
+    // Enabling the instances of the new input devices
+    DALI_COMMISSION_CONFIGURE_INPUTS,
+    DALI_COMMISSION_DONE
+};
+
+/** Progress of a commissioning run, see DALIDriver::commission_step()
+ *
+ * Saved as is as the checkpoint of the run.
+ */
+struct DALICommissionState {
+    uint32_t magic;
+    uint16_t version;
+    // DALICommissionPhase
+    uint8_t phase;
+    // Step within the phase
+    uint8_t step;
+    // Short address the phase is at
+    uint8_t addr;
+    // Step within the unit at addr, when reading or configuring it
+    uint8_t unit_step;
+    // Units given a short address by the run
+    uint8_t added;
+    // The units without a short address have been searched
+    uint8_t searched;
+    // Short addresses in use in the address space of the phase
+    uint64_t used;
+    // Short addresses whose units all move to free ones: the ones several
+    // units answer at, and input devices in the luminaire range
+    uint64_t moves;
+    // Units to read or configure, the new ones and the ones the bus map
+    // does not know
+    uint64_t todo;
+    // Random address search
+    SearchRun run;
+    // Random address of the unit being scanned
+    uint32_t random_addr;
+    // Sum of all the bytes above
+    uint32_t checksum;
+};
+
+struct GearCommands;
+struct DeviceCommands;
+class DALITransaction;
+
 class DALIDriver {
+    // Commissioning command sets, see DALICommandSet.h
+    friend struct GearCommands;
+    friend struct DeviceCommands;
+    // Checks the capability table for the colour steps it sends
+    friend class DALITransaction;
+
 public:
     /** Constructor DALIDriver
      *
@@ -94,9 +288,94 @@ public:
      *
      *   @returns    the number of logical units on the bus
      *
+     *   NOTE: With storage set, a saved bus map that still matches the bus
+     *   is used as is and the bus is not searched
      */
     int init();
 
+    /** Give addresses to units added since init(), on a live bus
+     *
+     *   @returns    the number of units that got a new short address
+     *
+     *   NOTE: Takes one query per short address to find the ones in use,
+     *   then searches only the units without an address and gives them the
+     *   lowest free ones. Units found sharing a short address are all moved
+     *   to free ones. A luminaire added past get_num_lights() moves the
+     *   start of the input device range.
+     */
+    int add_new_units();
+
+    /** Start commissioning the bus one step at a time
+     *
+     *   @param state   Receives the first step, or the step an interrupted
+     * run had reached
+     *   @returns       true if the run picks up from a saved checkpoint
+     *
+     *   NOTE: With storage set, a run saves its progress and the bus map
+     *   after each unit it addresses or reads, every few addresses it scans
+     *   and at the end of each phase.
+     *   A run that did not finish, e.g. because of a reboot, picks up from
+     *   there. DALICommissioner runs the steps between other commands.
+     */
+    bool commission_begin(DALICommissionState &state);
+
+    /** Send the next commissioning frame
+     *
+     *   @param state   Progress of the run, updated
+     *   @returns       Milliseconds until the next step may run, or
+     * DALI_COMMISSION_FINISHED once every unit is addressed, set up and in
+     * the bus map
+     *
+     *   NOTE: Each step sends one command or query, with the DTR and device
+     *   type frames it needs. Luminaires keep the short addresses they have,
+     *   and the ones without one get the lowest free addresses, so a new
+     *   bus ends up as after init() and the lights already addressed stay
+     *   controllable. Input devices are moved to close any gap after the
+     *   luminaires. Only units the bus map does not know are read and
+     *   set up. Input devices keep sending events, which win or lose the
+     *   bus against the commissioning frames.
+     */
+    int commission_step(DALICommissionState &state);
+
+    /** Set where the bus map is kept between boots
+     *
+     *   @param storage  Key-value backend, or NULL to always search the bus
+     */
+    void set_storage(DALIStorage *storage);
+
+    /** Delete the saved bus map so the next init() searches the bus
+     *
+     *   @returns    0 on success, negative error code otherwise
+     */
+    int forget_bus_map();
+
+    /** Keep a copy of the state of the control gear
+     *
+     *   @param shadow  Copy to serve getters from and to leave out redundant
+     * commands with, or NULL to always go to the bus
+     *
+     *   NOTE: Only state changed through this driver is tracked. Call
+     *   DALIShadow::invalidate() if something else may have changed it.
+     *   The shadow gets the level limits of the luminaires in the bus map,
+     *   call set_shadow() again after invalidate() to keep set levels.
+     */
+    void set_shadow(DALIShadow *shadow);
+
+    /** Load the data transfer registers on the next command that needs them
+     *
+     *   NOTE: The driver leaves out DTR0-2 loads that would not change them.
+     *   It forgets them by itself when the encoder hears a command from
+     *   another control device. Call this if they may have changed otherwise.
+     */
+    void forget_dtrs();
+
+    /** Only send the search address bytes that changed
+     *
+     *   @param on  On by default. Off sends SEARCHADDRH, M and L for every
+     * new search address, e.g. to compare frame counts.
+     */
+    void set_incremental_search(bool on);
+
     /** Initialise the luminaires on the bus (give them addresses)
      *
      *   @returns    the number of luminaires on the bus
@@ -112,12 +391,23 @@ public:
     int init_inputs();
 
     /** Attach a callback when input event is generated
+     *
+     * The encoder listens for events all the time and arbitrates commands
+     * against them, so commands can be sent while the callback is attached.
+     * Input devices are only told to stop quiescent mode if the driver put
+     * them in it.
      *
      *   @param status_cb callback to take in the 32 bit event message
+     *   @param queue     event queue to run the callback on, NULL to run it
+     *                    on a dispatcher thread of the encoder. Without an
+     *                    RTOS call encoder.dispatch_events() instead.
      */
-    void attach(mbed::Callback<void(uint32_t)> status_cb);
+    void attach(mbed::Callback<void(uint32_t)> status_cb,
+                EventQueue *queue = NULL);
 
-    /** Detach the callback
+    /** Detach the callback, events are dropped until reattach()
+     *
+     * No frames are sent, input devices keep sending events.
      */
     void detach();
 
@@ -129,36 +419,47 @@ public:
      *
      *   @param address     The address byte for command
      *   @param opcode      The opcode byte
+     *   @param kind        SEND_TWICE for the first frame of a send-twice pair
      *
      */
-    void send_command_standard(uint8_t address, uint8_t opcode);
+    void send_command_standard(
+        uint8_t address, uint8_t opcode,
+        BusScheduler::FrameKind kind = BusScheduler::FORWARD);
 
     /** Send a standard command on the bus to input devices
      *
      *   @param address      The address byte for command
      *   @param instance     The instance byte for command
      *   @param opcode       The opcode byte
+     *   @param kind         SEND_TWICE for the first frame of a send-twice pair
      *
      */
-    void send_command_standard_input(uint8_t address, uint8_t instance,
-                                     uint8_t opcode);
+    void send_command_standard_input(
+        uint8_t address, uint8_t instance, uint8_t opcode,
+        BusScheduler::FrameKind kind = BusScheduler::FORWARD);
 
     /** Send a special command on the bus
      *
      *   @param address     The special command opcode from SpecialCommandOpAddr
      * enum
      *   @param opcode      The data for the command
+     *   @param kind        SEND_TWICE for the first frame of a send-twice pair
      *
      */
-    void send_command_special(uint8_t address, uint8_t opcode);
+    void send_command_special(
+        uint8_t address, uint8_t opcode,
+        BusScheduler::FrameKind kind = BusScheduler::FORWARD);
 
     /** Send a special command on the bus to input devices
      *
      *   @param instance     The instance byte for command
      *   @param opcode       The opcode byte
+     *   @param kind         SEND_TWICE for the first frame of a send-twice pair
      *
      */
-    void send_command_special_input(uint8_t instance, uint8_t opcode);
+    void send_command_special_input(
+        uint8_t instance, uint8_t opcode,
+        BusScheduler::FrameKind kind = BusScheduler::FORWARD);
 
     /** Send a direct arc power command on the bus
      *
@@ -168,6 +469,19 @@ public:
      */
     void send_command_direct(uint8_t address, uint8_t opcode);
 
+    /** Send a forward frame that is already encoded
+     *
+     *   @param frame   The frame, address byte first
+     *   @param bits    16 for control gear, 24 for input devices
+     *   @param kind    SEND_TWICE for the first frame of a send-twice pair
+     *
+     *   NOTE: Goes through the same DTR and search address tracking as the
+     *   send_command functions, so a DTR load that would not change the DTR
+     *   is left out here as well
+     */
+    void send_frame(uint32_t frame, int bits,
+                    BusScheduler::FrameKind kind = BusScheduler::FORWARD);
+
     /** Get the address of a group
      *
      *   @param group_number    The group number [0-15]
@@ -197,6 +511,64 @@ public:
      */
     bool remove_from_group(uint8_t addr, uint8_t group);
 
+    /** Read the groups of every luminaire
+     *
+     *   @param table   Receives the groups of each luminaire and the members
+     * of each group
+     *   @returns       Number of luminaires that did not answer
+     *
+     *   NOTE: One QUERY GEAR GROUPS (L and H) pair per luminaire, fewer with
+     *   a DALIShadow that already knows them
+     */
+    int read_groups(DALIGroupTable &table);
+
+    /** Make the groups of every luminaire match a table
+     *
+     *   @param desired Groups wanted for each luminaire in desired.groups,
+     * members is not used
+     *   @param actual  Receives the groups read back and the members of each
+     * group, can be the same table as desired
+     *   @returns       Number of luminaires whose groups do not match (or
+     * that did not answer), 0 on success
+     *
+     *   NOTE: Reads the groups of each luminaire once, sends only the ADD TO
+     *   GROUP and REMOVE FROM GROUP commands that change something, and reads
+     *   back only the luminaires that were changed
+     */
+    int set_groups(const DALIGroupTable &desired, DALIGroupTable &actual);
+
+    /** Find the luminaires that answer YES to a yes/no query
+     *
+     *   @param opcode  The query, e.g. QUERY_LAMP_FAILURE
+     *   @param table   Groups from read_groups() or set_groups() to narrow
+     * the search down with, or NULL
+     *   @returns       Bitmap of the short addresses that answered YES
+     *
+     *   NOTE: Starts with one broadcast query, which is all it takes when
+     *   no luminaire answers: several answers garble the frame, but that
+     *   still means yes. Otherwise each group with two or more luminaires
+     *   left is asked, a group that does not answer clears its members, and
+     *   only the luminaires left are asked one by one.
+     */
+    uint64_t find_yes(uint8_t opcode, const DALIGroupTable *table = NULL);
+
+    /** Find the luminaires with a lamp failure, and optionally the ones
+     * with a power failure
+     *
+     *   @param faults          Receives the luminaires with each fault
+     *   @param table           As for find_yes()
+     *   @param power_failure   Also sweep QUERY POWER FAILURE. Every
+     * luminaire answers YES to it from power up until its first arc power
+     * command, so right after boot this finds every luminaire at the cost of
+     * a full scan. faults.power_failure is 0 without it.
+     *
+     *   NOTE: One frame on a bus without faults, two with power_failure.
+     *   Control gear failure has no yes/no query, get_error() reads it from
+     *   one luminaire.
+     */
+    void find_faults(DALIFaults &faults, const DALIGroupTable *table = NULL,
+                     bool power_failure = false);
+
     /** Set the light output for a device/group
      *
      *   @param addr    8 bit address (device or group)
@@ -272,6 +644,20 @@ public:
     */
     uint8_t query_color_type_features(uint8_t addr);
 
+    /** Get what a luminaire can do
+     *
+     *   @param addr    Short address of the luminaire
+     *   @returns       Its bus map entry, with the device type, the DT8
+     * colour type features and the colour temperature limits. For an input
+     * device, the entry with its instances as configured by init().
+     *
+     *   NOTE: Read once per luminaire, by init() and add_new_units() or on
+     *   first use, and kept in the bus map. The colour functions use it to
+     *   leave out DT8 commands for gear without colour control and to keep
+     *   colour temperatures within the limits of the gear.
+     */
+    const DALIUnitRecord &get_capabilities(uint8_t addr);
+
     ColorType get_color_type(uint8_t addr);
 
     /** Query if the light is capable of color temperature
@@ -456,6 +842,17 @@ public:
      */
     void set_scene(uint8_t addr, uint8_t scene, uint8_t level);
 
+    /** Get the light output for a scene
+     *
+     *   @param addr    8 bit address (device or group)
+     *   @param scene   scene number [0, 15]
+     *   @returns
+     *       Light output level [0, 254], or 255 (MASK) if not part of the
+     * scene, from QUERY SCENE LEVEL command
+     *
+     */
+    uint8_t get_scene_level(uint8_t addr, uint8_t scene);
+
     /** Remove device/group from scene
      *
      *   @param addr    8 bit address (device or group)
@@ -479,6 +876,20 @@ public:
      */
     uint32_t recv();
 
+    /** Get the bus statistics counted since the last reset_stats()
+     *
+     *   @returns    Frames, replies, timeouts, decode errors and bus time per
+     * frame class, and a histogram of query latencies
+     *
+     *   NOTE: Only counted when built with the dali.stats config option,
+     *   otherwise everything reads zero
+     */
+    const DALIStats &get_stats();
+
+    /** Clear the bus statistics
+     */
+    void reset_stats();
+
     /** Parse the event message
      *
      *   @param msg      the 32 bit event message
@@ -512,65 +923,331 @@ private:
     void set_color_temp(uint8_t addr, uint16_t temp);
     void set_color_temp(uint8_t addr, uint8_t r, uint8_t g, uint8_t b, uint8_t dim = 0);
 
-    // Some commands must be sent twice, utility function to do that
+    // Receive the backward frame to the last forward frame, see
+    // ManchesterEncoder::recv()
+    int recv_frame();
+
+    // Statistics, do nothing unless built with dali.stats
+    uint32_t stats_now();
+    void record_send(DALIFrameClass cls, BusScheduler::FrameKind kind,
+                     int bits, uint32_t start);
+    void record_recv(int response, uint32_t start);
+
+    // Follow what a forward frame does to the DTRs and search address,
+    // false if it can be left out
+    bool track_gear(DALIFrameClass cls, uint16_t frame);
+    bool track_input(uint32_t frame);
+
+    /** Read the groups of a luminaire
+     *
+     *   @param cached  Take them from the DALIShadow if it knows them
+     *   @returns       16 bit group mask, negative if it did not answer
+     */
+    int query_groups(uint8_t addr, bool cached = true);
+
+    // Send a yes/no query, true if anything answered
+    bool query_yes(uint8_t addr, uint8_t opcode);
+
+    // Record a group change and the QUERY GROUPS answer after it
+    void shadow_groups(uint8_t addr, uint8_t group, bool member, int groups);
+
+    // Some commands must be sent twice, utility functions to do that
     void send_twice(uint8_t addr, uint8_t opcode);
+    void send_twice_special(uint8_t address, uint8_t opcode);
+    void send_twice_input(uint8_t addr, uint8_t inst, uint8_t opcode);
+    void send_twice_special_input(uint8_t instance, uint8_t opcode);
 
     /** Assign addresses to the luminaires on the bus
      *
-     *   @returns    The number of input devices found on bus
+     *   @param reset   Readdress all luminaires, otherwise the addresses in
+     * use are kept and only luminaires without one are addressed
+     *   @returns       Highest short address in use plus one
      *
      *   NOTE: This process is mostly copied from page 82 of iec62386-102
-     *   The addresses will be in the range [0, number units - 1]
      */
     int assign_addresses(bool reset = false);
 
     /** Assign addresses to the input devices on the bus
      *
+     *   @param reset        Readdress all input devices, otherwise the
+     * addresses in use are kept and only devices without one are addressed
      *   @param num_found    The number of luminaires already found (so that the
      * starting address is last_luminaire + 1)
-     *   @returns            The number of unput devices found on bus
+     *   @returns            Highest short address in use plus one
      *
      *   NOTE: This process is mostly copied from page 82 of iec62386-102
-     *   The addresses will be in the range [0, number units - 1]
      */
     int assign_addresses_input(bool reset = false, int num_found = 0);
 
-    /** Assign addresses to the logical units on the bus
+    /** Find the short addresses in use
      *
-     *   @returns    The number of logical units found on bus
+     *   @param duplicates   Receives the addresses several units answer
+     *   @returns            Bitmap of the addresses in use
      *
-     *   NOTE: This process is mostly copied from page 82 of iec62386-102
-     *   The addresses will be in the range [0, number units - 1]
+     *   NOTE: One QUERY RANDOM ADDRESS (L) per address, which also records
+     *   the random address of each unit in the bus map
      */
-    int get_highest_address();
+    template <class Commands> uint64_t scan(uint64_t &duplicates);
 
-    /** Set the controller search address for luminaires
-     * This address will be used in search commands to determine what
-     * control units have this address or a numerically lower address
+    /** Search the selected units and give them the lowest free addresses
      *
-     *   @param val    Search address valued (only lower 24 bits are used)
+     *   @param selector    INITIALISE data, Commands::SELECT_ALL,
+     * Commands::SELECT_UNADDRESSED or Commands::select(address)
+     *   @param used        Bitmap of the addresses in use, updated
+     *   @returns           Bitmap of the addresses given out
+     *
+     *   NOTE: Units that picked the same random address get the same short
+     *   address. They pick new random addresses and are searched again, up
+     *   to DALI_COLLISION_RETRIES times.
+     */
+    template <class Commands>
+    uint64_t commission(uint8_t selector, uint64_t &used);
+
+    /** Move the units sharing a short address to free ones
+     *
+     *   @returns    Bitmap of the addresses given out
+     */
+    template <class Commands>
+    uint64_t resolve_duplicates(uint64_t duplicates, uint64_t &used);
+
+    /** Lowest address not set in the bitmap, -1 if all are
+     */
+    int lowest_free(uint64_t used);
+
+    /** Highest address set in the bitmap, -1 if none is
+     */
+    int highest_used(uint64_t used);
+
+    /** Number of addresses set in the bitmap
+     */
+    int count_units(uint64_t units);
+
+    /** Add a newly addressed luminaire to the bus map, with its
+     * capabilities
+     */
+    void record_light(uint8_t addr);
+
+    /** Read a DT8 colour value
+     *
+     *   @param selector    COLOUR_VALUE_* selector
+     *   @returns           16 bit value, negative if the gear did not answer
+     *
+     *   NOTE: Two queries, which stay in one record_light_step(): the gear
+     *   answers the MSB and leaves the LSB in DTR0, and any frame sent
+     *   between the steps may load DTR0 and replace it
+     */
+    int query_colour_value(uint8_t addr, uint8_t selector);
+
+    /** Check if DT8 commands to an address can reach colour control gear
+     */
+    bool colour_capable(uint8_t addr);
+
+    /** Colour temperature to send for a Kelvin value, clamped to the limits
+     * of the luminaire when they are known, the warmest one for 0 Kelvin
+     */
+    uint16_t colour_mirek(uint8_t addr, uint16_t kelvin);
+
+    /** Pass the level limits of the luminaires in the bus map to the shadow
+     */
+    void shadow_limits();
+
+    /** Run one step of record_light()
+     *
+     *   @param step    0 for the first step
+     *   @returns       The next step, 0 once the luminaire is recorded
+     */
+    int record_light_step(uint8_t addr, int step);
+
+    /** Enable the instances of a newly addressed input device and add it to
+     * the bus map
+     */
+    void configure_input(uint8_t addr);
+
+    /** Run one step of configure_input()
+     *
+     *   @param step    0 for the first step
+     *   @returns       The next step, 0 once the device is set up
+     */
+    int configure_input_step(uint8_t addr, int step);
+
+    // Phases of commission_step(), each sends at most one command or query
+    // and returns the time to hold off, or COMMISSION_AGAIN if it sent
+    // nothing
+    template <class Commands> int commission_scan(DALICommissionState &state);
+    template <class Commands>
+    int commission_search(DALICommissionState &state);
+    int commission_record(DALICommissionState &state);
+    int commission_configure(DALICommissionState &state);
+
+    // Move the scan on to the next address
+    void commission_scanned(DALICommissionState &state);
+
+    // Move on to a phase and save the checkpoint
+    void commission_phase(DALICommissionState &state, uint8_t phase);
+
+    // Record a unit given a short address
+    void commission_added(DALICommissionState &state, uint8_t addr,
+                          uint32_t random_addr);
+
+    // Short addresses below num_lights
+    uint64_t lights_mask();
+
+    /** Read the checkpoint of an unfinished commissioning run
      *
+     *   @returns    true if there is one
      */
-    void set_search_address(uint32_t val);
+    bool load_checkpoint(DALICommissionState &state);
 
-    /** Set the controller search address  for input devices
+    /** Write the checkpoint, and the bus map it goes with
+     */
+    void save_checkpoint(DALICommissionState &state);
+
+    /** Set the controller search address
      * This address will be used in search commands to determine what
      * control units have this address or a numerically lower address
+     * Bytes the units already hold from the previous call are not resent
      *
      *   @param val    Search address valued (only lower 24 bits are used)
      *
      */
-    void set_search_address_input(uint32_t val);
+    template <class Commands> void set_search_address(uint32_t val);
+
+    /** Send the first byte of the search address the units do not hold
+     *
+     *   @returns   false if they hold all of val and nothing was sent
+     */
+    template <class Commands> bool search_address_step(uint32_t val);
+
+    /** Start a search from the bottom of the random address range
+     */
+    void search_reset(SearchState &state);
+
+    /** Remember an address that answered COMPARE with yes
+     */
+    void search_add_hint(SearchState &state, uint32_t addr);
+
+    /** Record that the devices at addr were withdrawn from the search
+     */
+    void search_found(SearchState &state, uint32_t addr);
+
+    /** Record that no device is below lo and drop the hints under it
+     */
+    void search_drop_below(SearchState &state, uint32_t lo);
+
+    /** Start a search of the selected units
+     *
+     *   @param selector    INITIALISE data, Commands::SELECT_ALL,
+     * Commands::SELECT_UNADDRESSED or Commands::select(address)
+     */
+    void search_begin(SearchRun &run, uint8_t selector);
+
+    /** Send the next frame of a search, which gives the lowest free
+     * addresses to the units in the order of their random addresses
+     *
+     *   @param run     Search progress, updated
+     *   @param used    Bitmap of the addresses in use, updated
+     *   @returns       Milliseconds until the next step may run,
+     * SEARCH_FOUND once run.addr was given to the unit at random address
+     * run.hi, or SEARCH_DONE once TERMINATE was sent
+     *
+     *   NOTE: Resumes from the last device found and the COMPARE answers
+     *   from earlier searches, so only the interval that can hold the next
+     *   device is bisected. Units that picked the same random address get
+     *   the same short address. They pick new random addresses and are
+     *   searched again, up to DALI_COLLISION_RETRIES times.
+     */
+    template <class Commands> int search_step(SearchRun &run, uint64_t &used);
+
+    /** Check if any unit has a random address at or below addr
+     */
+    template <class Commands> bool search_compare(uint32_t addr);
+
+    /** Send the next frame of search_compare()
+     *
+     *   @returns   The answer once COMPARE was sent, -1 if a search address
+     * byte was sent
+     */
+    template <class Commands> int search_compare_step(uint32_t addr);
+
+    /** Record a search address byte sent on the bus
+     *
+     *   @param addr    Tracked search address
+     *   @param known   Bitmask of the bytes of addr that are valid
+     *   @param byte    Byte index, 2 for H, 1 for M, 0 for L
+     *   @param value   Value sent
+     */
+    void track_search_byte(uint32_t &addr, uint8_t &known, int byte,
+                           uint8_t value);
+
+    /** Record a DTR load
+     *
+     *   @param dtr     Tracked DTRs of the standard the load is for
+     *   @param n       DTR number [0, 2]
+     *   @param value   Value to load
+     *   @returns       false if the DTR already holds the value, so the load
+     * can be left out
+     */
+    bool load_dtr(DTRState &dtr, int n, uint8_t value);
+
+    /** Check if a byte of the tracked search address already has a value
+     *
+     *   @returns   true if the byte is known and equal to the byte of val
+     */
+    bool search_byte_matches(uint32_t addr, uint8_t known, int byte,
+                             uint32_t val);
 
     /** Check the response from the bus
      *
      *   @param expected    Expected response from the bus
      *   @returns
-     *       True if response matches expected response
+     *       True if response matches expected response. Any frame, even
+     *       a garbled one, counts as YES, since it means several devices
+     *       answered.
      *
      */
     bool check_response(uint8_t expected);
 
+    /** Read the bus map from storage
+     *
+     *   @returns    true if a complete map of this version was read
+     */
+    bool load_map();
+
+    /** Write the bus map to storage
+     */
+    void save_map();
+
+    /** Check the loaded bus map against the bus
+     *
+     *   @returns    true if every unit is where the map says and no unit is
+     * missing from it
+     *
+     *   NOTE: Costs one query per short address of each address space, two
+     *   more per unit and a handful of frames, against a full search of
+     *   both address spaces
+     */
+    bool validate_map();
+
+    /** Check one address space of the loaded bus map against the bus
+     *
+     *   @param first   Short address of the first unit in the map
+     *   @param count   Number of units in the map
+     *   @returns       true if each unit answers with the whole random address
+     * it was addressed with, and nothing answers at the other short addresses
+     */
+    template <class Commands> bool validate_units(int first, int count);
+
+    /** Check if any unit has no short address
+     */
+    template <class Commands> bool any_unaddressed();
+
+    /** Checksum of the bus map, excluding the checksum field
+     */
+    uint32_t map_checksum();
+
+    // Checksum of the first size bytes of data
+    uint32_t checksum(const void *data, size_t size);
+
     /** Get the index of a control unit
      *
      *   @param addr     The address of the device
@@ -586,6 +1263,38 @@ private:
     int num_inputs;
     // Address where input devices start
     int inputs_start;
+    // Search address last sent to control gear, and which bytes are valid
+    uint32_t _search_addr;
+    uint8_t _search_addr_known;
+    // Search address last sent to input devices, and which bytes are valid
+    uint32_t _search_addr_input;
+    uint8_t _search_addr_input_known;
+    // Only the changed search address bytes are sent
+    bool _incremental_search;
+    // DTRs last loaded into control gear and into input devices
+    DTRState _dtr;
+    DTRState _dtr_input;
+    // encoder.foreign_frames() when the DTRs were last trusted
+    uint32_t _foreign_frames;
+    // Input devices were last told to start quiescent mode
+    bool _quiet;
+    // Where the bus map is kept, NULL if it is not
+    DALIStorage *_storage;
+    // Copy of the gear state, NULL if none is kept
+    DALIShadow *_shadow;
+    // Short address, random address and type of every unit found
+    DALIBusMap _map;
+#if MBED_CONF_DALI_STATS
+    DALIStats _stats;
+    // Half bit time, for the time frames take on the wire
+    int _half_bit_us;
+    // Class of the last forward frame, which replies are counted in
+    DALIFrameClass _last_class;
+    // Time the last forward frame started on the wire
+    uint32_t _last_send;
+    // The next frame is the second of a send-twice pair
+    bool _twice_pending;
+#endif
 };
 
 #endif
@@ -0,0 +1,214 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALIHealthPoller.h"
+
+// QUERY INSTANCE STATUS, iec62386-103
+#define QUERY_INSTANCE_STATUS 0x86
+// Longest idle time counted, long idle times only bring the credit to zero
+#define MAX_ELAPSED_US 10000000
+
+DALIHealthPoller::DALIHealthPoller(DALICommandQueue &queue, DALIDriver &dali)
+    : _queue(queue), _dali(dali), _budget(DALI_POLL_BUDGET_PERCENT),
+      _credit_us(0), _last_us(us_ticker_read()), _cost_us(0),
+      _average_us(DALI_POLL_QUERY_US), _queued(false), _polls(0)
+{
+    restart();
+}
+
+void DALIHealthPoller::set_budget(uint8_t percent)
+{
+    if (percent < 1) {
+        percent = 1;
+    } else if (percent > 100) {
+        percent = 100;
+    }
+    _budget = percent;
+}
+
+void DALIHealthPoller::attach(
+    mbed::Callback<void(const DALIHealthEvent &)> changed)
+{
+    _changed = changed;
+}
+
+void DALIHealthPoller::restart()
+{
+    _addr = 0;
+    _item = 0;
+    for (int i = 0; i < DALI_MAP_UNITS; i++) {
+        _status[i] = DALI_HEALTH_UNKNOWN;
+        _level[i] = DALI_HEALTH_UNKNOWN;
+        for (int j = 0; j < DALI_POLL_INSTANCES; j++) {
+            _instance_status[i][j] = DALI_HEALTH_UNKNOWN;
+        }
+    }
+}
+
+bool DALIHealthPoller::poll()
+{
+    if (_queued) {
+        return false;
+    }
+    uint32_t now = us_ticker_read();
+    uint32_t elapsed = now - _last_us;
+    _last_us = now;
+    if (elapsed > MAX_ELAPSED_US) {
+        elapsed = MAX_ELAPSED_US;
+    }
+    // Nothing is queued, so the bus thread is done with _cost_us
+    _credit_us += elapsed * _budget / 100;
+    _credit_us -= (int32_t)_cost_us;
+    _cost_us = 0;
+    if (_credit_us > 0) {
+        _credit_us = 0;
+    }
+    if (_credit_us < 0) {
+        return false;
+    }
+    _queued = true;
+    if (!_queue.call(mbed::callback(this, &DALIHealthPoller::query_next),
+                     DALI_PRIORITY_BACKGROUND,
+                     mbed::callback(this, &DALIHealthPoller::done))) {
+        _queued = false;
+        return false;
+    }
+    return true;
+}
+
+uint32_t DALIHealthPoller::cycle_ms()
+{
+    return (uint64_t)num_items() * _average_us * 100 / _budget / 1000;
+}
+
+uint32_t DALIHealthPoller::polls()
+{
+    return _polls;
+}
+
+int DALIHealthPoller::value(DALIHealthItem item, uint8_t addr,
+                            uint8_t instance)
+{
+    if (addr >= DALI_MAP_UNITS) {
+        return DALI_HEALTH_UNKNOWN;
+    }
+    switch (item) {
+        case DALI_HEALTH_GEAR_STATUS:
+            return _status[addr];
+        case DALI_HEALTH_GEAR_LEVEL:
+            return _level[addr];
+        default:
+            if (instance >= DALI_POLL_INSTANCES) {
+                return DALI_HEALTH_UNKNOWN;
+            }
+            return _instance_status[addr][instance];
+    }
+}
+
+int DALIHealthPoller::query_next()
+{
+    if (!seek()) {
+        return 0;
+    }
+    uint8_t addr = _addr;
+    uint8_t item = _item++;
+    uint32_t start = us_ticker_read();
+    if (addr < _dali.get_num_lights()) {
+        _dali.send_command_standard(addr, item ? QUERY_ACTUAL_LEVEL
+                                               : QUERY_ERROR);
+        int value = (int)_dali.recv();
+        if (item) {
+            record(DALI_HEALTH_GEAR_LEVEL, addr, 0, _level[addr], value);
+        } else {
+            record(DALI_HEALTH_GEAR_STATUS, addr, 0, _status[addr], value);
+        }
+    } else {
+        _dali.send_command_standard_input(addr, item, QUERY_INSTANCE_STATUS);
+        int value = (int)_dali.recv();
+        record(DALI_HEALTH_INSTANCE_STATUS, addr, item,
+               _instance_status[addr][item], value);
+    }
+    uint32_t cost = us_ticker_read() - start;
+    _average_us += ((int32_t)cost - (int32_t)_average_us) / 8;
+    _polls++;
+    _cost_us = cost;
+    return 0;
+}
+
+void DALIHealthPoller::done(DALIHandle handle, int result)
+{
+    _queued = false;
+}
+
+bool DALIHealthPoller::seek()
+{
+    int end = _dali.get_num_lights() + _dali.get_num_inputs();
+    if (end > DALI_MAP_UNITS) {
+        end = DALI_MAP_UNITS;
+    }
+    // Every address once, and back to the start
+    for (int i = 0; i <= end; i++) {
+        if (_addr >= end) {
+            _addr = 0;
+            _item = 0;
+        }
+        if (_item < items_of(_addr)) {
+            return true;
+        }
+        _addr++;
+        _item = 0;
+    }
+    return false;
+}
+
+int DALIHealthPoller::items_of(uint8_t addr)
+{
+    if (addr < _dali.get_num_lights()) {
+        return 2;
+    }
+    int instances = _dali.get_capabilities(addr).num_instances;
+    return instances < DALI_POLL_INSTANCES ? instances : DALI_POLL_INSTANCES;
+}
+
+int DALIHealthPoller::num_items()
+{
+    int end = _dali.get_num_lights() + _dali.get_num_inputs();
+    int items = 0;
+    for (int addr = 0; addr < end && addr < DALI_MAP_UNITS; addr++) {
+        items += items_of(addr);
+    }
+    return items;
+}
+
+void DALIHealthPoller::record(DALIHealthItem item, uint8_t addr,
+                              uint8_t instance, int16_t &last, int value)
+{
+    int before = last;
+    last = value;
+    // The first answer is the baseline
+    if (value == before || before == DALI_HEALTH_UNKNOWN) {
+        return;
+    }
+    if (_changed) {
+        DALIHealthEvent event;
+        event.item = item;
+        event.addr = addr;
+        event.instance = instance;
+        event.before = before;
+        event.value = value;
+        _changed(event);
+    }
+}
@@ -0,0 +1,176 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_HEALTH_POLLER_H
+#define DALI_HEALTH_POLLER_H
+
+#include "DALICommandQueue.h"
+#include "DALIDriver.h"
+#include "mbed.h"
+
+// Share of the bus time polling may take by default, in percent
+#ifndef DALI_POLL_BUDGET_PERCENT
+#define DALI_POLL_BUDGET_PERCENT 10
+#endif
+
+// Bus time of one poll query until one has been timed
+#ifndef DALI_POLL_QUERY_US
+#define DALI_POLL_QUERY_US 30000
+#endif
+
+// Instances polled per input device
+#ifndef DALI_POLL_INSTANCES
+#define DALI_POLL_INSTANCES DALI_MAP_INSTANCES
+#endif
+
+// Value of an item not polled yet
+#define DALI_HEALTH_UNKNOWN (-100)
+
+enum DALIHealthItem {
+    // QUERY_ERROR answer of a luminaire (QUERY STATUS, 0x90)
+    DALI_HEALTH_GEAR_STATUS,
+    // QUERY_ACTUAL_LEVEL answer of a luminaire
+    DALI_HEALTH_GEAR_LEVEL,
+    // QUERY INSTANCE STATUS answer of an input device instance
+    DALI_HEALTH_INSTANCE_STATUS
+};
+
+// A polled value that changed
+struct DALIHealthEvent {
+    DALIHealthItem item;
+    uint8_t addr;
+    uint8_t instance;
+    // The answers before and now, RECV_NO_RESPONSE or RECV_FRAME_ERROR if
+    // the unit did not answer
+    int16_t before;
+    int16_t value;
+};
+
+/** Polls the units on the bus round robin within a share of the bus time
+ *
+ * Every luminaire gets a QUERY_ERROR and a QUERY_ACTUAL_LEVEL and every
+ * input device instance a QUERY INSTANCE STATUS, one query at a time. The
+ * queries go through a DALICommandQueue at DALI_PRIORITY_BACKGROUND, so a
+ * user command waits for at most the one query on the bus. The time each
+ * query takes on the bus is counted against the budget, and the next one
+ * is only queued once polling is within it again.
+ *
+ * Only changes are reported. The first answer of each item is kept as the
+ * baseline without a report, so the first cycle does not call back for
+ * every item. value() gives the baseline, e.g. to find the faults already
+ * there at boot. A full cycle takes about cycle_ms(), which grows linearly
+ * with the number of units, so a fault is reported within about that time.
+ */
+class DALIHealthPoller {
+public:
+    /** Constructor
+     *
+     *   @param queue   Queue to run the polls on
+     *   @param dali    The driver of the queue
+     */
+    DALIHealthPoller(DALICommandQueue &queue, DALIDriver &dali);
+
+    /** Set the share of the bus time polling may take
+     *
+     *   @param percent     1 to 100
+     */
+    void set_budget(uint8_t percent);
+
+    /** Attach a callback for changed values
+     *
+     *   @param changed     Called on the bus thread with each change
+     */
+    void attach(mbed::Callback<void(const DALIHealthEvent &)> changed);
+
+    /** Queue the next poll if the budget allows it
+     *
+     *   @returns   true if a poll was queued
+     *
+     *   NOTE: Call it every few milliseconds, e.g. from an EventQueue. Only
+     *   one poll is queued at a time.
+     */
+    bool poll();
+
+    /** Forget the recorded answers and start over at the first unit, e.g.
+     * after the bus was commissioned again
+     */
+    void restart();
+
+    /** Expected time to poll every item once
+     *
+     *   @returns   Milliseconds, from the measured query time, the number of
+     * items and the budget
+     */
+    uint32_t cycle_ms();
+
+    /** Number of queries sent
+     */
+    uint32_t polls();
+
+    /** Get the last answer of an item
+     *
+     *   @param item        What was polled
+     *   @param addr        Short address
+     *   @param instance    Instance, for DALI_HEALTH_INSTANCE_STATUS
+     *   @returns           The answer, RECV_NO_RESPONSE or RECV_FRAME_ERROR
+     * if there was none, DALI_HEALTH_UNKNOWN if it was not polled yet
+     */
+    int value(DALIHealthItem item, uint8_t addr, uint8_t instance = 0);
+
+private:
+    // Query the item at the cursor and move it on, runs on the bus thread
+    int query_next();
+
+    // Completion of query_next()
+    void done(DALIHandle handle, int result);
+
+    /** Move the cursor to the item to poll next, from the one it is at
+     *
+     *   @returns   false if there is nothing to poll
+     */
+    bool seek();
+
+    // Number of items of an address
+    int items_of(uint8_t addr);
+
+    // Record an answer, report it if it changed from a known one
+    void record(DALIHealthItem item, uint8_t addr, uint8_t instance,
+                int16_t &last, int value);
+
+    int num_items();
+
+    DALICommandQueue &_queue;
+    DALIDriver &_dali;
+    mbed::Callback<void(const DALIHealthEvent &)> _changed;
+    uint8_t _budget;
+    // Bus time polling is owed, negative when it used more than its share
+    int32_t _credit_us;
+    uint32_t _last_us;
+    // Bus time of the last poll, set before _queued is cleared
+    volatile uint32_t _cost_us;
+    // Moving average of the query time
+    uint32_t _average_us;
+    volatile bool _queued;
+    uint32_t _polls;
+    // Cursor: address and item of the address
+    uint8_t _addr;
+    uint8_t _item;
+    int16_t _status[DALI_MAP_UNITS];
+    int16_t _level[DALI_MAP_UNITS];
+    int16_t _instance_status[DALI_MAP_UNITS][DALI_POLL_INSTANCES];
+};
+
+#endif
@@ -0,0 +1,193 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALIMultiBus.h"
+
+#define JOB_FLAG(bus) (1UL << (bus))
+#define BUS_DONE_FLAG(bus) (1UL << ((bus) + 8))
+
+DALIMultiBus::DALIMultiBus(int baud)
+    : _tx_ticker(1000000 / (2 * baud)), _num_buses(0)
+{
+#if MBED_CONF_RTOS_PRESENT
+    for (int i = 0; i < DALI_MAX_BUSES; i++) {
+        _workers[i].owner = this;
+        _workers[i].index = i;
+        _workers[i].started = false;
+    }
+#endif
+}
+
+DALIMultiBus::~DALIMultiBus()
+{
+#if MBED_CONF_RTOS_PRESENT
+    for (int i = 0; i < DALI_MAX_BUSES; i++) {
+        if (_workers[i].started) {
+            _workers[i].thread.terminate();
+        }
+    }
+#endif
+}
+
+int DALIMultiBus::add_bus(DALIDriver &dali, bool idle_state)
+{
+    if (_num_buses == DALI_MAX_BUSES) {
+        return -1;
+    }
+    int index = _num_buses;
+    if (!_tx_ticker.add(&_tx[index])) {
+        return -1;
+    }
+    _tx[index].attach(&_tx_ticker, &dali.encoder.output_pin(), idle_state);
+    dali.encoder.set_tx_backend(&_tx[index]);
+    _buses[index] = &dali;
+    _num_buses++;
+    return index;
+}
+
+int DALIMultiBus::run_all(mbed::Callback<int(DALIDriver &)> func,
+                          int *results)
+{
+    _job = func;
+#if MBED_CONF_RTOS_PRESENT
+    uint32_t done = 0;
+    for (int i = 1; i < _num_buses; i++) {
+        if (!_workers[i].started) {
+            _workers[i].thread.start(
+                mbed::callback(&_workers[i], &Worker::main));
+            _workers[i].started = true;
+        }
+        done |= BUS_DONE_FLAG(i);
+        _flags.set(JOB_FLAG(i));
+    }
+    if (_num_buses) {
+        _results[0] = func(*_buses[0]);
+    }
+    if (done) {
+        _flags.wait_all(done);
+    }
+#else
+    for (int i = 0; i < _num_buses; i++) {
+        _results[i] = func(*_buses[i]);
+    }
+#endif
+    int sum = 0;
+    for (int i = 0; i < _num_buses; i++) {
+        sum += _results[i];
+        if (results) {
+            results[i] = _results[i];
+        }
+    }
+    return sum;
+}
+
+#if MBED_CONF_RTOS_PRESENT
+void DALIMultiBus::Worker::main()
+{
+    while (true) {
+        owner->_flags.wait_any(JOB_FLAG(index));
+        owner->_results[index] = owner->_job(*owner->_buses[index]);
+        owner->_flags.set(BUS_DONE_FLAG(index));
+    }
+}
+#endif
+
+int DALIMultiBus::init_bus(DALIDriver &dali)
+{
+    return dali.init();
+}
+
+int DALIMultiBus::add_new_units_bus(DALIDriver &dali)
+{
+    return dali.add_new_units();
+}
+
+int DALIMultiBus::init()
+{
+    return run_all(mbed::callback(this, &DALIMultiBus::init_bus));
+}
+
+int DALIMultiBus::add_new_units()
+{
+    return run_all(mbed::callback(this, &DALIMultiBus::add_new_units_bus));
+}
+
+int DALIMultiBus::get_num_lights()
+{
+    int lights = 0;
+    for (int i = 0; i < _num_buses; i++) {
+        lights += _buses[i]->get_num_lights();
+    }
+    return lights;
+}
+
+DALIBusAddress DALIMultiBus::light(int n)
+{
+    DALIBusAddress addr = {DALI_BUS_NONE, 0xFF};
+    for (int i = 0; n >= 0 && i < _num_buses; i++) {
+        int lights = _buses[i]->get_num_lights();
+        if (n < lights) {
+            addr.bus = i;
+            addr.addr = n;
+            break;
+        }
+        n -= lights;
+    }
+    return addr;
+}
+
+void DALIMultiBus::set_level(DALIBusAddress addr, uint8_t level)
+{
+    if (addr.bus < _num_buses) {
+        _buses[addr.bus]->set_level(addr.addr, level);
+    }
+}
+
+uint8_t DALIMultiBus::get_level(DALIBusAddress addr)
+{
+    if (addr.bus >= _num_buses) {
+        return 0xFF;
+    }
+    return _buses[addr.bus]->get_level(addr.addr);
+}
+
+void DALIMultiBus::turn_off(DALIBusAddress addr)
+{
+    if (addr.bus < _num_buses) {
+        _buses[addr.bus]->turn_off(addr.addr);
+    }
+}
+
+void DALIMultiBus::go_to_scene(DALIBusAddress addr, uint8_t scene)
+{
+    if (addr.bus < _num_buses) {
+        _buses[addr.bus]->go_to_scene(addr.addr, scene);
+    }
+}
+
+void DALIMultiBus::set_level_all(uint8_t addr, uint8_t level)
+{
+    for (int i = 0; i < _num_buses; i++) {
+        _buses[i]->set_level(addr, level);
+    }
+}
+
+void DALIMultiBus::go_to_scene_all(uint8_t addr, uint8_t scene)
+{
+    for (int i = 0; i < _num_buses; i++) {
+        _buses[i]->go_to_scene(addr, scene);
+    }
+}
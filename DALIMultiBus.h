@@ -0,0 +1,170 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_MULTI_BUS_H
+#define DALI_MULTI_BUS_H
+
+#include "DALIDriver.h"
+#include "mbed.h"
+
+// Buses one DALIMultiBus can drive, at most 8
+#ifndef DALI_MAX_BUSES
+#define DALI_MAX_BUSES SHARED_TX_MAX_LINES
+#endif
+
+// DALIBusAddress::bus of no unit, e.g. from light() past the last one
+#define DALI_BUS_NONE 0xFF
+
+// A unit on one of the buses
+struct DALIBusAddress {
+    uint8_t bus;
+    // 8 bit address on that bus (device, group or broadcast)
+    uint8_t addr;
+};
+
+/** Several DALI buses driven from one MCU
+ *
+ * The frames of every bus are shifted out by one shared timer interrupt
+ * (SharedTxTicker) instead of one timer per bus. Commissioning and other
+ * work that waits for answers runs on every bus at once: with RTOS each
+ * bus but the first gets a worker thread, which sleeps while its bus is
+ * busy, and the calling thread does the first bus. It then takes as long
+ * as the slowest bus rather than all of them together. Without RTOS the
+ * buses take turns.
+ *
+ * Example:
+ *
+ *     DALIDriver line0(D0, D1), line1(D2, D3);
+ *     DALIMultiBus buses;
+ *     buses.add_bus(line0);
+ *     buses.add_bus(line1);
+ *     buses.init();
+ *     DALIBusAddress lamp = {1, 5};
+ *     buses.set_level(lamp, 254);
+ *
+ * NOTE: Once added, a bus must only be used through this object, or from
+ * one thread while nothing runs on the others.
+ */
+class DALIMultiBus {
+public:
+    /** Constructor
+     *
+     *   @param baud    Bit rate of every bus
+     */
+    DALIMultiBus(int baud = 1200);
+
+    ~DALIMultiBus();
+
+    /** Add a bus
+     *
+     *   @param dali        Driver of the bus
+     *   @param idle_state  The idle state the driver was constructed with
+     *   @returns           Index of the bus, negative if DALI_MAX_BUSES
+     * buses were added already
+     *
+     *   NOTE: Moves the transmitter of the bus to the shared timer
+     */
+    int add_bus(DALIDriver &dali, bool idle_state = 0);
+
+    int num_buses()
+    {
+        return _num_buses;
+    }
+
+    DALIDriver &bus(int index)
+    {
+        return *_buses[index];
+    }
+
+    /** Run a function on every bus at once
+     *
+     *   @param func    Called with the driver of each bus
+     *   @param results Receives what func returned for each bus, or NULL
+     *   @returns       Sum of the results
+     */
+    int run_all(mbed::Callback<int(DALIDriver &)> func, int *results = NULL);
+
+    /** Initialise every bus, see DALIDriver::init()
+     *
+     *   @returns   Number of logical units on all the buses
+     */
+    int init();
+
+    /** Address units added to any bus, see DALIDriver::add_new_units()
+     *
+     *   @returns   Number of units that got a new short address
+     */
+    int add_new_units();
+
+    /** Number of luminaires on all the buses
+     */
+    int get_num_lights();
+
+    /** Address of a luminaire, counting through the buses in order
+     *
+     *   @param n   [0, get_num_lights())
+     *   @returns   The bus and short address, bus DALI_BUS_NONE and address
+     * 0xFF if n is out of range
+     */
+    DALIBusAddress light(int n);
+
+    // DALIDriver calls for a unit on one of the buses, an address on
+    // DALI_BUS_NONE or a bus not added sends nothing (get_level() gives 0xFF)
+    void set_level(DALIBusAddress addr, uint8_t level);
+    uint8_t get_level(DALIBusAddress addr);
+    void turn_off(DALIBusAddress addr);
+    void go_to_scene(DALIBusAddress addr, uint8_t scene);
+
+    /** Set the level of an address on every bus, e.g. broadcast
+     *
+     *   NOTE: A command returns once its frame has started, so the frames
+     *   of the buses go out together without worker threads
+     */
+    void set_level_all(uint8_t addr, uint8_t level);
+
+    /** Recall a scene at an address on every bus
+     */
+    void go_to_scene_all(uint8_t addr, uint8_t scene);
+
+private:
+    int init_bus(DALIDriver &dali);
+    int add_new_units_bus(DALIDriver &dali);
+
+#if MBED_CONF_RTOS_PRESENT
+    struct Worker {
+        DALIMultiBus *owner;
+        int index;
+        bool started;
+        Thread thread;
+
+        void main();
+    };
+
+    Worker _workers[DALI_MAX_BUSES];
+    // Bit n: job for bus n, bit n + 8: bus n done
+    EventFlags _flags;
+#endif
+
+    SharedTxTicker _tx_ticker;
+    SharedTickerTxBackend _tx[DALI_MAX_BUSES];
+    DALIDriver *_buses[DALI_MAX_BUSES];
+    int _num_buses;
+    // The function run_all() runs and what it returned
+    mbed::Callback<int(DALIDriver &)> _job;
+    int _results[DALI_MAX_BUSES];
+};
+
+#endif
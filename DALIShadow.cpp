@@ -0,0 +1,349 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALIShadow.h"
+#include <string.h>
+
+// Scene level that leaves the gear out of the scene
+#define MASK 0xFF
+
+DALIShadow::DALIShadow(uint32_t max_age_ms)
+{
+    set_max_age(max_age_ms);
+    invalidate();
+}
+
+void DALIShadow::set_max_age(uint32_t max_age_ms)
+{
+    _max_age_us = max_age_ms * 1000;
+}
+
+void DALIShadow::invalidate()
+{
+    memset(_gear, 0, sizeof(_gear));
+}
+
+void DALIShadow::invalidate(uint8_t addr)
+{
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        if (selects(i, addr) != NOT_SELECTED) {
+            memset(&_gear[i], 0, sizeof(_gear[i]));
+        }
+    }
+}
+
+const DALIGearState &DALIShadow::state(uint8_t addr)
+{
+    return _gear[addr % DALI_SHADOW_GEAR];
+}
+
+DALIShadow::Selection DALIShadow::selects(int i, uint8_t addr)
+{
+    if (addr < DALI_SHADOW_GEAR) {
+        return i == addr ? SELECTED : NOT_SELECTED;
+    }
+    if (addr == 0xFF) {
+        return SELECTED;
+    }
+    if ((addr & 0xF0) != 0x80) {
+        // Unaddressed broadcast or reserved
+        return MAYBE_SELECTED;
+    }
+    int group = addr & 0x0F;
+    if (!(_gear[i].known & (group < 8 ? SHADOW_GROUPS_L : SHADOW_GROUPS_H))) {
+        return MAYBE_SELECTED;
+    }
+    return (_gear[i].groups >> group) & 1 ? SELECTED : NOT_SELECTED;
+}
+
+void DALIShadow::forget(uint8_t addr, uint8_t fields)
+{
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        if (selects(i, addr) != NOT_SELECTED) {
+            _gear[i].known &= ~fields;
+        }
+    }
+}
+
+bool DALIShadow::level(uint8_t addr, uint8_t &level)
+{
+    if (addr >= DALI_SHADOW_GEAR || !(_gear[addr].known & SHADOW_LEVEL)) {
+        return false;
+    }
+    if (us_ticker_read() - _gear[addr].level_time > _max_age_us) {
+        _gear[addr].known &= ~SHADOW_LEVEL;
+        return false;
+    }
+    level = _gear[addr].actual_level;
+    return true;
+}
+
+bool DALIShadow::fade(uint8_t addr, uint8_t &fade)
+{
+    uint8_t both = SHADOW_FADE_TIME | SHADOW_FADE_RATE;
+    if (addr >= DALI_SHADOW_GEAR || (_gear[addr].known & both) != both) {
+        return false;
+    }
+    fade = _gear[addr].fade;
+    return true;
+}
+
+bool DALIShadow::phm(uint8_t addr, uint8_t &phm)
+{
+    if (addr >= DALI_SHADOW_GEAR || !(_gear[addr].known & SHADOW_PHM)) {
+        return false;
+    }
+    phm = _gear[addr].phm;
+    return true;
+}
+
+bool DALIShadow::in_group(uint8_t addr, uint8_t group, bool &member)
+{
+    uint8_t half = group < 8 ? SHADOW_GROUPS_L : SHADOW_GROUPS_H;
+    if (addr >= DALI_SHADOW_GEAR || group > 15 || !(_gear[addr].known & half)) {
+        return false;
+    }
+    member = (_gear[addr].groups >> group) & 1;
+    return true;
+}
+
+bool DALIShadow::scene_level(uint8_t addr, uint8_t scene, uint8_t &level)
+{
+    if (addr >= DALI_SHADOW_GEAR || scene > 15 ||
+        !((_gear[addr].scenes_known >> scene) & 1)) {
+        return false;
+    }
+    level = _gear[addr].scenes[scene];
+    return true;
+}
+
+bool DALIShadow::colour_tc(uint8_t addr, uint16_t &mirek)
+{
+    if (addr >= DALI_SHADOW_GEAR || !(_gear[addr].known & SHADOW_TC)) {
+        return false;
+    }
+    mirek = _gear[addr].colour_tc;
+    return true;
+}
+
+bool DALIShadow::colour_rgb(uint8_t addr, uint8_t rgb[4])
+{
+    if (addr >= DALI_SHADOW_GEAR || !(_gear[addr].known & SHADOW_RGB)) {
+        return false;
+    }
+    memcpy(rgb, _gear[addr].rgb, 4);
+    return true;
+}
+
+void DALIShadow::set_level(uint8_t addr, uint8_t level)
+{
+    if (level == MASK) {
+        // Direct arc power MASK leaves the level as it is
+        return;
+    }
+    uint32_t now = us_ticker_read();
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            store_level(i, level, now);
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].known &= ~SHADOW_LEVEL;
+        }
+    }
+}
+
+void DALIShadow::store_level(int i, uint8_t level, uint32_t now)
+{
+    DALIGearState &gear = _gear[i];
+    if (level) {
+        if (!gear.max_level) {
+            // What the gear made of it is not known
+            gear.known &= ~SHADOW_LEVEL;
+            return;
+        }
+        if (level < gear.min_level) {
+            level = gear.min_level;
+        }
+        if (level > gear.max_level) {
+            level = gear.max_level;
+        }
+    }
+    gear.actual_level = level;
+    gear.level_time = now;
+    gear.known |= SHADOW_LEVEL;
+}
+
+void DALIShadow::set_actual_level(uint8_t addr, uint8_t level)
+{
+    if (addr >= DALI_SHADOW_GEAR || level == MASK) {
+        return;
+    }
+    _gear[addr].actual_level = level;
+    _gear[addr].level_time = us_ticker_read();
+    _gear[addr].known |= SHADOW_LEVEL;
+}
+
+void DALIShadow::set_limits(uint8_t addr, uint8_t min_level,
+                            uint8_t max_level)
+{
+    if (addr >= DALI_SHADOW_GEAR) {
+        return;
+    }
+    _gear[addr].min_level = min_level;
+    _gear[addr].max_level = max_level;
+    // A level kept with other limits
+    _gear[addr].known &= ~SHADOW_LEVEL;
+}
+
+void DALIShadow::forget_level(uint8_t addr)
+{
+    forget(addr, SHADOW_LEVEL);
+}
+
+void DALIShadow::set_fade_time(uint8_t addr, uint8_t time)
+{
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            _gear[i].fade = (_gear[i].fade & 0x0F) | (time << 4);
+            _gear[i].known |= SHADOW_FADE_TIME;
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].known &= ~SHADOW_FADE_TIME;
+        }
+    }
+}
+
+void DALIShadow::set_fade_rate(uint8_t addr, uint8_t rate)
+{
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            _gear[i].fade = (_gear[i].fade & 0xF0) | (rate & 0x0F);
+            _gear[i].known |= SHADOW_FADE_RATE;
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].known &= ~SHADOW_FADE_RATE;
+        }
+    }
+}
+
+void DALIShadow::set_fade(uint8_t addr, uint8_t fade)
+{
+    set_fade_time(addr, fade >> 4);
+    set_fade_rate(addr, fade & 0x0F);
+}
+
+void DALIShadow::set_phm(uint8_t addr, uint8_t phm)
+{
+    if (addr < DALI_SHADOW_GEAR) {
+        _gear[addr].phm = phm;
+        _gear[addr].known |= SHADOW_PHM;
+    }
+}
+
+void DALIShadow::set_group(uint8_t addr, uint8_t group, bool member)
+{
+    uint8_t half = group < 8 ? SHADOW_GROUPS_L : SHADOW_GROUPS_H;
+    uint16_t mask = 1 << group;
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            // Only meaningful when the rest of that half is known
+            if (_gear[i].known & half) {
+                _gear[i].groups = member ? _gear[i].groups | mask
+                                         : _gear[i].groups & ~mask;
+            }
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].known &= ~half;
+        }
+    }
+}
+
+void DALIShadow::set_groups(uint8_t addr, bool high, uint8_t groups)
+{
+    if (addr >= DALI_SHADOW_GEAR) {
+        return;
+    }
+    if (high) {
+        _gear[addr].groups = (_gear[addr].groups & 0x00FF) | (groups << 8);
+        _gear[addr].known |= SHADOW_GROUPS_H;
+    } else {
+        _gear[addr].groups = (_gear[addr].groups & 0xFF00) | groups;
+        _gear[addr].known |= SHADOW_GROUPS_L;
+    }
+}
+
+void DALIShadow::set_scene_level(uint8_t addr, uint8_t scene, uint8_t level)
+{
+    uint16_t mask = 1 << (scene & 0x0F);
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            _gear[i].scenes[scene & 0x0F] = level;
+            _gear[i].scenes_known |= mask;
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].scenes_known &= ~mask;
+        }
+    }
+}
+
+void DALIShadow::go_to_scene(uint8_t addr, uint8_t scene)
+{
+    uint32_t now = us_ticker_read();
+    uint16_t mask = 1 << (scene & 0x0F);
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == NOT_SELECTED) {
+            continue;
+        }
+        // DT8 gear also recalls the scene colour, which is not kept
+        _gear[i].known &= ~(SHADOW_TC | SHADOW_RGB);
+        if (sel == SELECTED && (_gear[i].scenes_known & mask)) {
+            if (_gear[i].scenes[scene & 0x0F] != MASK) {
+                store_level(i, _gear[i].scenes[scene & 0x0F], now);
+            }
+        } else {
+            _gear[i].known &= ~SHADOW_LEVEL;
+        }
+    }
+}
+
+void DALIShadow::set_colour_tc(uint8_t addr, uint16_t mirek)
+{
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            _gear[i].colour_tc = mirek;
+            _gear[i].known |= SHADOW_TC;
+            _gear[i].known &= ~SHADOW_RGB;
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].known &= ~(SHADOW_TC | SHADOW_RGB);
+        }
+    }
+}
+
+void DALIShadow::set_colour_rgb(uint8_t addr, const uint8_t rgb[4])
+{
+    for (int i = 0; i < DALI_SHADOW_GEAR; i++) {
+        Selection sel = selects(i, addr);
+        if (sel == SELECTED) {
+            memcpy(_gear[i].rgb, rgb, 4);
+            _gear[i].known |= SHADOW_RGB;
+            _gear[i].known &= ~SHADOW_TC;
+        } else if (sel == MAYBE_SELECTED) {
+            _gear[i].known &= ~(SHADOW_TC | SHADOW_RGB);
+        }
+    }
+}
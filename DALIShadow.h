@@ -0,0 +1,170 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_SHADOW_H
+#define DALI_SHADOW_H
+
+#include "mbed.h"
+
+// Short addresses of control gear kept
+#define DALI_SHADOW_GEAR 64
+
+// How long an actual level is trusted by default
+#ifndef DALI_SHADOW_MAX_AGE_MS
+#define DALI_SHADOW_MAX_AGE_MS 10000
+#endif
+
+// Fields of a DALIGearState that hold
+#define SHADOW_LEVEL (1 << 0)
+#define SHADOW_FADE_TIME (1 << 1)
+#define SHADOW_FADE_RATE (1 << 2)
+#define SHADOW_PHM (1 << 3)
+#define SHADOW_GROUPS_L (1 << 4)
+#define SHADOW_GROUPS_H (1 << 5)
+#define SHADOW_TC (1 << 6)
+#define SHADOW_RGB (1 << 7)
+
+// Last known state of one control gear
+struct DALIGearState {
+    // SHADOW_* fields that hold
+    uint8_t known;
+    uint8_t actual_level;
+    // Fade time in the high nibble, fade rate in the low one (QUERY FADE)
+    uint8_t fade;
+    uint8_t phm;
+    uint16_t groups;
+    // Scenes whose level is known
+    uint16_t scenes_known;
+    uint8_t scenes[16];
+    // Active colour temperature in mirek
+    uint16_t colour_tc;
+    // Active red, green, blue and WAF dim level
+    uint8_t rgb[4];
+    // MIN and MAX LEVEL set levels are limited to, max_level 0 if not known
+    uint8_t min_level;
+    uint8_t max_level;
+    // us_ticker_read() when the actual level was last set or read
+    uint32_t level_time;
+};
+
+/** Write-through copy of the state of the control gear on a bus
+ *
+ * DALIDriver updates it as it sends commands and reads replies, serves its
+ * getters from it and leaves out commands that would not change anything.
+ * Commands to a group or broadcast update every gear known to be in it, and
+ * forget the field in gear whose groups are not known.
+ *
+ * The actual level can also change outside the driver (other controllers,
+ * input devices, power cycles), so it is only trusted for a limited time.
+ * Fade times, groups, scenes and colours only change through configuration
+ * commands and are kept until invalidate().
+ *
+ * Levels are kept limited to the MIN and MAX LEVEL of the gear, and levels
+ * set on gear whose limits are not known are not kept. Other values are
+ * kept as they were sent, and fades in progress are not modelled.
+ */
+class DALIShadow {
+public:
+    /** Constructor
+     *
+     *   @param max_age_ms  How long a level read or set is served without
+     * querying the gear again, at most an hour
+     */
+    DALIShadow(uint32_t max_age_ms = DALI_SHADOW_MAX_AGE_MS);
+
+    /** Set how long a level read or set is served without querying the gear
+     */
+    void set_max_age(uint32_t max_age_ms);
+
+    /** Forget everything, e.g. after the bus was readdressed, including the
+     * level limits
+     */
+    void invalidate();
+
+    /** Forget the state of the gear at a short, group or broadcast address,
+     * including the level limits
+     */
+    void invalidate(uint8_t addr);
+
+    /** Read the state of a control gear
+     *
+     *   @param addr    Short address
+     *   @returns       The state, check known before using a field
+     */
+    const DALIGearState &state(uint8_t addr);
+
+    // Getters return false if the field is not known (or the level is too
+    // old), and only take short addresses
+    bool level(uint8_t addr, uint8_t &level);
+    bool fade(uint8_t addr, uint8_t &fade);
+    bool phm(uint8_t addr, uint8_t &phm);
+    bool in_group(uint8_t addr, uint8_t group, bool &member);
+    bool scene_level(uint8_t addr, uint8_t scene, uint8_t &level);
+    bool colour_tc(uint8_t addr, uint16_t &mirek);
+    bool colour_rgb(uint8_t addr, uint8_t rgb[4]);
+
+    // Setters take short, group and broadcast addresses
+    void set_level(uint8_t addr, uint8_t level);
+    void forget_level(uint8_t addr);
+    void set_fade_time(uint8_t addr, uint8_t time);
+    void set_fade_rate(uint8_t addr, uint8_t rate);
+    void set_phm(uint8_t addr, uint8_t phm);
+    void set_group(uint8_t addr, uint8_t group, bool member);
+    void set_scene_level(uint8_t addr, uint8_t scene, uint8_t level);
+    void go_to_scene(uint8_t addr, uint8_t scene);
+    void set_colour_tc(uint8_t addr, uint16_t mirek);
+    void set_colour_rgb(uint8_t addr, const uint8_t rgb[4]);
+
+    /** Set the limits of the gear at a short address
+     *
+     *   @param min_level   MIN LEVEL
+     *   @param max_level   MAX LEVEL, 0 if not known
+     */
+    void set_limits(uint8_t addr, uint8_t min_level, uint8_t max_level);
+
+    /** Record a QUERY ACTUAL LEVEL answer, kept whether the limits are
+     * known or not
+     */
+    void set_actual_level(uint8_t addr, uint8_t level);
+
+    /** Record a QUERY FADE answer
+     */
+    void set_fade(uint8_t addr, uint8_t fade);
+
+    /** Record a QUERY GROUPS (L or H) answer
+     *
+     *   @param high    true for groups 8-15
+     */
+    void set_groups(uint8_t addr, bool high, uint8_t groups);
+
+private:
+    enum Selection { NOT_SELECTED, SELECTED, MAYBE_SELECTED };
+
+    // Whether a command to addr reaches the gear at short address i
+    Selection selects(int i, uint8_t addr);
+
+    // Set the actual level of the gear at short address i, as the gear
+    // limits it
+    void store_level(int i, uint8_t level, uint32_t now);
+
+    // Forget fields of the gear addr may reach
+    void forget(uint8_t addr, uint8_t fields);
+
+    DALIGearState _gear[DALI_SHADOW_GEAR];
+    uint32_t _max_age_us;
+};
+
+#endif
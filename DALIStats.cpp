@@ -0,0 +1,64 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALIStats.h"
+
+int dali_latency_bucket(uint32_t us)
+{
+    if (us < 4) {
+        return us;
+    }
+    int msb = 31;
+    while (!(us >> msb)) {
+        msb--;
+    }
+    // Power of two and the two bits below the top one
+    int bucket = (msb - 1) * 4 + ((us >> (msb - 2)) & 3);
+    return bucket < DALI_LATENCY_BUCKETS ? bucket : DALI_LATENCY_BUCKETS - 1;
+}
+
+uint32_t dali_latency_bucket_max(int bucket)
+{
+    if (bucket < 4) {
+        return bucket;
+    }
+    int msb = bucket / 4 + 1;
+    return ((uint32_t)(4 + bucket % 4 + 1) << (msb - 2)) - 1;
+}
+
+uint32_t dali_latency_percentile(const DALIStats &stats, int percent)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < DALI_LATENCY_BUCKETS; i++) {
+        total += stats.latency[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // Rank of the sample the percentile falls on, starting from 1
+    uint32_t rank = ((uint64_t)total * percent + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint32_t count = 0;
+    for (int i = 0; i < DALI_LATENCY_BUCKETS; i++) {
+        count += stats.latency[i];
+        if (count >= rank) {
+            return dali_latency_bucket_max(i);
+        }
+    }
+    return dali_latency_bucket_max(DALI_LATENCY_BUCKETS - 1);
+}
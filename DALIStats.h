@@ -0,0 +1,89 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_STATS_H
+#define DALI_STATS_H
+
+#include <stdint.h>
+
+// Classes forward frames are counted in
+enum DALIFrameClass {
+    // iec62386-102 special commands (DTR, INITIALISE, search, ...)
+    DALI_CLASS_SPECIAL,
+    // iec62386-102 commands and queries to a short, group or broadcast address
+    DALI_CLASS_STANDARD,
+    // Direct arc power
+    DALI_CLASS_DIRECT,
+    // iec62386-103 frames, special and standard
+    DALI_CLASS_INPUT,
+    // Both frames of a send-twice pair, whatever the command
+    DALI_CLASS_SEND_TWICE,
+    DALI_NUM_FRAME_CLASSES
+};
+
+// Query latency histogram buckets, see dali_latency_bucket()
+#define DALI_LATENCY_BUCKETS 64
+
+struct DALIClassStats {
+    // Forward frames sent
+    uint32_t frames;
+    // Backward frames received
+    uint32_t replies;
+    // Queries no backward frame came back for
+    uint32_t timeouts;
+    // Backward frames that could not be decoded (e.g. several answers)
+    uint32_t errors;
+    // Time the frames were on the wire, forward and backward
+    uint64_t wire_us;
+    // Time the caller was blocked sending and receiving, which includes the
+    // settling time, the frames themselves and waiting for the reply
+    uint64_t wait_us;
+};
+
+/** Bus statistics kept by DALIDriver when built with dali.stats enabled
+ */
+struct DALIStats {
+    DALIClassStats classes[DALI_NUM_FRAME_CLASSES];
+    // Time from the start of a query on the wire to its reply or timeout, in
+    // microseconds.
+    // Four buckets per power of two, see dali_latency_bucket()
+    uint32_t latency[DALI_LATENCY_BUCKETS];
+};
+
+/** Histogram bucket of a latency
+ *
+ *   @param us      Latency in microseconds
+ *   @returns       Bucket, latencies of 131 ms or more share the last one
+ */
+int dali_latency_bucket(uint32_t us);
+
+/** Highest latency counted in a histogram bucket
+ *
+ *   @param bucket  Bucket
+ *   @returns       Latency in microseconds
+ */
+uint32_t dali_latency_bucket_max(int bucket);
+
+/** Estimate a query latency percentile from the histogram
+ *
+ *   @param stats   Statistics to read
+ *   @param percent Percentile, [0, 100]
+ *   @returns       Upper bound of the bucket the percentile falls in, 0 if
+ * no query was timed
+ */
+uint32_t dali_latency_percentile(const DALIStats &stats, int percent);
+
+#endif
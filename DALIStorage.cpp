@@ -0,0 +1,93 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALIStorage.h"
+#include <stdio.h>
+#if MBED_CONF_DALI_KVSTORE_BACKEND
+#include "kvstore_global_api.h"
+#endif
+
+// Longest partition/directory plus key name
+#define STORAGE_PATH_MAX 64
+
+#if MBED_CONF_DALI_KVSTORE_BACKEND
+DALIKVStoreStorage::DALIKVStoreStorage(const char *partition)
+    : _partition(partition)
+{
+}
+
+int DALIKVStoreStorage::get(const char *key, void *buffer, size_t size,
+                            size_t *actual)
+{
+    char path[STORAGE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", _partition, key);
+    return kv_get(path, buffer, size, actual);
+}
+
+int DALIKVStoreStorage::set(const char *key, const void *buffer, size_t size)
+{
+    char path[STORAGE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", _partition, key);
+    return kv_set(path, buffer, size, 0);
+}
+
+int DALIKVStoreStorage::remove(const char *key)
+{
+    char path[STORAGE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", _partition, key);
+    return kv_remove(path);
+}
+#endif
+
+DALIFileStorage::DALIFileStorage(const char *dir) : _dir(dir)
+{
+}
+
+int DALIFileStorage::get(const char *key, void *buffer, size_t size,
+                         size_t *actual)
+{
+    char path[STORAGE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", _dir, key);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return -1;
+    }
+    *actual = fread(buffer, 1, size, f);
+    fclose(f);
+    return 0;
+}
+
+int DALIFileStorage::set(const char *key, const void *buffer, size_t size)
+{
+    char path[STORAGE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", _dir, key);
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        return -1;
+    }
+    size_t written = fwrite(buffer, 1, size, f);
+    if (fclose(f) != 0 || written != size) {
+        return -1;
+    }
+    return 0;
+}
+
+int DALIFileStorage::remove(const char *key)
+{
+    char path[STORAGE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", _dir, key);
+    return ::remove(path) == 0 ? 0 : -1;
+}
@@ -0,0 +1,154 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_STORAGE_H
+#define DALI_STORAGE_H
+
+#include "mbed.h"
+
+// Units (luminaires and input devices) kept in a bus map
+#define DALI_MAP_UNITS 64
+// Instance types kept per input device
+#define DALI_MAP_INSTANCES 4
+#define DALI_MAP_MAGIC 0x44414C49
+#define DALI_MAP_VERSION 3
+// Instance type that was not recorded
+#define UNKNOWN_INSTANCE_TYPE 0xFF
+
+// DALIUnitRecord::capabilities
+// The capabilities of the luminaire were read
+#define DALI_CAP_KNOWN (1 << 0)
+// iec62386-209 (DT8) colour control gear
+#define DALI_CAP_COLOUR (1 << 1)
+
+// What the driver knows about one short address
+struct DALIUnitRecord {
+    // Random address the unit had when it was addressed
+    uint32_t random_addr;
+    // Device type of a luminaire, from QUERY DEVICE TYPE
+    uint8_t device_type;
+    // Number of instances of an input device
+    uint8_t num_instances;
+    // Types of the first instances of an input device
+    uint8_t instance_types[DALI_MAP_INSTANCES];
+    // DALI_CAP_* flags of a luminaire
+    uint8_t capabilities;
+    // QUERY COLOUR TYPE FEATURES answer of DT8 gear
+    uint8_t colour_features;
+    // Colour temperature limits of DT8 gear in mirek, 0 if not known
+    uint16_t tc_coolest;
+    uint16_t tc_warmest;
+    // MIN and MAX LEVEL of a luminaire, max_level 0 if not known
+    uint8_t min_level;
+    uint8_t max_level;
+};
+
+/** Result of commissioning a bus
+ *
+ * Luminaires are at [0, num_lights) and input devices at
+ * [num_lights, num_lights + num_inputs), as assigned by DALIDriver::init().
+ */
+struct DALIBusMap {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t num_lights;
+    uint8_t num_inputs;
+    DALIUnitRecord units[DALI_MAP_UNITS];
+    // Sum of all the bytes above
+    uint32_t checksum;
+};
+
+/** Key-value store the driver persists its state in
+ */
+class DALIStorage {
+public:
+    virtual ~DALIStorage()
+    {
+    }
+
+    /** Read a value
+     *
+     *   @param key         Name of the value
+     *   @param buffer      Buffer to read into
+     *   @param size        Size of the buffer
+     *   @param actual      Receives the number of bytes read
+     *   @returns           0 on success, negative error code otherwise
+     */
+    virtual int get(const char *key, void *buffer, size_t size,
+                    size_t *actual) = 0;
+
+    /** Write a value, replacing any previous one
+     *
+     *   @param key         Name of the value
+     *   @param buffer      Data to write
+     *   @param size        Number of bytes to write
+     *   @returns           0 on success, negative error code otherwise
+     */
+    virtual int set(const char *key, const void *buffer, size_t size) = 0;
+
+    /** Delete a value
+     *
+     *   @param key         Name of the value
+     *   @returns           0 on success, negative error code otherwise
+     */
+    virtual int remove(const char *key) = 0;
+};
+
+#if MBED_CONF_DALI_KVSTORE_BACKEND
+/** Storage on the Mbed OS global KVStore API
+ */
+class DALIKVStoreStorage : public DALIStorage {
+public:
+    /** Constructor
+     *
+     *   @param partition   KVStore partition keys are stored in
+     */
+    DALIKVStoreStorage(const char *partition = "/kv/");
+
+    virtual int get(const char *key, void *buffer, size_t size,
+                    size_t *actual);
+
+    virtual int set(const char *key, const void *buffer, size_t size);
+
+    virtual int remove(const char *key);
+
+private:
+    const char *_partition;
+};
+#endif
+
+/** Storage as one file per key, for a mounted file system or a host build
+ */
+class DALIFileStorage : public DALIStorage {
+public:
+    /** Constructor
+     *
+     *   @param dir     Directory the files are kept in
+     */
+    DALIFileStorage(const char *dir);
+
+    virtual int get(const char *key, void *buffer, size_t size,
+                    size_t *actual);
+
+    virtual int set(const char *key, const void *buffer, size_t size);
+
+    virtual int remove(const char *key);
+
+private:
+    const char *_dir;
+};
+
+#endif
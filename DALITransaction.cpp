@@ -0,0 +1,165 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DALITransaction.h"
+
+// Step flags
+// Goes to the address given to run()
+#define STEP_ADDRESSED (1 << 0)
+// Send-twice command
+#define STEP_TWICE (1 << 1)
+// Query, wait for the answer
+#define STEP_QUERY (1 << 2)
+// The data byte is the answer to the last query
+#define STEP_ANSWER (1 << 3)
+// The data byte is the low or high byte of the colour temperature in mirek,
+// limited to the range of the luminaire
+#define STEP_MIREK_LOW (1 << 4)
+#define STEP_MIREK_HIGH (1 << 5)
+
+DALITransaction::DALITransaction() : _size(0), _colour(false)
+{
+}
+
+void DALITransaction::clear()
+{
+    _size = 0;
+    _colour = false;
+}
+
+int DALITransaction::size()
+{
+    return _size;
+}
+
+bool DALITransaction::add(uint16_t frame, uint8_t flags, uint16_t kelvin)
+{
+    if (_size == DALI_TRANSACTION_STEPS) {
+        return false;
+    }
+    _steps[_size].frame = frame;
+    _steps[_size].flags = flags;
+    _steps[_size].kelvin = kelvin;
+    _size++;
+    return true;
+}
+
+bool DALITransaction::command(uint8_t opcode)
+{
+    // 1 in LSb of the address byte signifies 'standard command'
+    return add(0x0100 | opcode, STEP_ADDRESSED);
+}
+
+bool DALITransaction::command_twice(uint8_t opcode)
+{
+    return add(0x0100 | opcode, STEP_ADDRESSED | STEP_TWICE);
+}
+
+bool DALITransaction::direct(uint8_t level)
+{
+    return add(level, STEP_ADDRESSED);
+}
+
+bool DALITransaction::query(uint8_t opcode)
+{
+    return add(0x0100 | opcode, STEP_ADDRESSED | STEP_QUERY);
+}
+
+bool DALITransaction::special(uint8_t address, uint8_t data)
+{
+    return add(((uint16_t)address << 8) | data, 0);
+}
+
+bool DALITransaction::special_answer(uint8_t address)
+{
+    return add((uint16_t)address << 8, STEP_ANSWER);
+}
+
+bool DALITransaction::color_scene(uint8_t scene, uint16_t temp)
+{
+    if (_size + 7 > DALI_TRANSACTION_STEPS || temp == 0) {
+        return false;
+    }
+    _colour = true;
+    add((uint16_t)DTR0 << 8, STEP_MIREK_LOW, temp);
+    add((uint16_t)DTR1 << 8, STEP_MIREK_HIGH, temp);
+    special(ENABLE_DEVICE_TYPE, 0x08);
+    command(SET_TEMP_TEMPC);
+    // Keep the scene level
+    query(QUERY_SCENE_LEVEL + scene);
+    special_answer(DTR0);
+    command_twice(STORE_DTR_AS_SCENE + scene);
+    return true;
+}
+
+int DALITransaction::run(DALIDriver &dali, uint8_t addr)
+{
+    // Same address byte as DALIDriver::send_command_standard(), less the
+    // LSb kept in the step
+    uint8_t address = (addr & 0x80) | (uint8_t)(addr << 1);
+    // Same check as DALIDriver::set_color_scene(), from the capability
+    // table read during commissioning
+    if (_colour && !dali.colour_capable(addr)) {
+        return DALI_NOT_COLOUR;
+    }
+    int answer = 0;
+    for (int i = 0; i < _size; i++) {
+        const Step &step = _steps[i];
+        uint16_t frame = step.frame;
+        if (step.flags & STEP_ADDRESSED) {
+            frame |= (uint16_t)address << 8;
+        }
+        if (step.flags & STEP_ANSWER) {
+            frame |= answer;
+        }
+        if (step.flags & (STEP_MIREK_LOW | STEP_MIREK_HIGH)) {
+            uint16_t mirek = dali.colour_mirek(addr, step.kelvin);
+            frame |= step.flags & STEP_MIREK_LOW ? mirek & 0x00FF : mirek >> 8;
+        }
+        if (step.flags & STEP_TWICE) {
+            dali.send_frame(frame, 16, BusScheduler::SEND_TWICE);
+        }
+        dali.send_frame(frame, 16);
+        if (step.flags & STEP_QUERY) {
+            answer = (int)dali.recv();
+            if (answer < 0) {
+                return answer;
+            }
+            // Overlapping answers can decode as a longer frame, which would
+            // spill into the address byte of the frame that uses it
+            if (answer > 0xFF) {
+                return RECV_FRAME_ERROR;
+            }
+        }
+    }
+    return answer;
+}
+
+int DALITransaction::run(DALIDriver &dali, const uint8_t *addrs, int count,
+                         int *answers)
+{
+    int done = 0;
+    for (int i = 0; i < count; i++) {
+        int answer = run(dali, addrs[i]);
+        if (answers) {
+            answers[i] = answer;
+        }
+        if (answer >= 0) {
+            done++;
+        }
+    }
+    return done;
+}
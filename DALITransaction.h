@@ -0,0 +1,162 @@
+/* DALI Driver
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DALI_TRANSACTION_H
+#define DALI_TRANSACTION_H
+
+#include "DALIDriver.h"
+#include "mbed.h"
+
+// Steps one transaction can hold, a send-twice command takes one
+#ifndef DALI_TRANSACTION_STEPS
+#define DALI_TRANSACTION_STEPS 16
+#endif
+
+// Result of run() for an address without colour control gear, when the
+// sequence has colour steps
+#define DALI_NOT_COLOUR (-14)
+
+/** Sequence of control gear frames built once and sent to many addresses
+ *
+ * The frames are encoded when the sequence is built. Sending it to an
+ * address only puts the address into the frames sent to the luminaire
+ * (and the answer to the last query into the frames that use it), then
+ * sends them back to back: both frames of a send-twice command go out
+ * with only the settling time between them, well inside the 100 ms the
+ * gear allows, and the bus only waits for an answer after a query.
+ *
+ * Example, the same as DALIDriver::set_color_scene(addr, 3, 4000):
+ *
+ *     DALITransaction t;
+ *     t.color_scene(3, 4000);
+ *     t.run(dali, addrs, count);
+ *
+ * NOTE: The frames go through DALIDriver::send_frame(), so the DTRs are
+ * tracked as usual, but the DALIShadow is not told what they changed.
+ * Invalidate the addresses if it may hold what the sequence changes.
+ */
+class DALITransaction {
+public:
+    DALITransaction();
+
+    /** Remove all steps
+     */
+    void clear();
+
+    /** Number of steps
+     */
+    int size();
+
+    /** Add a standard command to the address
+     *
+     *   @param opcode  The opcode byte, e.g. from CommandOpCodes
+     *   @returns       false if the transaction is full
+     */
+    bool command(uint8_t opcode);
+
+    /** Add a standard command to the address that must be sent twice
+     *
+     *   @param opcode  The opcode byte
+     *   @returns       false if the transaction is full
+     */
+    bool command_twice(uint8_t opcode);
+
+    /** Add a direct arc power command to the address
+     *
+     *   @param level   The light level
+     *   @returns       false if the transaction is full
+     */
+    bool direct(uint8_t level);
+
+    /** Add a query to the address
+     *
+     *   @param opcode  The opcode byte, e.g. from CommandOpCodes
+     *   @returns       false if the transaction is full
+     *
+     *   NOTE: When the address does not answer, the rest of the sequence
+     *   is not sent to it
+     */
+    bool query(uint8_t opcode);
+
+    /** Add a special command
+     *
+     *   @param address The special command from SpecialCommandOpAddr
+     *   @param data    The data for the command
+     *   @returns       false if the transaction is full
+     */
+    bool special(uint8_t address, uint8_t data);
+
+    /** Add a special command with the answer to the last query as data
+     *
+     *   @param address The special command from SpecialCommandOpAddr, e.g.
+     * DTR0 to load the answer into DTR0
+     *   @returns       false if the transaction is full
+     */
+    bool special_answer(uint8_t address);
+
+    /** Add the steps of DALIDriver::set_color_scene(addr, scene, temp)
+     *
+     *   @param scene   scene number [0, 15]
+     *   @param temp    Colour temperature in Kelvin
+     *   @returns       false if the transaction is full, or temp is 0
+     *
+     *   NOTE: As with set_color_scene(), run() skips addresses that are not
+     *   colour control gear and limits the temperature to the range each
+     *   luminaire reported during commissioning
+     */
+    bool color_scene(uint8_t scene, uint16_t temp);
+
+    /** Send the sequence to an address
+     *
+     *   @param dali    Driver to send it with
+     *   @param addr    8 bit address (device, group or broadcast)
+     *   @returns       The answer to the last query, 0 without queries,
+     * RECV_NO_RESPONSE or RECV_FRAME_ERROR if a query was not answered, or
+     * not with a single byte, DALI_NOT_COLOUR if nothing was sent because
+     * the sequence has colour steps and the address has no colour gear
+     */
+    int run(DALIDriver &dali, uint8_t addr);
+
+    /** Send the sequence to several addresses, one after the other
+     *
+     *   @param dali    Driver to send it with
+     *   @param addrs   The addresses
+     *   @param count   Number of addresses
+     *   @param answers Receives what run() returned for each address, or
+     * NULL
+     *   @returns       Number of addresses the whole sequence was sent to
+     */
+    int run(DALIDriver &dali, const uint8_t *addrs, int count,
+            int *answers = NULL);
+
+private:
+    struct Step {
+        // Encoded frame, without the parts filled in by run()
+        uint16_t frame;
+        uint8_t flags;
+        // Colour temperature of a mirek step
+        uint16_t kelvin;
+    };
+
+    bool add(uint16_t frame, uint8_t flags, uint16_t kelvin = 0);
+
+    Step _steps[DALI_TRANSACTION_STEPS];
+    int _size;
+    // Holds DT8 steps, only for colour control gear
+    bool _colour;
+};
+
+#endif
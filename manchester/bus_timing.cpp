@@ -0,0 +1,70 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bus_timing.h"
+
+// Minimum settling time for forward frames of each priority
+static const uint32_t priority_settle_us[BUS_PRIORITY_MAX] = {
+    13500, 14900, 16300, 17900, 19500};
+
+BusScheduler::BusScheduler()
+    : _last_end(0), _last_kind(BACKWARD), _priority(BUS_PRIORITY_DEFAULT)
+{
+}
+
+void BusScheduler::set_priority(int priority)
+{
+    if (priority < BUS_PRIORITY_MIN) {
+        priority = BUS_PRIORITY_MIN;
+    } else if (priority > BUS_PRIORITY_MAX) {
+        priority = BUS_PRIORITY_MAX;
+    }
+    _priority = priority;
+}
+
+int BusScheduler::get_priority()
+{
+    return _priority;
+}
+
+uint32_t BusScheduler::settling_time(FrameKind kind)
+{
+    switch (kind) {
+        case BACKWARD:
+            return BACKWARD_TO_FORWARD_US;
+        case SEND_TWICE:
+            // Second frame must win against any other master
+            return priority_settle_us[0];
+        default:
+            return priority_settle_us[_priority - 1];
+    }
+}
+
+uint32_t BusScheduler::time_to_free(uint32_t now)
+{
+    uint32_t settle = settling_time(_last_kind);
+    uint32_t elapsed = now - _last_end;
+    if (elapsed >= settle) {
+        return 0;
+    }
+    return settle - elapsed;
+}
+
+void BusScheduler::frame_end(FrameKind kind, uint32_t end_us)
+{
+    _last_kind = kind;
+    _last_end = end_us;
+}
@@ -0,0 +1,97 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MAN_BUS_TIMING_H
+#define MAN_BUS_TIMING_H
+
+#include <stdint.h>
+
+// Settling times from iec62386-101 section 8, in microseconds
+// A backward frame starts this long after the forward frame it answers
+#define BACKWARD_SETTLE_MIN_US 5500
+#define BACKWARD_SETTLE_MAX_US 10500
+// Minimum gap between a backward frame and the next forward frame
+#define BACKWARD_TO_FORWARD_US 2400
+
+// Lowest and highest transmitter priority
+#define BUS_PRIORITY_MIN 1
+#define BUS_PRIORITY_MAX 5
+// Priority of user actions from an application controller, 1 is left for
+// the second frame of send-twice pairs and transactions
+#define BUS_PRIORITY_DEFAULT 2
+
+/** Tracks when the bus is next free for a forward frame
+ *
+ * Every frame seen on the bus is reported with the time its last half bit
+ * ended. The settling time before the next forward frame depends on what that
+ * frame was: a backward frame only needs BACKWARD_TO_FORWARD_US, the second
+ * half of a send-twice pair goes out with priority 1 timing to stay inside the
+ * 100 ms window, and everything else waits for the configured priority.
+ */
+class BusScheduler {
+public:
+    enum FrameKind {
+        // Forward frame from us or another bus master
+        FORWARD,
+        // First frame of a send-twice pair
+        SEND_TWICE,
+        // Backward frame from a device
+        BACKWARD
+    };
+
+    BusScheduler();
+
+    /** Set the priority used for forward frames
+     *
+     *   @param priority    [1, 5], 1 being the highest, BUS_PRIORITY_DEFAULT
+     * by default
+     *
+     *   NOTE: iec62386-101 keeps priority 1 for frames that continue a
+     *   send-twice pair or a transaction, which get it anyway. 2 is for user
+     *   actions, 3 for configuration, 4 for automatic actions and 5 for
+     *   periodic queries.
+     */
+    void set_priority(int priority);
+
+    int get_priority();
+
+    /** Get the time until a forward frame may start
+     *
+     *   @param now     Current time in microseconds
+     *   @returns       Microseconds to wait, 0 if the bus is free
+     */
+    uint32_t time_to_free(uint32_t now);
+
+    /** Record the end of a frame on the bus
+     *
+     *   @param kind    What the frame was
+     *   @param end_us  Time the frame ended in microseconds
+     */
+    void frame_end(FrameKind kind, uint32_t end_us);
+
+    /** Get the settling time that follows a frame
+     *
+     *   @param kind    The frame on the bus
+     *   @returns       Minimum idle time in microseconds
+     */
+    uint32_t settling_time(FrameKind kind);
+
+private:
+    volatile uint32_t _last_end;
+    volatile FrameKind _last_kind;
+    int _priority;
+};
+
+#endif
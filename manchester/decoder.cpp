@@ -0,0 +1,86 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "decoder.h"
+
+// Number of half bits an interval spans, 0 if it fits neither window
+static int half_bits_in(uint32_t interval, int half_bit_us, int tolerance_us)
+{
+    int d = (int)interval;
+    if (d >= half_bit_us - tolerance_us && d <= half_bit_us + tolerance_us) {
+        return 1;
+    }
+    if (d >= 2 * (half_bit_us - tolerance_us) &&
+        d <= 2 * (half_bit_us + tolerance_us)) {
+        return 2;
+    }
+    return 0;
+}
+
+ManchesterDecodeStatus manchester_decode(const ManchesterEdge *edges,
+                                         int num_edges, int half_bit_us,
+                                         int tolerance_us, uint32_t *data,
+                                         uint8_t *num_bits)
+{
+    // Level of every half bit in the frame, start bit included
+    uint8_t halves[2 + 2 * MANCHESTER_MAX_BITS + 1];
+    int num_halves = 0;
+
+    if (num_edges < 2 || edges[0].level != 1) {
+        return MANCHESTER_NO_FRAME;
+    }
+    // The line must be back at idle after the last edge
+    if (edges[num_edges - 1].level != 0) {
+        return MANCHESTER_TIMING_ERROR;
+    }
+    for (int i = 0; i < num_edges; i++) {
+        int count = 1;
+        if (i + 1 < num_edges) {
+            if (edges[i + 1].level == edges[i].level) {
+                // Missed an edge in between
+                return MANCHESTER_TIMING_ERROR;
+            }
+            count = half_bits_in(edges[i + 1].time_us - edges[i].time_us,
+                                 half_bit_us, tolerance_us);
+            if (count == 0) {
+                return MANCHESTER_TIMING_ERROR;
+            }
+        }
+        // After the last edge the line idles, which completes the last bit
+        // if its second half is low
+        for (int j = 0; j < count; j++) {
+            if (num_halves == (int)sizeof(halves)) {
+                return MANCHESTER_CODE_VIOLATION;
+            }
+            halves[num_halves++] = edges[i].level;
+        }
+    }
+    // Drop the idle half bit if the last bit was already complete
+    num_halves &= ~1;
+    if (num_halves < 4 || halves[1] != 0) {
+        return MANCHESTER_CODE_VIOLATION;
+    }
+    uint32_t value = 0;
+    for (int i = 2; i < num_halves; i += 2) {
+        if (halves[i] == halves[i + 1]) {
+            return MANCHESTER_CODE_VIOLATION;
+        }
+        value = (value << 1) | halves[i];
+    }
+    *data = value;
+    *num_bits = (num_halves - 2) / 2;
+    return MANCHESTER_OK;
+}
@@ -0,0 +1,68 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MAN_DECODER_H
+#define MAN_DECODER_H
+
+#include <stdint.h>
+
+// Longest frame the decoder will rebuild
+#define MANCHESTER_MAX_BITS 32
+
+// Edges in the longest frame: start bit, two per data bit and the stop edge
+#define MANCHESTER_MAX_EDGES (2 + 2 * MANCHESTER_MAX_BITS + 1)
+
+// One captured line transition
+struct ManchesterEdge {
+    // Capture time in microseconds (free running, wraps)
+    uint32_t time_us;
+    // Line level after the edge
+    uint8_t level;
+};
+
+enum ManchesterDecodeStatus {
+    MANCHESTER_OK = 0,
+    // No start bit in the edges
+    MANCHESTER_NO_FRAME,
+    // An interval did not fit a half or full bit time
+    MANCHESTER_TIMING_ERROR,
+    // A bit without a mid-bit transition, or a frame that is too long
+    MANCHESTER_CODE_VIOLATION
+};
+
+/** Rebuild a frame from captured edge timestamps
+ *
+ * The first edge must be the rising edge of the start bit. A bit is decoded
+ * as the level of its first half, which is how ManchesterEncoder transmits.
+ * Intervals are accepted within tolerance_us of one half bit and within
+ * 2 * tolerance_us of a full bit, so tolerance_us = half_bit_us / 5 gives the
+ * 333-500 us and 667-1000 us windows of iec62386-101 at 1200 baud.
+ *
+ * This has no dependency on mbed and can be run on captured data off-target.
+ *
+ *   @param edges           Edges of one frame, in capture order
+ *   @param num_edges       Number of edges
+ *   @param half_bit_us     Nominal half bit time
+ *   @param tolerance_us    Allowed deviation of a half bit interval
+ *   @param data            Receives the frame data, right aligned
+ *   @param num_bits        Receives the number of data bits
+ *   @returns               MANCHESTER_OK or the reason the frame was rejected
+ */
+ManchesterDecodeStatus manchester_decode(const ManchesterEdge *edges,
+                                         int num_edges, int half_bit_us,
+                                         int tolerance_us, uint32_t *data,
+                                         uint8_t *num_bits);
+
+#endif
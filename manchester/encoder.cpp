@@ -18,70 +18,109 @@
 
 ManchesterEncoder::ManchesterEncoder(PinName out_pin, PinName in_pin, int baud,
                                      bool idle_state)
-    : _output_pin(out_pin), _input_pin(in_pin, PullUp)
+    : _output_pin(out_pin), _input_pin(in_pin, PullUp),
+      _half_bit_time(half_bit_us(baud)),
+      _bitbang_tx(_output_pin, _half_bit_time, idle_state),
+      _ticker_tx(_output_pin, _half_bit_time, idle_state), _tx(&_ticker_tx)
 {
     _idle_state = idle_state;
     _output_pin = idle_state;
+    data_ready = false;
+    rx_in_progress = false;
+    bit_recv_total = 8;
+    _edge_count = 0;
+    _last_edge_us = us_ticker_read();
+    _frame_start = 0;
+    _rx_frame.start = 0;
+    _rx_frame.stop = 0;
+    _rx_frame.time_us = 0;
+    // Stop condition is at least two bit times of idle line
+    _stop_time = 4 * _half_bit_time;
+    _tx_kind = BusScheduler::FORWARD;
+    _tx_data = 0;
+    _tx_bits = 0;
+    _tx_pending = false;
+    _tx_lost = false;
+    _collisions = 0;
+    _tx_end_us = us_ticker_read();
+    _event_queue = NULL;
+    _event_queue_save = NULL;
+    _dispatch_pending = false;
+    _event_errors = 0;
+    _event_time = 0;
+    _events_on = false;
+    _foreign_frames = 0;
+#if MBED_CONF_RTOS_PRESENT
+    _dispatch_started = false;
+#endif
+    _bitbang_tx.set_line_check(callback(this, &ManchesterEncoder::line_check));
+    _ticker_tx.set_line_check(callback(this, &ManchesterEncoder::line_check));
+    // Transmitter starts idle
+    event_flags.set(TX_DONE_FLAG);
+    // Listen for event frames from the start
+    arm_receiver();
+}
+
+ManchesterEncoder::~ManchesterEncoder()
+{
+#if MBED_CONF_RTOS_PRESENT
+    if (_dispatch_started) {
+        _dispatch_thread.terminate();
+    }
+#endif
+}
+
+int ManchesterEncoder::half_bit_us(int baud)
+{
     // Half bit time in seconds
     float time_s = 1.0 / (2.0 * (float)baud);
     // Half bit time in microseconds
-    _half_bit_time = (int)(time_s * 1000000.0);
-    data_ready = false;
-    recv_data = 0;
-    bit_recv_total = 8;
+    return (int)(time_s * 1000000.0);
 }
 
 // Blocking receive call
 int ManchesterEncoder::recv()
 {
-    // -1 means no data ready in timeout period
-    int ret = -1;
-    // Wait for timeout between response
-    wait_us(2400);
-    // Calculate timer stop time, 9 recv bits, stop condition, half bit extra
-    int stop_time = (_half_bit_time * 2 * 9) + 2400 + _half_bit_time;
-    // Start a timer
-    Timer t;
-    t.start();
-    // While reading data
-    while (rx_in_progress && t.read_us() < stop_time) {
-    };
-    t.stop();
-    if (data_ready) {
-        // If there is data, clear our buffer
-        ret = recv_data;
-        recv_data = 0;
-    }
-    return ret;
-}
-
-void ManchesterEncoder::send_24(uint32_t data_out)
-{
-    // We don't want to be preempted because this is time sensitive
+    // Wait for the forward frame to be on the wire
+    flush();
+    uint32_t elapsed = us_ticker_read() - _tx_end_us;
+    if (!rx_in_progress && !data_ready) {
+        if (elapsed >= BACKWARD_SETTLE_MAX_US) {
+            return RECV_NO_RESPONSE;
+        }
+        // Sleep until the frame starts or the window closes
+        uint32_t window_ms = (BACKWARD_SETTLE_MAX_US - elapsed + 999) / 1000;
+        uint32_t flags = event_flags.wait_any(RX_START_FLAG, window_ms, false);
+        if ((flags & osFlagsError) && !rx_in_progress && !data_ready) {
+            return RECV_NO_RESPONSE;
+        }
+    }
+    // Start bit, data bits, stop condition and a millisecond of slack
+    uint32_t frame_ms =
+        ((1 + bit_recv_total) * 2 * _half_bit_time + _stop_time) / 1000 + 1;
+    while (!data_ready) {
+        uint32_t flags = event_flags.wait_any(DONE_FLAG, frame_ms);
+        // A frame ended without being a backward frame, or nothing is coming
+        // in. Keep waiting only while a longer frame is still coming in.
+        if (!(flags & osFlagsError) || !rx_in_progress) {
+            break;
+        }
+    }
+    if (!data_ready) {
+        return RECV_NO_RESPONSE;
+    }
     core_util_critical_section_enter();
-    clear_interrupts();
-    // Send start condition
-    _output_pin = !_idle_state;
-    wait_us(_half_bit_time);
-    _output_pin = _idle_state;
-    wait_us(_half_bit_time);
-    // Send the data
-    for (int i = 0; i < 24; i++) {
-        // Send the actual MSb
-        _output_pin = (bool)(data_out & 0x800000);
-        wait_us(_half_bit_time);
-        // Send the inverted MSb
-        _output_pin = !((bool)(data_out & 0x800000));
-        wait_us(_half_bit_time);
-        // Shift to next bit
-        data_out = data_out << 1;
-    }
-    // Send the stop condition
-    _output_pin = _idle_state;
-    bit_recv_total = 8;
+    rx_frame frame = _rx_frame;
+    data_ready = false;
     core_util_critical_section_exit();
-    _input_pin.rise(callback(this, &ManchesterEncoder::rise_handler));
-    wait_us(13500);
+    uint8_t num_bits = 0;
+    return decode_frame(frame, &num_bits);
+}
+
+void ManchesterEncoder::send_24(uint32_t data_out,
+                                BusScheduler::FrameKind kind)
+{
+    transmit(data_out, 24, kind);
 }
 
 void ManchesterEncoder::set_recv_frame_length(int num)
@@ -89,113 +128,414 @@ void ManchesterEncoder::set_recv_frame_length(int num)
     bit_recv_total = num;
 }
 
-void ManchesterEncoder::send(uint16_t data_out)
+void ManchesterEncoder::send(uint16_t data_out, BusScheduler::FrameKind kind)
 {
-    // We don't want to be preempted because this is time sensitive
-    core_util_critical_section_enter();
-    clear_interrupts();
-    // Send start condition
-    _output_pin = !_idle_state;
-    wait_us(_half_bit_time);
-    _output_pin = _idle_state;
-    wait_us(_half_bit_time);
-    // Send the data
-    for (int i = 0; i < 16; i++) {
-        // Send the actual MSb
-        _output_pin = (bool)(data_out & 0x8000);
-        wait_us(_half_bit_time);
-        // Send the inverted MSb
-        _output_pin = !((bool)(data_out & 0x8000));
-        wait_us(_half_bit_time);
-        // Shift to next bit
-        data_out = data_out << 1;
-    }
-    // Send the stop condition
-    _output_pin = _idle_state;
+    transmit(data_out, 16, kind);
+}
+
+void ManchesterEncoder::flush()
+{
+    while (true) {
+        uint32_t flags = event_flags.wait_any(TX_DONE_FLAG | TX_RETRY_FLAG,
+                                              osWaitForever, false);
+        if (flags & TX_DONE_FLAG) {
+            return;
+        }
+        // A blocking engine lost the bus, send the frame again from here
+        event_flags.clear(TX_RETRY_FLAG);
+        wait_settled();
+        if (_tx_lost) {
+            start_frame();
+        }
+    }
+}
+
+void ManchesterEncoder::set_priority(int priority)
+{
+    _sched.set_priority(priority);
+}
+
+void ManchesterEncoder::transmit(uint32_t data_out, uint8_t num_bits,
+                                 BusScheduler::FrameKind kind)
+{
+    do {
+        wait_bus_free();
+    } while (send_async(data_out, num_bits, NULL, kind) < 0);
+}
+
+void ManchesterEncoder::wait_bus_free()
+{
+    flush();
+    wait_settled();
+}
+
+void ManchesterEncoder::wait_settled()
+{
+    while (true) {
+        core_util_critical_section_enter();
+        uint32_t delay = rx_in_progress
+                             ? _half_bit_time
+                             : _sched.time_to_free(us_ticker_read());
+        core_util_critical_section_exit();
+        if (delay == 0) {
+            return;
+        }
+#if MBED_CONF_RTOS_PRESENT
+        // Sleep through the settling time, so the threads of other buses
+        // can run, and only spin for the last fraction of a millisecond
+        if (delay >= 1000) {
+            Thread::wait(delay / 1000);
+            continue;
+        }
+#endif
+        wait_us(delay);
+    }
+}
+
+int ManchesterEncoder::send_async(uint32_t data_out, uint8_t num_bits,
+                                  mbed::Callback<void()> done,
+                                  BusScheduler::FrameKind kind)
+{
+    if (_tx_pending) {
+        return -1;
+    }
+    // Any reply we get must be to this frame
+    data_ready = false;
+    event_flags.clear(TX_DONE_FLAG | RX_START_FLAG | DONE_FLAG);
+    _tx_kind = kind;
+    _tx_done_cb = done;
+    _tx_data = data_out;
+    _tx_bits = num_bits;
+    _tx_pending = true;
+    start_frame();
+    return 0;
+}
+
+void ManchesterEncoder::start_frame()
+{
+    _tx_lost = false;
+    _tx->transmit(_tx_data, _tx_bits,
+                  callback(this, &ManchesterEncoder::tx_complete));
+}
+
+void ManchesterEncoder::retry_frame()
+{
+    if (!_tx_lost || rx_in_progress) {
+        // Sent already, or frame_end() tries again after the frame on the bus
+        return;
+    }
+    uint32_t delay = _sched.time_to_free(us_ticker_read());
+    if (delay) {
+        _retry_timeout.attach_us(
+            callback(this, &ManchesterEncoder::retry_frame), delay);
+        return;
+    }
+    start_frame();
+}
+
+bool ManchesterEncoder::tx_busy()
+{
+    return _tx_pending;
+}
+
+uint32_t ManchesterEncoder::collisions()
+{
+    return _collisions;
+}
+
+void ManchesterEncoder::set_tx_mode(TxMode mode)
+{
+    if (mode == TX_BITBANG) {
+        set_tx_backend(&_bitbang_tx);
+    } else {
+        set_tx_backend(&_ticker_tx);
+    }
+}
+
+void ManchesterEncoder::set_tx_backend(ManchesterTxBackend *backend)
+{
+    // Let any frame in flight finish on the old engine
+    flush();
+    _tx = backend ? backend : &_ticker_tx;
+    _tx->set_line_check(callback(this, &ManchesterEncoder::line_check));
+}
+
+void ManchesterEncoder::tx_complete()
+{
+    _tx_end_us = us_ticker_read();
+    _sched.frame_end(_tx_kind, _tx_end_us);
+    // The receiver heard our own frame, it is not one we received
+    _frame_timeout.detach();
+    rx_in_progress = false;
+    event_flags.clear(RX_START_FLAG);
     bit_recv_total = 8;
-    core_util_critical_section_exit();
-    _input_pin.rise(callback(this, &ManchesterEncoder::rise_handler));
-    wait_us(13500);
+    _tx_pending = false;
+    event_flags.set(TX_DONE_FLAG);
+    if (_tx_done_cb) {
+        _tx_done_cb();
+    }
+}
+
+bool ManchesterEncoder::line_check()
+{
+    // Another transmitter holds the bus active while we leave it idle. Its
+    // frame goes on, and ours waits for it to end.
+    if (_input_pin.read() && _output_pin.read() == _idle_state) {
+        _tx_lost = true;
+        _collisions++;
+        return false;
+    }
+    return true;
 }
 
-void ManchesterEncoder::attach(mbed::Callback<void(uint32_t)> status_cb)
+void ManchesterEncoder::attach(mbed::Callback<void(uint32_t)> status_cb,
+                               EventQueue *queue)
 {
+#if MBED_CONF_RTOS_PRESENT
+    if (status_cb && !queue && !_dispatch_started) {
+        osStatus status = _dispatch_thread.start(
+            callback(this, &ManchesterEncoder::dispatch_main));
+        if (status == osOK) {
+            _dispatch_thread.set_priority(osPriorityAboveNormal);
+            _dispatch_started = true;
+        }
+    }
+#endif
+    core_util_critical_section_enter();
     bit_recv_total = 24;
+    _event_queue = queue;
     _sensor_event_cb = status_cb;
-    _input_pin.rise(callback(this, &ManchesterEncoder::rise_handler));
+    _events_on = true;
+    core_util_critical_section_exit();
 }
 
 void ManchesterEncoder::detach()
 {
-    // Wait for the done flag or 100 ms max 
-    event_flags.wait_all(DONE_FLAG, 100);
-    bit_recv_total = 8;
-    if (_sensor_event_cb) {
+    // The receiver keeps running, event frames are dropped until reattach()
+    core_util_critical_section_enter();
+    if (_events_on) {
         _sensor_event_cb_save = _sensor_event_cb;
+        _event_queue_save = _event_queue;
         _sensor_event_cb = NULL;
+        _events_on = false;
     }
-    clear_interrupts();
+    core_util_critical_section_exit();
 }
 
 void ManchesterEncoder::reattach()
 {
-    attach(_sensor_event_cb_save);
+    attach(_sensor_event_cb_save, _event_queue_save);
 }
 
-void ManchesterEncoder::clear_interrupts()
+int ManchesterEncoder::dispatch_events()
 {
-    _input_pin.rise(0);
-    _input_pin.fall(0);
+    // Clear first so an event queued while draining posts a new dispatch
+    _dispatch_pending = false;
+    int count = 0;
+    event_frame frame;
+    // Without a callback the frames are left to read_event()
+    while (_sensor_event_cb && _events.pop(frame)) {
+        _event_time = frame.time_us;
+        _sensor_event_cb(frame.data);
+        count++;
+    }
+    return count;
 }
 
-void ManchesterEncoder::stop()
+#if MBED_CONF_RTOS_PRESENT
+void ManchesterEncoder::dispatch_main()
 {
-    clear_interrupts();
-    if (rx_in_progress) {
-        data_ready = true;
+    while (true) {
+        event_flags.wait_any(EVENT_POSTED_FLAG);
+        dispatch_events();
     }
-    rx_in_progress = false;
-    // Call sensor event handler
-    if (_sensor_event_cb)
-        _sensor_event_cb(recv_data);
-    event_flags.set(DONE_FLAG);
+}
+#endif
+
+bool ManchesterEncoder::read_event(event_frame &frame)
+{
+    if (_sensor_event_cb) {
+        // The dispatcher is the only reader of the ring
+        return false;
+    }
+    return _events.pop(frame);
+}
+
+uint32_t ManchesterEncoder::event_time()
+{
+    return _event_time;
+}
+
+uint32_t ManchesterEncoder::event_overflows()
+{
+    return _events.overflows();
+}
+
+uint32_t ManchesterEncoder::event_errors()
+{
+    return _event_errors;
+}
+
+uint32_t ManchesterEncoder::event_high_water()
+{
+    return _events.high_water();
+}
+
+uint32_t ManchesterEncoder::foreign_frames()
+{
+    return _foreign_frames;
+}
+
+void ManchesterEncoder::arm_receiver()
+{
     _input_pin.rise(callback(this, &ManchesterEncoder::rise_handler));
+    _input_pin.fall(callback(this, &ManchesterEncoder::fall_handler));
 }
 
-void ManchesterEncoder::irq_handler()
+void ManchesterEncoder::rise_handler()
 {
-    clear_interrupts();
-    rx_in_progress = true;
-    data_ready = false;
-    // Clear any stop timers
-    t2.detach();
-    t1.attach_us(callback(this, &ManchesterEncoder::read_state),
-                 1.5 * (float)_half_bit_time);
-    t2.attach_us(callback(this, &ManchesterEncoder::stop), 2450);
+    record_edge(1);
+}
+
+void ManchesterEncoder::fall_handler()
+{
+    record_edge(0);
+}
+
+void ManchesterEncoder::record_edge(uint8_t level)
+{
+    uint32_t now = us_ticker_read();
+    uint32_t count = _edge_count;
+    if (now - _last_edge_us > _stop_time) {
+        // First edge after an idle line starts a new frame
+        _frame_start = count;
+        rx_in_progress = true;
+        data_ready = false;
+        event_flags.set(RX_START_FLAG);
+        // Start bit, data bits and the stop condition
+        _frame_timeout.attach_us(callback(this, &ManchesterEncoder::frame_end),
+                                 (1 + bit_recv_total) * 2 * _half_bit_time +
+                                     _stop_time);
+    }
+    ManchesterEdge &edge = _edges[count & (EDGE_BUFFER_SIZE - 1)];
+    edge.time_us = now;
+    edge.level = level;
+    _last_edge_us = now;
+    _edge_count = count + 1;
 }
 
-void ManchesterEncoder::read_state()
+void ManchesterEncoder::frame_end()
 {
-    int state = _input_pin.read();
-    if (bit_count < bit_recv_total) {
-        uint32_t mask = ((bool)state) << ((bit_recv_total - 1) - bit_count++);
-        recv_data |= mask;
+    uint32_t idle = us_ticker_read() - _last_edge_us;
+    if (idle < _stop_time) {
+        // Longer frame than expected, check again once it could have stopped
+        _frame_timeout.attach_us(callback(this, &ManchesterEncoder::frame_end),
+                                 _stop_time - idle);
+        return;
+    }
+    if (_input_pin.read()) {
+        // Held active by colliding senders, wait for the line to be released
+        _frame_timeout.attach_us(callback(this, &ManchesterEncoder::frame_end),
+                                 _stop_time);
+        return;
     }
-    if (state == 0) {
-        _input_pin.rise(callback(this, &ManchesterEncoder::irq_handler));
+    rx_frame frame;
+    frame.start = _frame_start;
+    frame.stop = _edge_count;
+    frame.time_us = _edges[frame.start & (EDGE_BUFFER_SIZE - 1)].time_us;
+    // Tell the frames apart by their length, recv() decodes backward frames.
+    // Backward frames are a start bit and 8 data bits, several devices
+    // answering at once may add a bit or two. Forward frames of other
+    // control devices have 16 data bits and event frames 24.
+    uint32_t length = _last_edge_us - frame.time_us;
+    uint32_t bit_time = 2 * _half_bit_time;
+    bool backward = length < (1 + 12) * bit_time;
+    _sched.frame_end(backward ? BusScheduler::BACKWARD
+                              : BusScheduler::FORWARD,
+                     _last_edge_us + _half_bit_time);
+    rx_in_progress = false;
+    if (backward) {
+        _rx_frame = frame;
+        data_ready = true;
     } else {
-        _input_pin.fall(callback(this, &ManchesterEncoder::irq_handler));
+        bool event = false;
+        if (length > (1 + 20) * bit_time) {
+            // At most 51 edges, decode here so the queue holds the data and
+            // not edges a burst of newer frames would overwrite
+            uint8_t num_bits = 0;
+            int data = decode_frame(frame, &num_bits);
+            if (data < 0) {
+                _event_errors++;
+            } else if (num_bits == 24 && !(data & EVENT_COMMAND_BIT)) {
+                event = true;
+                if (_events_on) {
+                    queue_event(data, frame.time_us);
+                }
+            }
+        }
+        if (!event) {
+            // Our own frames end in tx_complete(), this is another control
+            // device's command
+            _foreign_frames++;
+        }
+    }
+    event_flags.set(DONE_FLAG);
+    if (_tx_lost) {
+        // Our frame lost the bus to this one. A blocking engine would hold
+        // up this interrupt for the whole frame, flush() sends it instead.
+        if (_tx->blocking()) {
+            event_flags.set(TX_RETRY_FLAG);
+        } else {
+            retry_frame();
+        }
     }
 }
 
-void ManchesterEncoder::rise_handler()
+void ManchesterEncoder::queue_event(uint32_t data, uint32_t time_us)
 {
-    bit_count = 0;
-    recv_data = 0;
-    clear_interrupts();
-    // fall handler called in less than 1.5*_half_bit_time means start condition
-    _input_pin.fall(callback(this, &ManchesterEncoder::irq_handler));
-    // Stop condition if rise handler is not called in time
-    t2.attach_us(callback(this, &ManchesterEncoder::stop),
-                 1.5 * (float)_half_bit_time);
+    event_frame frame;
+    frame.data = data;
+    frame.time_us = time_us;
+    _events.push(frame);
+    if (!_sensor_event_cb) {
+        // Left to read_event()
+        return;
+    }
+    if (!_event_queue) {
+#if MBED_CONF_RTOS_PRESENT
+        event_flags.set(EVENT_POSTED_FLAG);
+#endif
+        // Without an RTOS the application calls dispatch_events()
+    } else if (!_dispatch_pending) {
+        _dispatch_pending = true;
+        if (_event_queue->call(this, &ManchesterEncoder::dispatch_events) ==
+            0) {
+            // Queue out of memory, retry on the next event
+            _dispatch_pending = false;
+        }
+    }
+}
+
+int ManchesterEncoder::decode_frame(const rx_frame &frame, uint8_t *num_bits)
+{
+    ManchesterEdge edges[MANCHESTER_MAX_EDGES];
+    uint32_t start = frame.start;
+    int num_edges = frame.stop - start;
+    if (num_edges > MANCHESTER_MAX_EDGES || num_edges > EDGE_BUFFER_SIZE) {
+        return RECV_FRAME_ERROR;
+    }
+    for (int i = 0; i < num_edges; i++) {
+        edges[i] = _edges[(start + i) & (EDGE_BUFFER_SIZE - 1)];
+    }
+    // Overwritten by newer frames before or while copying
+    if (_edge_count - start > EDGE_BUFFER_SIZE) {
+        return RECV_FRAME_ERROR;
+    }
+    uint32_t data;
+    if (manchester_decode(edges, num_edges, _half_bit_time,
+                          _half_bit_time / 5, &data, num_bits) !=
+        MANCHESTER_OK) {
+        return RECV_FRAME_ERROR;
+    }
+    return data;
 }
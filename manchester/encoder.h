@@ -16,9 +16,33 @@
 #ifndef MAN_ENCODING_H
 #define MAN_ENCODING_H
 
+#include "bus_timing.h"
+#include "decoder.h"
 #include "mbed.h"
+#include "ring_buffer.h"
+#include "tx_backend.h"
 
 #define DONE_FLAG (1UL << 0)
+#define TX_DONE_FLAG (1UL << 1)
+#define RX_START_FLAG (1UL << 2)
+#define TX_RETRY_FLAG (1UL << 3)
+#define EVENT_POSTED_FLAG (1UL << 4)
+
+// recv() return values when there is no valid frame
+#define RECV_NO_RESPONSE (-1)
+#define RECV_FRAME_ERROR (-2)
+
+// Edges kept by the receive interrupt, must be a power of two
+#define EDGE_BUFFER_SIZE 64
+
+// 24 bit frames with this bit clear are input device events, the ones with
+// it set are commands from other control devices -- iec62386-103
+#define EVENT_COMMAND_BIT (1UL << 16)
+
+// Input device event frames queued for dispatch, must be a power of two
+#ifndef EVENT_QUEUE_SIZE
+#define EVENT_QUEUE_SIZE 32
+#endif
 
 struct event_msg {
     uint8_t addr;
@@ -26,58 +50,304 @@ struct event_msg {
     uint16_t info;
 };
 
+// Raw event frame as captured by the receiver
+struct event_frame {
+    // 24 bit frame data
+    uint32_t data;
+    // Time of the start bit in microseconds
+    uint32_t time_us;
+};
+
 class ManchesterEncoder {
 public:
+    // Built-in transmit engines
+    enum TxMode { TX_TIMER, TX_BITBANG };
+
     // Flag data ready
     volatile bool data_ready;
 
     ManchesterEncoder(PinName out_pin, PinName in_pin, int baud,
                       bool idle_state = 0);
 
-    // Blocking receive call
+    ~ManchesterEncoder();
+
+    /** Blocking receive call
+     *
+     * Sleeps until the backward frame to the last forward frame is complete,
+     * or until the iec62386-101 backward frame window has closed without a
+     * backward frame starting. Event frames received meanwhile go to the
+     * event callback.
+     *
+     *   @returns   The received frame, RECV_NO_RESPONSE if nothing was
+     *              received or RECV_FRAME_ERROR if the frame could not be
+     *              decoded (e.g. several devices answering at once)
+     */
     int recv();
 
-    void send_24(uint32_t data_out);
+    /** Send a 24 bit frame
+     *
+     * Waits until the bus is free for the frame, then starts it and returns
+     * without waiting for it to finish.
+     *
+     *   @param data_out    Frame data
+     *   @param kind        SEND_TWICE for the first frame of a send-twice pair
+     */
+    void send_24(uint32_t data_out,
+                 BusScheduler::FrameKind kind = BusScheduler::FORWARD);
 
     void set_recv_frame_length(int num);
 
-    void send(uint16_t data_out);
+    /** Send a 16 bit frame
+     *
+     * Waits until the bus is free for the frame, then starts it and returns
+     * without waiting for it to finish.
+     *
+     *   @param data_out    Frame data
+     *   @param kind        SEND_TWICE for the first frame of a send-twice pair
+     */
+    void send(uint16_t data_out,
+              BusScheduler::FrameKind kind = BusScheduler::FORWARD);
+
+    /** Wait until the last frame sent is completely on the wire
+     */
+    void flush();
 
-    void attach(mbed::Callback<void(uint32_t)> status_cb);
+    /** Set the transmitter priority, which sets the settling time before
+     * forward frames -- section 8 of iec62386-101
+     *
+     *   @param priority    [1, 5], 1 being the highest, BUS_PRIORITY_DEFAULT
+     * (2, user actions) by default. See BusScheduler::set_priority().
+     */
+    void set_priority(int priority);
 
+    /** Start sending a frame without waiting for it to complete
+     *
+     * The receiver watches the bus while the frame goes out. When another
+     * transmitter wins the bus the frame stops, and goes again once the
+     * winning frame is over and the bus has settled for our priority. With a
+     * blocking engine (TX_BITBANG) it goes again from the next flush(), which
+     * send(), send_24() and recv() call first.
+     *
+     *   @param data_out    Frame data, right aligned
+     *   @param num_bits    Number of data bits (16 or 24)
+     *   @param done        Called when the frame is on the wire, may be from
+     *                      interrupt context
+     *   @returns           0 on success, -1 if a frame is still being sent
+     */
+    int send_async(uint32_t data_out, uint8_t num_bits,
+                   mbed::Callback<void()> done,
+                   BusScheduler::FrameKind kind = BusScheduler::FORWARD);
+
+    /** Check if the transmitter is sending a frame, or waiting to send it
+     * again after losing the bus
+     */
+    bool tx_busy();
+
+    /** Get the number of times another transmitter won the bus from us
+     */
+    uint32_t collisions();
+
+    /** Select one of the built-in transmit engines
+     *
+     *   @param mode    TX_TIMER (default) or TX_BITBANG
+     */
+    void set_tx_mode(TxMode mode);
+
+    /** Use a custom transmit engine (e.g. PWM or DMA based)
+     *
+     *   @param backend     The engine, must outlive the encoder. NULL selects
+     *                      the default timer engine.
+     */
+    void set_tx_backend(ManchesterTxBackend *backend);
+
+    /** Get the output pin, for transmit engines that drive it themselves
+     */
+    DigitalOut &output_pin()
+    {
+        return _output_pin;
+    }
+
+    /** Attach a callback for input device event frames
+     *
+     * The receiver listens all the time, and tells event frames from backward
+     * frames by their length. Event frames are queued by the receive
+     * interrupt, the callback never runs there. With an event queue it runs
+     * on the queue's thread. Otherwise it runs on a dispatcher thread the
+     * encoder starts, or without an RTOS from dispatch_events(), which the
+     * application then calls.
+     *
+     *   @param status_cb   Callback taking the 24 bit event frame, or NULL to
+     *                      take the frames with read_event()
+     *   @param queue       Queue to dispatch events on, or NULL
+     */
+    void attach(mbed::Callback<void(uint32_t)> status_cb,
+                EventQueue *queue = NULL);
+
+    /** Stop passing event frames to the callback, until reattach()
+     */
     void detach();
 
     void reattach();
 
+    /** Pass queued event frames to the attached callback
+     *
+     * Only needed without an RTOS and without an event queue, the frames are
+     * dispatched by a thread otherwise.
+     *
+     *   @returns   Number of events dispatched
+     */
+    int dispatch_events();
+
+    /** Take the oldest queued event frame without dispatching it
+     *
+     * Only while attached without a callback, as the ring has one reader.
+     *
+     *   @param frame   Receives the frame and its capture time
+     *   @returns       false if no frame is queued or a callback is attached
+     */
+    bool read_event(event_frame &frame);
+
+    /** Get the capture time of the event being dispatched
+     *
+     *   @returns   Time of the start bit in microseconds
+     */
+    uint32_t event_time();
+
+    /** Get the number of event frames dropped because the queue was full
+     */
+    uint32_t event_overflows();
+
+    /** Get the number of event frames that could not be decoded
+     */
+    uint32_t event_errors();
+
+    /** Get the highest number of event frames queued at once
+     */
+    uint32_t event_high_water();
+
+    /** Get the number of forward frames received from other control devices
+     *
+     * Frames that don't decode count as well, as they may be commands.
+     */
+    uint32_t foreign_frames();
+
 private:
-    void clear_interrupts();
+    // Frame captured by the receive interrupt
+    struct rx_frame {
+        // Edge range [start, stop) in the edge buffer
+        uint32_t start;
+        uint32_t stop;
+        // Time of the start bit in microseconds
+        uint32_t time_us;
+    };
+
+    static int half_bit_us(int baud);
+
+    // Transmit used by send() and send_24()
+    void transmit(uint32_t data_out, uint8_t num_bits,
+                  BusScheduler::FrameKind kind);
+
+    // Wait for the transmitter to be idle and the settling time to pass
+    void wait_bus_free();
+
+    // Wait for the frame on the bus to end and the settling time to pass
+    void wait_settled();
+
+    // Put the frame of the last send_async() on the wire
+    void start_frame();
+
+    // Start the frame again after losing the bus, once the bus has settled.
+    // Runs in interrupt context, so only for engines that don't block.
+    void retry_frame();
 
-    void stop();
+    void tx_complete();
 
-    void irq_handler();
+    // Collision check made by the transmit engine in the middle of each
+    // half bit
+    bool line_check();
 
-    void read_state();
+    void arm_receiver();
 
     void rise_handler();
 
+    void fall_handler();
+
+    void record_edge(uint8_t level);
+
+    void frame_end();
+
+    void queue_event(uint32_t data, uint32_t time_us);
+
+#if MBED_CONF_RTOS_PRESENT
+    // Dispatcher thread of attach() without an event queue
+    void dispatch_main();
+#endif
+
+    /** Decode a frame from the edge buffer
+     *
+     *   @param frame       The frame's edges
+     *   @param num_bits    Receives the number of data bits
+     *   @returns           The frame data or RECV_FRAME_ERROR, also when newer
+     *                      frames overwrote its edges
+     */
+    int decode_frame(const rx_frame &frame, uint8_t *num_bits);
+
     // Pin to output encoded data
     DigitalOut _output_pin;
     // Pin to read encoded data
     InterruptIn _input_pin;
     // Half the time for each bit (1/(2*baud))
     int _half_bit_time;
-    volatile uint32_t recv_data;
-    volatile uint8_t bit_count;
     volatile bool rx_in_progress;
     // Total amount of bits expected
     volatile uint8_t bit_recv_total;
     bool _idle_state;
-    Timeout t1;
-    Timeout t2;
+    // Edge timestamps captured by the receive interrupt
+    ManchesterEdge _edges[EDGE_BUFFER_SIZE];
+    // Total number of edges captured, indexes _edges modulo its size
+    volatile uint32_t _edge_count;
+    volatile uint32_t _last_edge_us;
+    // First edge of the frame coming in
+    volatile uint32_t _frame_start;
+    // Last backward frame, decoded by recv()
+    rx_frame _rx_frame;
+    // Idle time that ends a frame
+    uint32_t _stop_time;
+    // Fires once per frame to detect its stop condition
+    Timeout _frame_timeout;
     EventFlags event_flags;
 
+    BitBangTxBackend _bitbang_tx;
+    TickerTxBackend _ticker_tx;
+    ManchesterTxBackend *_tx;
+    Callback<void()> _tx_done_cb;
+    BusScheduler::FrameKind _tx_kind;
+    uint32_t _tx_data;
+    uint8_t _tx_bits;
+    // Frame handed to send_async() and not yet completely on the wire
+    volatile bool _tx_pending;
+    // Another transmitter won the bus, the frame waits to go again
+    volatile bool _tx_lost;
+    volatile uint32_t _collisions;
+    Timeout _retry_timeout;
+    volatile uint32_t _tx_end_us;
+    BusScheduler _sched;
+
     Callback<void(uint32_t)> _sensor_event_cb;
     Callback<void(uint32_t)> _sensor_event_cb_save;
+    EventQueue *_event_queue;
+    EventQueue *_event_queue_save;
+    RingBuffer<event_frame, EVENT_QUEUE_SIZE> _events;
+    volatile bool _dispatch_pending;
+    // Event frames are queued between attach() and detach()
+    volatile bool _events_on;
+#if MBED_CONF_RTOS_PRESENT
+    Thread _dispatch_thread;
+    bool _dispatch_started;
+#endif
+    volatile uint32_t _event_errors;
+    volatile uint32_t _foreign_frames;
+    uint32_t _event_time;
 };
 
 #endif
@@ -0,0 +1,120 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MAN_RING_BUFFER_H
+#define MAN_RING_BUFFER_H
+
+#include <stdint.h>
+
+// Keeps the compiler from moving item accesses across index updates
+#if defined(__GNUC__) || defined(__clang__)
+#define RING_BUFFER_BARRIER() __asm__ __volatile__("" : : : "memory")
+#elif defined(__CC_ARM)
+#define RING_BUFFER_BARRIER() __schedule_barrier()
+#else
+#define RING_BUFFER_BARRIER() __DMB()
+#endif
+
+/** Fixed capacity single-producer/single-consumer queue
+ *
+ * push() may be called from one interrupt or thread and pop() from one other
+ * context without locking. The producer only writes _head and the counters,
+ * the consumer only writes _tail.
+ *
+ * @tparam T    Item type, copied in and out
+ * @tparam N    Capacity, must be a power of two
+ */
+template <typename T, uint32_t N>
+class RingBuffer {
+    typedef char capacity_must_be_power_of_two[(N & (N - 1)) == 0 ? 1 : -1];
+
+public:
+    RingBuffer() : _head(0), _tail(0), _overflows(0), _high_water(0)
+    {
+    }
+
+    /** Add an item (producer side)
+     *
+     *   @returns   false if the queue was full and the item was dropped
+     */
+    bool push(const T &item)
+    {
+        uint32_t head = _head;
+        uint32_t used = head - _tail;
+        if (used == N) {
+            _overflows++;
+            return false;
+        }
+        _items[head & (N - 1)] = item;
+        RING_BUFFER_BARRIER();
+        _head = head + 1;
+        if (used + 1 > _high_water) {
+            _high_water = used + 1;
+        }
+        return true;
+    }
+
+    /** Remove the oldest item (consumer side)
+     *
+     *   @returns   false if the queue was empty
+     */
+    bool pop(T &item)
+    {
+        uint32_t tail = _tail;
+        if (tail == _head) {
+            return false;
+        }
+        item = _items[tail & (N - 1)];
+        RING_BUFFER_BARRIER();
+        _tail = tail + 1;
+        return true;
+    }
+
+    uint32_t size() const
+    {
+        return _head - _tail;
+    }
+
+    bool empty() const
+    {
+        return _head == _tail;
+    }
+
+    uint32_t capacity() const
+    {
+        return N;
+    }
+
+    // Number of items dropped because the queue was full
+    uint32_t overflows() const
+    {
+        return _overflows;
+    }
+
+    // Highest number of items queued at once
+    uint32_t high_water() const
+    {
+        return _high_water;
+    }
+
+private:
+    T _items[N];
+    volatile uint32_t _head;
+    volatile uint32_t _tail;
+    volatile uint32_t _overflows;
+    volatile uint32_t _high_water;
+};
+
+#endif
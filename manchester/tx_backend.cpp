@@ -0,0 +1,264 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "tx_backend.h"
+
+BitBangTxBackend::BitBangTxBackend(DigitalOut &out, int half_bit_time,
+                                   bool idle_state)
+    : _out(out), _half_bit_time(half_bit_time), _idle_state(idle_state)
+{
+}
+
+void BitBangTxBackend::transmit(uint32_t data, uint8_t num_bits,
+                                mbed::Callback<void()> done)
+{
+    uint32_t msb = 1UL << (num_bits - 1);
+    // We don't want to be preempted because this is time sensitive
+    core_util_critical_section_enter();
+    // Send start condition
+    bool ok = half_bit(!_idle_state) && half_bit(_idle_state);
+    // Send the data
+    for (int i = 0; ok && i < num_bits; i++) {
+        // Send the actual MSb, then the inverted MSb
+        ok = half_bit((bool)(data & msb)) && half_bit(!((bool)(data & msb)));
+        // Shift to next bit
+        data = data << 1;
+    }
+    // Send the stop condition, or leave the bus to the winner
+    _out = _idle_state;
+    core_util_critical_section_exit();
+    if (ok && done) {
+        done();
+    }
+}
+
+bool BitBangTxBackend::half_bit(int level)
+{
+    _out = level;
+    wait_us(_half_bit_time / 2);
+    bool ok = line_ok();
+    wait_us(_half_bit_time - _half_bit_time / 2);
+    return ok;
+}
+
+bool BitBangTxBackend::busy()
+{
+    // Transmission completes before transmit() returns
+    return false;
+}
+
+bool BitBangTxBackend::blocking()
+{
+    return true;
+}
+
+TickerTxBackend::TickerTxBackend(DigitalOut &out, int half_bit_time,
+                                 bool idle_state)
+    : _out(out), _half_bit_time(half_bit_time), _idle_state(idle_state),
+      _pattern(0), _num_half_bits(0), _index(0), _busy(false)
+{
+}
+
+void TickerTxBackend::transmit(uint32_t data, uint8_t num_bits,
+                               mbed::Callback<void()> done)
+{
+    uint32_t msb = 1UL << (num_bits - 1);
+    // Start condition
+    uint64_t pattern = (uint64_t)!_idle_state;
+    pattern |= (uint64_t)_idle_state << 1;
+    // Data bits, actual value followed by inverted value
+    for (int i = 0; i < num_bits; i++) {
+        bool bit = data & msb;
+        pattern |= (uint64_t)bit << (2 + 2 * i);
+        pattern |= (uint64_t)!bit << (3 + 2 * i);
+        data = data << 1;
+    }
+    _pattern = pattern;
+    _num_half_bits = 2 + 2 * num_bits;
+    _done = done;
+    _busy = true;
+    // First half bit goes out now, the ticker handles the rest
+    _index = 1;
+    _out = (int)(_pattern & 1);
+    _ticker.attach_us(callback(this, &TickerTxBackend::tick), _half_bit_time);
+    _sample.attach_us(callback(this, &TickerTxBackend::sample),
+                      _half_bit_time / 2);
+}
+
+bool TickerTxBackend::busy()
+{
+    return _busy;
+}
+
+void TickerTxBackend::tick()
+{
+    if (_index < _num_half_bits) {
+        _out = (int)((_pattern >> _index) & 1);
+        _index++;
+        _sample.attach_us(callback(this, &TickerTxBackend::sample),
+                          _half_bit_time / 2);
+        return;
+    }
+    // Last half bit has been held long enough, send the stop condition
+    _out = _idle_state;
+    _ticker.detach();
+    _busy = false;
+    if (_done) {
+        _done();
+    }
+}
+
+SharedTickerTxBackend::SharedTickerTxBackend()
+    : _ticker(NULL), _out(NULL), _idle_state(0), _pattern(0),
+      _num_half_bits(0), _index(0), _busy(false)
+{
+}
+
+void SharedTickerTxBackend::attach(SharedTxTicker *ticker, DigitalOut *out,
+                                   bool idle_state)
+{
+    _ticker = ticker;
+    _out = out;
+    _idle_state = idle_state;
+}
+
+void SharedTickerTxBackend::transmit(uint32_t data, uint8_t num_bits,
+                                     mbed::Callback<void()> done)
+{
+    uint32_t msb = 1UL << (num_bits - 1);
+    // Start condition
+    uint64_t pattern = (uint64_t)!_idle_state;
+    pattern |= (uint64_t)_idle_state << 1;
+    // Data bits, actual value followed by inverted value
+    for (int i = 0; i < num_bits; i++) {
+        bool bit = data & msb;
+        pattern |= (uint64_t)bit << (2 + 2 * i);
+        pattern |= (uint64_t)!bit << (3 + 2 * i);
+        data = data << 1;
+    }
+    _pattern = pattern;
+    _num_half_bits = 2 + 2 * num_bits;
+    _done = done;
+    _index = 0;
+    _busy = true;
+    _ticker->start(this);
+}
+
+bool SharedTickerTxBackend::busy()
+{
+    return _busy;
+}
+
+void TickerTxBackend::sample()
+{
+    if (!line_ok()) {
+        _ticker.detach();
+        _out = _idle_state;
+        _busy = false;
+    }
+}
+
+void SharedTickerTxBackend::sample()
+{
+    if (!line_ok()) {
+        // The shared timer stops once no line is busy
+        *_out = _idle_state;
+        _busy = false;
+    }
+}
+
+bool SharedTickerTxBackend::tick()
+{
+    if (_index < _num_half_bits) {
+        *_out = (int)((_pattern >> _index) & 1);
+        _index++;
+        return true;
+    }
+    // Last half bit has been held long enough, send the stop condition
+    *_out = _idle_state;
+    _busy = false;
+    if (_done) {
+        _done();
+    }
+    return false;
+}
+
+SharedTxTicker::SharedTxTicker(int half_bit_time)
+    : _half_bit_time(half_bit_time), _num_lines(0), _running(false)
+{
+}
+
+bool SharedTxTicker::add(SharedTickerTxBackend *line)
+{
+    if (_num_lines == SHARED_TX_MAX_LINES) {
+        return false;
+    }
+    _lines[_num_lines++] = line;
+    return true;
+}
+
+void SharedTxTicker::start(SharedTickerTxBackend *line)
+{
+    core_util_critical_section_enter();
+    if (!_running) {
+        // Nothing else is sending, the first half bit goes out now
+        _running = true;
+        line->tick();
+        _ticker.attach_us(callback(this, &SharedTxTicker::tick),
+                          _half_bit_time);
+        _sample.attach_us(callback(this, &SharedTxTicker::sample),
+                          _half_bit_time / 2);
+    }
+    // Otherwise the next tick starts it
+    core_util_critical_section_exit();
+}
+
+void SharedTxTicker::tick()
+{
+    bool sending = false;
+    for (int i = 0; i < _num_lines; i++) {
+        if (_lines[i]->_busy) {
+            sending |= _lines[i]->tick();
+        }
+    }
+    if (!sending) {
+        // A done callback may have started a frame, which waits for the
+        // next tick
+        core_util_critical_section_enter();
+        for (int i = 0; i < _num_lines; i++) {
+            sending |= _lines[i]->_busy;
+        }
+        if (!sending) {
+            _ticker.detach();
+            _running = false;
+        }
+        core_util_critical_section_exit();
+        if (!sending) {
+            return;
+        }
+    }
+    _sample.attach_us(callback(this, &SharedTxTicker::sample),
+                      _half_bit_time / 2);
+}
+
+void SharedTxTicker::sample()
+{
+    for (int i = 0; i < _num_lines; i++) {
+        if (_lines[i]->_busy) {
+            _lines[i]->sample();
+        }
+    }
+}
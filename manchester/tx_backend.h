@@ -0,0 +1,227 @@
+/* Manchester Encoder Library
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef MAN_TX_BACKEND_H
+#define MAN_TX_BACKEND_H
+
+#include "mbed.h"
+
+/** Transmit engine used by ManchesterEncoder
+ *
+ * A backend emits one frame: the start bit, num_bits data bits (MSb first)
+ * and then leaves the line in the idle state. The done callback is called once
+ * the last half bit has been on the line for a full half bit time. It may be
+ * called from interrupt context.
+ *
+ * In the middle of each half bit the backend calls line_ok(), where a
+ * receiver would sample the line. When it returns false another transmitter
+ * has won the bus: the backend releases the line and drops the frame without
+ * calling done.
+ */
+class ManchesterTxBackend {
+public:
+    virtual ~ManchesterTxBackend()
+    {
+    }
+
+    /** Start transmitting a frame
+     *
+     *   @param data        Frame data, right aligned
+     *   @param num_bits    Number of data bits [1, 31]
+     *   @param done        Called when the frame is complete
+     */
+    virtual void transmit(uint32_t data, uint8_t num_bits,
+                          mbed::Callback<void()> done) = 0;
+
+    /** Check if a frame is currently being transmitted
+     */
+    virtual bool busy() = 0;
+
+    /** Check if transmit() only returns once the frame is over, so it must
+     * not be called from interrupt context
+     */
+    virtual bool blocking()
+    {
+        return false;
+    }
+
+    /** Set the collision check made in the middle of each half bit
+     *
+     *   @param check   Returns false when the frame must stop, may be NULL
+     */
+    void set_line_check(mbed::Callback<bool()> check)
+    {
+        _line_check = check;
+    }
+
+protected:
+    bool line_ok()
+    {
+        return !_line_check || _line_check();
+    }
+
+private:
+    mbed::Callback<bool()> _line_check;
+};
+
+/** Blocking bit-bang backend
+ *
+ * Emits the waveform with wait_us() inside a critical section, so interrupts
+ * are locked out for the whole frame. Kept as a fallback for targets where
+ * the timer backend is too jittery.
+ */
+class BitBangTxBackend : public ManchesterTxBackend {
+public:
+    BitBangTxBackend(DigitalOut &out, int half_bit_time, bool idle_state);
+
+    virtual void transmit(uint32_t data, uint8_t num_bits,
+                          mbed::Callback<void()> done);
+
+    virtual bool busy();
+
+    virtual bool blocking();
+
+private:
+    // Put out a half bit, false if the frame lost the bus
+    bool half_bit(int level);
+
+    DigitalOut &_out;
+    int _half_bit_time;
+    bool _idle_state;
+};
+
+/** Timer driven backend
+ *
+ * The frame is expanded into a half bit pattern up front and a Ticker shifts
+ * out one half bit per interrupt, so the CPU is free between edges.
+ */
+class TickerTxBackend : public ManchesterTxBackend {
+public:
+    TickerTxBackend(DigitalOut &out, int half_bit_time, bool idle_state);
+
+    virtual void transmit(uint32_t data, uint8_t num_bits,
+                          mbed::Callback<void()> done);
+
+    virtual bool busy();
+
+private:
+    void tick();
+
+    void sample();
+
+    DigitalOut &_out;
+    int _half_bit_time;
+    bool _idle_state;
+    Ticker _ticker;
+    // Fires in the middle of each half bit
+    Timeout _sample;
+    // Output level of each half bit, bit 0 is sent first
+    uint64_t _pattern;
+    // Number of half bits in the pattern
+    uint8_t _num_half_bits;
+    volatile uint8_t _index;
+    volatile bool _busy;
+    mbed::Callback<void()> _done;
+};
+
+// Lines one SharedTxTicker can drive
+#ifndef SHARED_TX_MAX_LINES
+#define SHARED_TX_MAX_LINES 4
+#endif
+
+class SharedTxTicker;
+
+/** One line of a SharedTxTicker
+ *
+ * Like TickerTxBackend, but the half bits come from a timer shared with
+ * the other lines. A frame starts at once when no line is sending, and on
+ * the next tick of the shared timer otherwise, at most half a bit later.
+ */
+class SharedTickerTxBackend : public ManchesterTxBackend {
+public:
+    SharedTickerTxBackend();
+
+    /** Connect the line before the first frame
+     *
+     *   @param ticker      The shared timer
+     *   @param out         Output pin of the line
+     *   @param idle_state  Level of the idle line
+     */
+    void attach(SharedTxTicker *ticker, DigitalOut *out, bool idle_state);
+
+    virtual void transmit(uint32_t data, uint8_t num_bits,
+                          mbed::Callback<void()> done);
+
+    virtual bool busy();
+
+private:
+    friend class SharedTxTicker;
+
+    // Put out the next half bit, false once the frame is complete
+    bool tick();
+
+    // Check the half bit on the line, drop the frame if it lost the bus
+    void sample();
+
+    SharedTxTicker *_ticker;
+    DigitalOut *_out;
+    bool _idle_state;
+    // Output level of each half bit, bit 0 is sent first
+    uint64_t _pattern;
+    // Number of half bits in the pattern
+    uint8_t _num_half_bits;
+    volatile uint8_t _index;
+    volatile bool _busy;
+    mbed::Callback<void()> _done;
+};
+
+/** One timer interrupt shifting out the frames of several lines
+ *
+ * All the lines must run at the same bit rate. The timer only runs while a
+ * line is sending.
+ */
+class SharedTxTicker {
+public:
+    /** Constructor
+     *
+     *   @param half_bit_time   Half the bit time of every line in us
+     */
+    SharedTxTicker(int half_bit_time);
+
+    /** Add a line
+     *
+     *   @returns   false if SHARED_TX_MAX_LINES lines were added already
+     */
+    bool add(SharedTickerTxBackend *line);
+
+private:
+    friend class SharedTickerTxBackend;
+
+    // Start the timer for a line that has a frame to send
+    void start(SharedTickerTxBackend *line);
+
+    void tick();
+
+    void sample();
+
+    int _half_bit_time;
+    Ticker _ticker;
+    Timeout _sample;
+    SharedTickerTxBackend *_lines[SHARED_TX_MAX_LINES];
+    int _num_lines;
+    volatile bool _running;
+};
+
+#endif
@@ -0,0 +1,907 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Commissioning and bulk control benchmarks on simulated buses
+ *
+ *   bench [--json] [--inputs N] [--seed N]
+ *
+ * Every bus size runs the same steps from a fresh bus and virtual clock, so
+ * frames and bus time only change when the driver does. --json prints the
+ * results for tracking regressions instead of the table.
+ */
+
+#include "DALICommandQueue.h"
+#include "DALICommissioner.h"
+#include "DALIDriver.h"
+#include "DALIHealthPoller.h"
+#include "DALIMultiBus.h"
+#include "DALITransaction.h"
+#include "mbed.h"
+#include "sim_bus.h"
+#include "sim_gear.h"
+#include "sim_input_device.h"
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define TX_PIN 1
+#define RX_PIN 2
+#define DEFAULT_INPUTS 4
+#define DEFAULT_SEED 42
+// DT8 gear answers for QUERY COLOUR TYPE FEATURES
+#define FEATURES_TC 0x02
+#define FEATURES_RGB 0x60
+#define SWEEP_STEPS 8
+#define POLL_ROUNDS 3
+// A slider dragged for two seconds, sending 50 updates a second
+#define SLIDER_UPDATES 100
+#define SLIDER_PERIOD_US 20000
+// Health polling budget in percent, and a user command five times a second
+#define HEALTH_BUDGET 10
+#define HEALTH_USER_PERIOD_US 200000
+// A user command waits for at most one poll query and its own frame
+#define HEALTH_USER_MAX_MS 60
+// Scene given a new colour temperature on every light, keeping its level
+#define REDEPLOY_SCENE 3
+// Direct arc power commands to every light, which get no reply
+#define COMMAND_ROUNDS 4
+// DALI lines of a multi-bus gateway
+#define GATEWAY_LINES 4
+// Commands sent while input devices report occupancy, each one just after
+// an event frame is due to start, so that the two collide
+#define EVENT_ROUNDS 16
+#define EVENT_PERIOD_MS 100
+#define EVENT_LEAD_US 50
+// A user command waits for at most one commissioning step and its own
+// frame
+#define COMMISSION_USER_MAX_MS 150
+// Units made to pick the same random address on their first RANDOMISE
+#define COLLIDING_GEAR 3
+#define COLLIDING_INPUTS 2
+#define COLLIDING_GEAR_ADDR 0x123456
+#define COLLIDING_INPUT_ADDR 0x00ABCD
+
+static const int bus_sizes[] = {1, 8, 16, 32, 63};
+
+struct Result {
+    const char *name;
+    int gear;
+    int inputs;
+    bool ok;
+    uint32_t forward_frames;
+    uint32_t backward_frames;
+    uint32_t bad_frames;
+    double bus_s;
+    double cpu_ms;
+    // Forward frames per unit the step worked on
+    double per_unit;
+    // Time from the last input to the bus being idle, or from a fault to
+    // it being reported, where it applies
+    double lag_ms;
+};
+
+// A bus of DT8 gear, alternately colour temperature and RGB, plus input
+// devices with an occupancy and a light sensor instance
+struct Fixture {
+    SimBus bus;
+    std::vector<std::unique_ptr<SimGear> > gear;
+    std::vector<std::unique_ptr<SimInputDevice> > inputs;
+    DALIDriver dali;
+
+    // Lines after the first are on the next pins up
+    Fixture(int num_gear, int num_inputs, uint32_t seed, int line = 0)
+        : bus(TX_PIN + 2 * line, RX_PIN + 2 * line),
+          dali(TX_PIN + 2 * line, RX_PIN + 2 * line)
+    {
+        bus.seed(seed);
+        bus.set_reply_delay(7000, 1500);
+        bus.set_edge_jitter(20);
+        for (int i = 0; i < num_gear; i++) {
+            uint8_t features = i % 2 ? FEATURES_RGB : FEATURES_TC;
+            gear.emplace_back(new SimGear(SIM_DT_COLOUR, features));
+            bus.add(gear.back().get());
+        }
+        for (int i = 0; i < num_inputs; i++) {
+            inputs.emplace_back(new SimInputDevice());
+            inputs.back()->add_instance(SIM_INSTANCE_OCCUPANCY);
+            inputs.back()->add_instance(SIM_INSTANCE_LIGHT, 2);
+            bus.add(inputs.back().get());
+        }
+    }
+
+    // Gear at a short address, NULL if there is none
+    SimGear *at(int addr)
+    {
+        for (size_t i = 0; i < gear.size(); i++) {
+            if (gear[i]->short_addr == addr) {
+                return gear[i].get();
+            }
+        }
+        return NULL;
+    }
+};
+
+class Timing {
+public:
+    Timing(Fixture &fixture) : _fixture(fixture)
+    {
+        _fixture.bus.reset_stats();
+        _bus_start = SimClock::instance().now();
+        _cpu_start = std::clock();
+    }
+
+    Result finish(const char *name, bool ok)
+    {
+        const SimBusStats &stats = _fixture.bus.stats();
+        Result result;
+        result.name = name;
+        result.gear = _fixture.gear.size();
+        result.inputs = _fixture.inputs.size();
+        result.ok = ok;
+        result.forward_frames = stats.forward_frames;
+        result.backward_frames = stats.backward_frames;
+        result.bad_frames = stats.bad_frames;
+        result.bus_s = (SimClock::instance().now() - _bus_start) / 1e6;
+        result.cpu_ms = 1000.0 * (std::clock() - _cpu_start) / CLOCKS_PER_SEC;
+        result.lag_ms = 0;
+        set_units(result, result.gear + result.inputs);
+        return result;
+    }
+
+    // Count the frames against only some of the units, e.g. the gear
+    static void set_units(Result &result, int units)
+    {
+        result.per_unit = units ? (double)result.forward_frames / units : 0;
+    }
+
+private:
+    Fixture &_fixture;
+    uint64_t _bus_start;
+    std::clock_t _cpu_start;
+};
+
+static void run_init(int num_gear, int num_inputs, uint32_t seed,
+                     std::vector<Result> &results)
+{
+    SimClock::instance().reset();
+    Fixture f(num_gear, num_inputs, seed);
+    Timing timing(f);
+    f.dali.init();
+    bool ok = f.dali.get_num_lights() == num_gear &&
+              f.dali.get_num_inputs() == num_inputs;
+    results.push_back(timing.finish("init", ok));
+}
+
+// True if no two units of the list share a short address and all have one
+template <class Unit>
+static bool unique_addresses(const std::vector<std::unique_ptr<Unit> > &units)
+{
+    uint64_t used = 0;
+    for (size_t i = 0; i < units.size(); i++) {
+        int addr = units[i]->short_addr;
+        if (addr > 63 || (used & (1ULL << addr))) {
+            return false;
+        }
+        used |= 1ULL << addr;
+    }
+    return true;
+}
+
+// init() on a bus where some gear and some input devices have the same
+// random address, so that the search finds each group as one unit
+static void run_collisions(int num_gear, int num_inputs, uint32_t seed,
+                           std::vector<Result> &results)
+{
+    SimClock::instance().reset();
+    Fixture f(num_gear, num_inputs, seed);
+    for (int i = 0; i < num_gear && i < COLLIDING_GEAR; i++) {
+        f.gear[i]->forced_random_addr = COLLIDING_GEAR_ADDR;
+        f.gear[i]->forced_randomises = 1;
+    }
+    for (int i = 0; i < num_inputs && i < COLLIDING_INPUTS; i++) {
+        f.inputs[i]->forced_random_addr = COLLIDING_INPUT_ADDR;
+        f.inputs[i]->forced_randomises = 1;
+    }
+    Timing timing(f);
+    f.dali.init();
+    bool ok = f.dali.get_num_lights() == num_gear &&
+              f.dali.get_num_inputs() == num_inputs &&
+              unique_addresses(f.gear) && unique_addresses(f.inputs);
+    results.push_back(timing.finish("init_collisions", ok));
+}
+
+// Addressing the luminaires with every search address sent whole, then
+// sending only the bytes that changed, on the same bus
+static void run_search_bytes(int num_gear, int num_inputs, uint32_t seed,
+                             std::vector<Result> &results)
+{
+    for (int incremental = 0; incremental < 2; incremental++) {
+        SimClock::instance().reset();
+        Fixture f(num_gear, num_inputs, seed);
+        f.dali.set_incremental_search(incremental);
+        Timing timing(f);
+        bool ok = f.dali.init_lights() == num_gear;
+        Result result = timing.finish(
+            incremental ? "search_incremental" : "search_full", ok);
+        Timing::set_units(result, num_gear);
+        results.push_back(result);
+    }
+}
+
+// Storage that outlives the driver, as flash does a reboot
+class MemStorage : public DALIStorage {
+public:
+    virtual int get(const char *key, void *buffer, size_t size,
+                    size_t *actual)
+    {
+        std::map<std::string, std::vector<uint8_t> >::iterator it =
+            _values.find(key);
+        if (it == _values.end()) {
+            return -1;
+        }
+        *actual = it->second.size() < size ? it->second.size() : size;
+        memcpy(buffer, it->second.data(), *actual);
+        return 0;
+    }
+
+    virtual int set(const char *key, const void *buffer, size_t size)
+    {
+        const uint8_t *data = (const uint8_t *)buffer;
+        _values[key].assign(data, data + size);
+        return 0;
+    }
+
+    virtual int remove(const char *key)
+    {
+        return _values.erase(key) ? 0 : -1;
+    }
+
+private:
+    std::map<std::string, std::vector<uint8_t> > _values;
+};
+
+// A user dimming the whole site while a new bus is commissioned
+struct CommissionBench {
+    DALICommandQueue queue;
+    DALICommissioner commissioner;
+    uint8_t level;
+    uint64_t posted_at;
+    uint64_t worst_user_us;
+
+    CommissionBench(DALIDriver &dali)
+        : queue(dali), commissioner(queue, dali), level(0), posted_at(0),
+          worst_user_us(0)
+    {
+    }
+
+    void user_done(DALIHandle handle, int result)
+    {
+        uint64_t waited = SimClock::instance().now() - posted_at;
+        if (waited > worst_user_us) {
+            worst_user_us = waited;
+        }
+    }
+
+    void post()
+    {
+        posted_at = SimClock::instance().now();
+        level = 100 + (level + 1) % 100;
+        queue.set_level(DALIDriver::broadcast_addr, level, DALI_PRIORITY_USER,
+                        mbed::callback(this, &CommissionBench::user_done));
+    }
+};
+
+// Commissioning through a DALICommissioner, with a reboot once half of the
+// units have an address. The rebooted driver picks up from the checkpoint.
+static void run_commission(int num_gear, int num_inputs, uint32_t seed,
+                           std::vector<Result> &results)
+{
+    SimClock::instance().reset();
+    Fixture f(num_gear, num_inputs, seed);
+    MemStorage storage;
+    // The first driver stays idle on the bus after the reboot
+    std::unique_ptr<DALIDriver> rebooted;
+    DALIDriver *dali = &f.dali;
+    uint64_t worst_user_us = 0;
+    uint8_t level = 0;
+    bool resumed = false;
+    int half = (num_gear + num_inputs + 1) / 2;
+
+    Timing timing(f);
+    for (int boot = 0; boot < 2; boot++) {
+        if (boot) {
+            rebooted.reset(new DALIDriver(TX_PIN, RX_PIN));
+            dali = rebooted.get();
+        }
+        dali->set_storage(&storage);
+        CommissionBench bench(*dali);
+        SimClock::EventId next_user = 0;
+        std::function<void()> user = [&]() {
+            bench.post();
+            next_user =
+                SimClock::instance().schedule_in(HEALTH_USER_PERIOD_US, user);
+        };
+        user();
+        bench.commissioner.start();
+        while (!bench.commissioner.done()) {
+            if (!boot && bench.commissioner.progress().added >= half) {
+                break;
+            }
+            bench.commissioner.poll();
+            if (!bench.queue.step()) {
+                wait_us(1000);
+            }
+        }
+        SimClock::instance().cancel(next_user);
+        bench.queue.run();
+        if (bench.worst_user_us > worst_user_us) {
+            worst_user_us = bench.worst_user_us;
+        }
+        resumed = bench.commissioner.progress().resumed;
+        level = bench.level;
+    }
+    wait_ms(100);
+
+    bool ok = resumed && dali->get_num_lights() == num_gear &&
+              dali->get_num_inputs() == num_inputs &&
+              worst_user_us <= COMMISSION_USER_MAX_MS * 1000;
+    // Every unit at its own address, and every light at the user's level
+    uint64_t addresses = 0;
+    for (int i = 0; i < num_gear; i++) {
+        SimGear *gear = f.gear[i].get();
+        ok &= gear->short_addr < num_gear && gear->actual_level == level;
+        addresses |= (uint64_t)1 << (gear->short_addr % DALI_MAP_UNITS);
+    }
+    for (int i = 0; i < num_inputs; i++) {
+        SimInputDevice *input = f.inputs[i].get();
+        ok &= input->short_addr >= num_gear &&
+              input->short_addr < num_gear + num_inputs;
+        addresses |= (uint64_t)1 << (input->short_addr % DALI_MAP_UNITS);
+    }
+    int units = num_gear + num_inputs;
+    ok &= addresses == (units < DALI_MAP_UNITS ? ((uint64_t)1 << units) - 1
+                                               : ~(uint64_t)0);
+    Result result = timing.finish("commission_live", ok);
+    result.lag_ms = worst_user_us / 1e3;
+    results.push_back(result);
+}
+
+// A dashboard reading the level of every light
+static bool poll_levels(Fixture &f, int num_gear)
+{
+    bool ok = true;
+    for (int round = 0; round < POLL_ROUNDS; round++) {
+        for (int addr = 0; addr < num_gear; addr++) {
+            SimGear *gear = f.at(addr);
+            ok &= gear && f.dali.get_level(addr) == gear->actual_level;
+        }
+    }
+    return ok;
+}
+
+// Slider updates to group 0 through a coalescing command queue, posted from
+// clock events the way another thread would
+static Result slider(Fixture &f, int num_gear)
+{
+    DALICommandQueue queue(f.dali);
+    queue.set_coalescing(true);
+    uint8_t group = f.dali.get_group_addr(0);
+    int posted = 0;
+    uint64_t last_post = 0;
+    std::function<void()> post = [&]() {
+        queue.set_level(group, 10 + posted * 2);
+        last_post = SimClock::instance().now();
+        if (++posted < SLIDER_UPDATES) {
+            SimClock::instance().schedule_in(SLIDER_PERIOD_US, post);
+        }
+    };
+
+    Timing timing(f);
+    post();
+    while (posted < SLIDER_UPDATES || queue.pending()) {
+        if (!queue.step()) {
+            wait_us(1000);
+        }
+    }
+    double lag_ms = (SimClock::instance().now() - last_post) / 1e3;
+    // Let the last frame reach the gear
+    wait_ms(40);
+    bool ok = true;
+    uint8_t level = 10 + (SLIDER_UPDATES - 1) * 2;
+    for (int addr = 0; addr < num_gear; addr += 16) {
+        SimGear *gear = f.at(addr);
+        ok &= gear && gear->actual_level == level;
+    }
+    Result result = timing.finish("slider_coalesced", ok);
+    result.lag_ms = lag_ms;
+    return result;
+}
+
+// The nightly redeployment of a colour scene to every light, one address
+// after the other through the driver or with one transaction. The second
+// run goes past the coolest colour of the lights, so each light gets its own
+// limit, and changes every temporary colour the first run left.
+static Result redeploy(Fixture &f, int num_gear, bool transaction)
+{
+    uint16_t kelvin = transaction ? 8000 : 3000;
+    Timing timing(f);
+    if (transaction) {
+        DALITransaction t;
+        t.color_scene(REDEPLOY_SCENE, kelvin);
+        std::vector<uint8_t> addrs;
+        for (int addr = 0; addr < num_gear; addr++) {
+            addrs.push_back(addr);
+        }
+        t.run(f.dali, addrs.data(), addrs.size());
+    } else {
+        for (int addr = 0; addr < num_gear; addr++) {
+            f.dali.set_color_scene(addr, REDEPLOY_SCENE, kelvin);
+        }
+    }
+    wait_ms(40);
+    bool ok = true;
+    for (int addr = 0; addr < num_gear; addr++) {
+        SimGear *gear = f.at(addr);
+        ok &= gear && gear->scenes[REDEPLOY_SCENE] == 130 + addr;
+        if (gear && gear->colour_features == FEATURES_TC) {
+            uint16_t mirek = 1000000 / kelvin;
+            ok &= gear->temp_colour_tc ==
+                  std::min(std::max(mirek, gear->tc_coolest), gear->tc_warmest);
+        }
+    }
+    return timing.finish(transaction ? "scene_transaction"
+                                     : "scene_redeploy", ok);
+}
+
+// Commands without a reply, back to back. Priority 1 settles for the 13.5 ms
+// that every frame waited before the settling time depended on what was on
+// the bus.
+static Result commands(Fixture &f, int num_gear, int priority)
+{
+    f.dali.encoder.set_priority(priority);
+    Timing timing(f);
+    for (int round = 0; round < COMMAND_ROUNDS; round++) {
+        for (int addr = 0; addr < num_gear; addr++) {
+            f.dali.set_level(addr, 100 + round);
+        }
+    }
+    f.dali.encoder.flush();
+    f.dali.encoder.set_priority(BUS_PRIORITY_DEFAULT);
+    wait_ms(40);
+    bool ok = true;
+    for (int addr = 0; addr < num_gear; addr++) {
+        SimGear *gear = f.at(addr);
+        ok &= gear && gear->actual_level == 100 + COMMAND_ROUNDS - 1;
+    }
+    return timing.finish(priority == BUS_PRIORITY_DEFAULT ? "commands"
+                                                          : "commands_13ms5",
+                         ok);
+}
+
+// Health polling within its budget while a user dims a light, until the
+// lamp failure of the last light is reported. The lamp fails after the
+// poller read the light once, the first answer is not reported.
+struct HealthBench {
+    Fixture &f;
+    DALICommandQueue queue;
+    DALIHealthPoller poller;
+    int fault_addr;
+    uint64_t detected_at;
+    uint64_t posted_at;
+    uint64_t worst_user_us;
+    int posts;
+
+    HealthBench(Fixture &fixture, int num_gear)
+        : f(fixture), queue(fixture.dali), poller(queue, fixture.dali),
+          fault_addr(num_gear - 1), detected_at(0), posted_at(0),
+          worst_user_us(0), posts(0)
+    {
+        poller.set_budget(HEALTH_BUDGET);
+        poller.attach(mbed::callback(this, &HealthBench::changed));
+    }
+
+    void changed(const DALIHealthEvent &event)
+    {
+        if (event.item == DALI_HEALTH_GEAR_STATUS &&
+            event.addr == fault_addr && event.value >= 0 &&
+            (event.value & 0x02) && !detected_at) {
+            detected_at = SimClock::instance().now();
+        }
+    }
+
+    void user_done(DALIHandle handle, int result)
+    {
+        uint64_t waited = SimClock::instance().now() - posted_at;
+        if (waited > worst_user_us) {
+            worst_user_us = waited;
+        }
+    }
+
+    void post()
+    {
+        posted_at = SimClock::instance().now();
+        queue.set_level(0, 100 + posts++ % 100, DALI_PRIORITY_USER,
+                        mbed::callback(this, &HealthBench::user_done));
+    }
+};
+
+static Result health(Fixture &f, int num_gear)
+{
+    HealthBench bench(f, num_gear);
+    SimClock::EventId next_user = 0;
+    std::function<void()> user = [&]() {
+        bench.post();
+        next_user = SimClock::instance().schedule_in(HEALTH_USER_PERIOD_US, user);
+    };
+
+    Timing timing(f);
+    uint64_t start = SimClock::instance().now();
+    user();
+    // The lamp fails once the poller has the baseline of its light, give up
+    // after two full cycles from there
+    uint64_t limit = start + 2000ULL * bench.poller.cycle_ms();
+    while (!bench.detected_at && SimClock::instance().now() < limit) {
+        if (!f.at(bench.fault_addr)->lamp_failure &&
+            bench.poller.value(DALI_HEALTH_GEAR_STATUS, bench.fault_addr) !=
+                DALI_HEALTH_UNKNOWN) {
+            f.at(bench.fault_addr)->lamp_failure = true;
+            start = SimClock::instance().now();
+            limit = start + 2000ULL * bench.poller.cycle_ms();
+        }
+        bench.poller.poll();
+        if (!bench.queue.step()) {
+            wait_us(1000);
+        }
+    }
+    // The bench goes out of scope, so later steps must not run its user
+    SimClock::instance().cancel(next_user);
+    bench.queue.run();
+    double lag_ms = bench.detected_at ? (bench.detected_at - start) / 1e3 : 0;
+    bool ok = bench.detected_at &&
+              bench.worst_user_us <= HEALTH_USER_MAX_MS * 1000;
+    Result result = timing.finish("health_poll", ok);
+    result.lag_ms = lag_ms;
+    return result;
+}
+
+// Occupancy events with the handler attached, while a user sets levels. The
+// commands to one light lose the bus to the events and the broadcasts win
+// against them, and every frame goes out once.
+struct EventBench {
+    int triggered;
+    int received;
+    uint64_t triggered_at;
+    uint64_t worst_us;
+
+    void trigger(SimInputDevice *input)
+    {
+        if (input->trigger(0, 1)) {
+            triggered++;
+            triggered_at = SimClock::instance().now();
+        }
+    }
+
+    void event(uint32_t data)
+    {
+        received++;
+        uint64_t waited = SimClock::instance().now() - triggered_at;
+        if (waited > worst_us) {
+            worst_us = waited;
+        }
+    }
+};
+
+static Result live_events(Fixture &f, int num_gear)
+{
+    EventBench bench = {0, 0, 0, 0};
+    // Takes the input devices out of quiescent mode
+    f.dali.attach(mbed::callback(&bench, &EventBench::event));
+    wait_ms(EVENT_PERIOD_MS);
+    uint32_t collisions = f.dali.encoder.collisions();
+
+    Timing timing(f);
+    bool ok = true;
+    for (int round = 0; round < EVENT_ROUNDS; round++) {
+        if (!f.inputs.empty()) {
+            SimInputDevice *input = f.inputs[round % f.inputs.size()].get();
+            SimClock::instance().schedule_in(
+                0, std::bind(&EventBench::trigger, &bench, input));
+            wait_us(EVENT_LEAD_US);
+        }
+        uint8_t addr = round % 2 ? f.dali.broadcast_addr : round % num_gear;
+        uint8_t level = 100 + round;
+        f.dali.set_level(addr, level);
+        wait_ms(EVENT_PERIOD_MS);
+        for (int i = 0; i < num_gear; i++) {
+            SimGear *gear = f.at(i);
+            if (addr == f.dali.broadcast_addr || i == addr) {
+                ok &= gear && gear->actual_level == level;
+            }
+        }
+    }
+    f.dali.detach();
+    // Every command and every event once
+    const SimBusStats &stats = f.bus.stats();
+    ok &= bench.received == bench.triggered &&
+          stats.forward_frames == (uint32_t)(EVENT_ROUNDS + bench.triggered) &&
+          stats.bad_frames == 0;
+    if (!f.inputs.empty()) {
+        ok &= bench.triggered == EVENT_ROUNDS &&
+              f.dali.encoder.collisions() > collisions &&
+              stats.lost_frames > 0;
+    }
+    Result result = timing.finish("events_live", ok);
+    result.lag_ms = bench.worst_us / 1e3;
+    return result;
+}
+
+// init() on every line of a gateway, one line after the other and then on
+// all of them at once through a DALIMultiBus
+static void run_lines(int num_gear, int num_inputs, uint32_t seed,
+                      std::vector<Result> &results)
+{
+    for (int parallel = 0; parallel < 2; parallel++) {
+        SimClock::instance().reset();
+        std::vector<std::unique_ptr<Fixture> > lines;
+        DALIMultiBus gateway;
+        for (int i = 0; i < GATEWAY_LINES; i++) {
+            lines.emplace_back(new Fixture(num_gear, num_inputs, seed + i, i));
+            if (parallel) {
+                gateway.add_bus(lines.back()->dali);
+            }
+        }
+        uint64_t start = SimClock::instance().now();
+        std::clock_t cpu_start = std::clock();
+        int units = 0;
+        if (parallel) {
+            units = gateway.init();
+        } else {
+            for (int i = 0; i < GATEWAY_LINES; i++) {
+                units += lines[i]->dali.init();
+            }
+        }
+        Result result;
+        result.name = parallel ? "init_lines_parallel" : "init_lines";
+        result.gear = num_gear * GATEWAY_LINES;
+        result.inputs = num_inputs * GATEWAY_LINES;
+        result.ok = units == (num_gear + num_inputs) * GATEWAY_LINES;
+        result.forward_frames = 0;
+        result.backward_frames = 0;
+        result.bad_frames = 0;
+        for (int i = 0; i < GATEWAY_LINES; i++) {
+            const SimBusStats &stats = lines[i]->bus.stats();
+            result.forward_frames += stats.forward_frames;
+            result.backward_frames += stats.backward_frames;
+            result.bad_frames += stats.bad_frames;
+        }
+        result.bus_s = (SimClock::instance().now() - start) / 1e6;
+        result.cpu_ms =
+            1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC;
+        result.lag_ms = 0;
+        Timing::set_units(result, result.gear + result.inputs);
+        results.push_back(result);
+    }
+}
+
+static void run_steps(int num_gear, int num_inputs, uint32_t seed,
+                      std::vector<Result> &results)
+{
+    SimClock::instance().reset();
+    Fixture f(num_gear, num_inputs, seed);
+
+    Timing lights(f);
+    bool ok = f.dali.init_lights() == num_gear;
+    Result result = lights.finish("assign_addresses", ok);
+    Timing::set_units(result, num_gear);
+    results.push_back(result);
+
+    Timing inputs(f);
+    ok = f.dali.init_inputs() == num_inputs;
+    result = inputs.finish("assign_addresses_input", ok);
+    Timing::set_units(result, num_inputs);
+    results.push_back(result);
+
+    // One group per light and four scenes each
+    Timing groups(f);
+    ok = true;
+    for (int addr = 0; addr < num_gear; addr++) {
+        ok &= f.dali.add_to_group(addr, addr % 16);
+        for (int scene = 0; scene < 4; scene++) {
+            f.dali.set_scene(addr, scene, 100 + 10 * scene + addr);
+        }
+    }
+    f.dali.go_to_scene(f.dali.broadcast_addr, 3);
+    for (int addr = 0; addr < num_gear; addr++) {
+        SimGear *gear = f.at(addr);
+        ok &= gear && gear->scenes[3] == 130 + addr &&
+              gear->actual_level == 130 + addr;
+    }
+    results.push_back(groups.finish("groups_scenes", ok));
+
+    // A second group for every light through the bulk table
+    Timing table(f);
+    DALIGroupTable layout;
+    for (int addr = 0; addr < num_gear; addr++) {
+        layout.groups[addr] = (1 << (addr % 16)) | (1 << ((addr / 4 + 8) % 16));
+    }
+    ok = f.dali.set_groups(layout, layout) == 0;
+    for (int addr = 0; addr < num_gear; addr++) {
+        SimGear *gear = f.at(addr);
+        ok &= gear && gear->groups == layout.groups[addr] &&
+              ((layout.members[addr % 16] >> addr) & 1);
+    }
+    results.push_back(table.finish("group_table", ok));
+
+    // Fault sweeps on a healthy bus, which has had arc power commands, and
+    // with two failed lamps
+    DALIFaults faults;
+    Timing healthy(f);
+    f.dali.find_faults(faults, &layout);
+    ok = faults.lamp_failure == 0 && faults.power_failure == 0;
+    results.push_back(healthy.finish("fault_sweep", ok));
+
+    Timing healthy_power(f);
+    f.dali.find_faults(faults, &layout, true);
+    ok = faults.lamp_failure == 0 && faults.power_failure == 0;
+    results.push_back(healthy_power.finish("fault_sweep_power", ok));
+
+    Timing locate(f);
+    uint64_t failed = 1 | ((uint64_t)1 << (num_gear / 2));
+    f.at(0)->lamp_failure = true;
+    f.at(num_gear / 2)->lamp_failure = true;
+    f.dali.find_faults(faults, &layout);
+    ok = faults.lamp_failure == failed;
+    f.at(0)->lamp_failure = false;
+    f.at(num_gear / 2)->lamp_failure = false;
+    results.push_back(locate.finish("fault_locate", ok));
+
+    // Every light through the sweep, each with the control it has
+    Timing sweep(f);
+    for (int step = 0; step < SWEEP_STEPS; step++) {
+        uint16_t kelvin = 2700 + step * 500;
+        // 255 is MASK, which leaves a channel as it is
+        uint8_t level = step * 254 / (SWEEP_STEPS - 1);
+        for (int addr = 0; addr < num_gear; addr++) {
+            SimGear *gear = f.at(addr);
+            if (gear && gear->colour_features == FEATURES_TC) {
+                f.dali.set_color(addr, kelvin);
+            } else {
+                f.dali.set_color(addr, level, 254 - level, level / 2);
+            }
+        }
+    }
+    wait_ms(40);
+    ok = true;
+    uint8_t level = 254;
+    uint16_t mirek = 1000000 / (2700 + (SWEEP_STEPS - 1) * 500);
+    for (int addr = 0; addr < num_gear; addr++) {
+        SimGear *gear = f.at(addr);
+        if (!gear) {
+            ok = false;
+        } else if (gear->colour_features == FEATURES_TC) {
+            ok &= gear->colour_tc == mirek;
+        } else {
+            ok &= gear->rgbwaf[0] == level && gear->rgbwaf[1] == 0 &&
+                  gear->rgbwaf[2] == level / 2;
+        }
+    }
+    results.push_back(sweep.finish("colour_sweep", ok));
+
+    results.push_back(redeploy(f, num_gear, false));
+    results.push_back(redeploy(f, num_gear, true));
+    results.push_back(commands(f, num_gear, BUS_PRIORITY_DEFAULT));
+    results.push_back(commands(f, num_gear, BUS_PRIORITY_MIN));
+
+    Timing poll(f);
+    ok = poll_levels(f, num_gear);
+    results.push_back(poll.finish("poll_levels", ok));
+
+    DALIShadow shadow;
+    f.dali.set_shadow(&shadow);
+    Timing cached(f);
+    ok = poll_levels(f, num_gear);
+    results.push_back(cached.finish("poll_levels_shadow", ok));
+    f.dali.set_shadow(NULL);
+
+    results.push_back(slider(f, num_gear));
+    results.push_back(health(f, num_gear));
+    results.push_back(live_events(f, num_gear));
+}
+
+static void print_table(const std::vector<Result> &results)
+{
+    printf("%-24s %4s %6s %4s %8s %8s %5s %8s %9s %9s %7s\n", "benchmark",
+           "gear", "inputs", "ok", "forward", "backward", "bad", "fwd/unit",
+           "bus s", "cpu ms", "lag ms");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        printf("%-24s %4d %6d %4s %8lu %8lu %5lu %8.1f %9.2f %9.1f %7.1f\n",
+               r.name, r.gear, r.inputs, r.ok ? "yes" : "NO",
+               (unsigned long)r.forward_frames,
+               (unsigned long)r.backward_frames, (unsigned long)r.bad_frames,
+               r.per_unit, r.bus_s, r.cpu_ms, r.lag_ms);
+    }
+}
+
+static void print_json(const std::vector<Result> &results, uint32_t seed)
+{
+    printf("{\n  \"seed\": %lu,\n  \"results\": [\n", (unsigned long)seed);
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &r = results[i];
+        printf("    {\"benchmark\": \"%s\", \"gear\": %d, \"inputs\": %d, "
+               "\"ok\": %s, \"forward_frames\": %lu, \"backward_frames\": "
+               "%lu, \"bad_frames\": %lu, \"forward_per_unit\": %.3f, "
+               "\"bus_s\": %.6f, \"cpu_ms\": %.3f, \"lag_ms\": %.3f}%s\n",
+               r.name, r.gear, r.inputs, r.ok ? "true" : "false",
+               (unsigned long)r.forward_frames,
+               (unsigned long)r.backward_frames, (unsigned long)r.bad_frames,
+               r.per_unit, r.bus_s, r.cpu_ms, r.lag_ms,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool json = false;
+    int num_inputs = DEFAULT_INPUTS;
+    uint32_t seed = DEFAULT_SEED;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!strcmp(argv[i], "--inputs") && i + 1 < argc) {
+            num_inputs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: %s [--json] [--inputs N] [--seed N]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector<Result> results;
+    for (size_t i = 0; i < sizeof(bus_sizes) / sizeof(bus_sizes[0]); i++) {
+        int num_gear = bus_sizes[i];
+        // 64 short addresses for gear and input devices together
+        int inputs = num_inputs < DALI_MAP_UNITS - num_gear
+                         ? num_inputs
+                         : DALI_MAP_UNITS - num_gear;
+        run_init(num_gear, inputs, seed, results);
+        run_collisions(num_gear, inputs, seed, results);
+        run_search_bytes(num_gear, inputs, seed, results);
+        run_commission(num_gear, inputs, seed, results);
+        run_steps(num_gear, inputs, seed, results);
+        run_lines(num_gear, inputs, seed, results);
+    }
+
+    if (json) {
+        print_json(results, seed);
+    } else {
+        print_table(results);
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        if (!results[i].ok) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Commission a full bus of simulated units and report bus time */
+
+#include "DALIDriver.h"
+#include "mbed.h"
+#include "sim_bus.h"
+#include "sim_gear.h"
+#include "sim_input_device.h"
+
+#define TX_PIN 1
+#define RX_PIN 2
+#define NUM_GEAR 56
+#define NUM_DEVICES 8
+
+static void report(const char *what, SimBus &bus, uint64_t start_us)
+{
+    const SimBusStats &stats = bus.stats();
+    printf("%-12s %8.2f s bus time, %5lu forward, %5lu backward, %3lu bad "
+           "frames, %5.1f%% busy\n",
+           what, (SimClock::instance().now() - start_us) / 1e6,
+           (unsigned long)stats.forward_frames,
+           (unsigned long)stats.backward_frames,
+           (unsigned long)stats.bad_frames,
+           100.0 * stats.busy_us / (SimClock::instance().now() - start_us));
+    bus.reset_stats();
+}
+
+static void report_driver(DALIDriver &dali)
+{
+    static const char *const names[DALI_NUM_FRAME_CLASSES] = {
+        "special", "standard", "direct", "input", "send twice"};
+    const DALIStats &stats = dali.get_stats();
+    printf("  %-10s %6s %6s %6s %6s %9s %9s\n", "class", "frames", "replies",
+           "none", "errors", "wire ms", "wait ms");
+    for (int i = 0; i < DALI_NUM_FRAME_CLASSES; i++) {
+        const DALIClassStats &c = stats.classes[i];
+        printf("  %-10s %6lu %6lu %6lu %6lu %9.1f %9.1f\n", names[i],
+               (unsigned long)c.frames, (unsigned long)c.replies,
+               (unsigned long)c.timeouts, (unsigned long)c.errors,
+               c.wire_us / 1e3, c.wait_us / 1e3);
+    }
+    printf("  query latency p50 %.1f ms, p99 %.1f ms\n",
+           dali_latency_percentile(stats, 50) / 1e3,
+           dali_latency_percentile(stats, 99) / 1e3);
+    dali.reset_stats();
+}
+
+int main()
+{
+    SimBus bus(TX_PIN, RX_PIN);
+    bus.seed(42);
+    bus.set_reply_delay(7000, 1500);
+    bus.set_edge_jitter(20);
+
+    SimGear gear[NUM_GEAR];
+    SimInputDevice devices[NUM_DEVICES];
+    for (int i = 0; i < NUM_GEAR; i++) {
+        bus.add(&gear[i]);
+    }
+    for (int i = 0; i < NUM_DEVICES; i++) {
+        devices[i].add_instance(SIM_INSTANCE_OCCUPANCY);
+        devices[i].add_instance(SIM_INSTANCE_LIGHT, 2);
+        bus.add(&devices[i]);
+    }
+
+    DALIDriver dali(TX_PIN, RX_PIN);
+    uint64_t start = SimClock::instance().now();
+    int units = dali.init();
+    printf("init found %d lights and %d input devices (%d expected)\n",
+           dali.get_num_lights(), dali.get_num_inputs(), units);
+    report("init", bus, start);
+    report_driver(dali);
+
+    start = SimClock::instance().now();
+    SimGear added;
+    bus.add(&added);
+    int num_added = dali.add_new_units();
+    printf("add_new_units gave %d address(es), new unit at %d\n", num_added,
+           added.short_addr);
+    report("hot add", bus, start);
+    report_driver(dali);
+
+    start = SimClock::instance().now();
+    dali.set_level(dali.broadcast_addr, 100);
+    int level = dali.get_level(0);
+    printf("level of unit 0 is %d, gear[0] holds %d\n", level,
+           gear[0].actual_level);
+    report("set/get", bus, start);
+    report_driver(dali);
+    return 0;
+}
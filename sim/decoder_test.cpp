@@ -0,0 +1,231 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of manchester_decode() at the tolerance ManchesterEncoder uses
+ *
+ * Frames are built as edge timestamps the way the receive interrupt captures
+ * them, no bus or clock involved. Exits with the number of failed checks.
+ */
+
+#include "manchester/decoder.h"
+#include <stdio.h>
+#include <vector>
+
+// 1200 baud, and the tolerance of ManchesterEncoder::decode_frame()
+#define HALF_BIT_US 416
+#define TOLERANCE_US (HALF_BIT_US / 5)
+// Capture time of the first edge, close to the wrap of the microsecond timer
+#define START_US 0xFFFFF000UL
+
+typedef std::vector<ManchesterEdge> Edges;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);   \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+// Level of every half bit of a frame: the start bit, then each bit MSb first
+// with the active half first for a one
+static std::vector<int> halves_of(uint32_t data, int num_bits)
+{
+    std::vector<int> halves;
+    halves.push_back(1);
+    halves.push_back(0);
+    for (int i = num_bits - 1; i >= 0; i--) {
+        int bit = (data >> i) & 1;
+        halves.push_back(bit);
+        halves.push_back(!bit);
+    }
+    return halves;
+}
+
+/** Edges of a frame
+ *
+ *   @param deviation_us    Added to every interval per half bit it spans, so
+ * a full bit interval moves twice as much as a half bit one
+ */
+static Edges edges_of(const std::vector<int> &halves, int deviation_us = 0)
+{
+    Edges edges;
+    int level = 0;
+    uint32_t time = START_US;
+    int span = 0;
+    for (size_t i = 0; i <= halves.size(); i++) {
+        // The line idles after the frame
+        int next = i < halves.size() ? halves[i] : 0;
+        if (next != level) {
+            time += span * (HALF_BIT_US + deviation_us);
+            ManchesterEdge edge = {time, (uint8_t)next};
+            edges.push_back(edge);
+            level = next;
+            span = 0;
+        }
+        span++;
+    }
+    return edges;
+}
+
+static ManchesterDecodeStatus decode(const Edges &edges, uint32_t *data,
+                                     uint8_t *num_bits)
+{
+    return manchester_decode(edges.data(), edges.size(), HALF_BIT_US,
+                             TOLERANCE_US, data, num_bits);
+}
+
+static void check_frame(uint32_t data, int num_bits, int deviation_us,
+                        ManchesterDecodeStatus expected)
+{
+    uint32_t got = 0;
+    uint8_t bits = 0;
+    ManchesterDecodeStatus status =
+        decode(edges_of(halves_of(data, num_bits), deviation_us), &got, &bits);
+    CHECK(status == expected);
+    if (status == expected && expected == MANCHESTER_OK) {
+        CHECK(got == data);
+        CHECK(bits == num_bits);
+    }
+}
+
+// 8, 16 and 24 bit frames with nominal timing, including all-zero and
+// all-one frames, which only have half bit and only full bit intervals
+static void test_lengths()
+{
+    const uint32_t patterns[] = {0x000000, 0xFFFFFF, 0xA5A5A5, 0x5A5A5A,
+                                 0x123456, 0x800001};
+    const int lengths[] = {8, 16, 24};
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        uint32_t mask = ((uint32_t)1 << lengths[l]) - 1;
+        for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+            check_frame(patterns[p] & mask, lengths[l], 0, MANCHESTER_OK);
+        }
+    }
+}
+
+// Intervals are accepted up to the tolerance and rejected just past it
+static void test_jitter()
+{
+    const uint32_t patterns[] = {0xFF, 0x00, 0xA5};
+    for (size_t p = 0; p < sizeof(patterns) / sizeof(patterns[0]); p++) {
+        check_frame(patterns[p], 8, TOLERANCE_US, MANCHESTER_OK);
+        check_frame(patterns[p], 8, -TOLERANCE_US, MANCHESTER_OK);
+        check_frame(patterns[p], 8, TOLERANCE_US + 1,
+                    MANCHESTER_TIMING_ERROR);
+        check_frame(patterns[p], 8, -TOLERANCE_US - 1,
+                    MANCHESTER_TIMING_ERROR);
+    }
+    // One late edge in an otherwise nominal frame
+    Edges edges = edges_of(halves_of(0xA5, 8));
+    uint32_t data;
+    uint8_t num_bits;
+    edges[3].time_us += TOLERANCE_US;
+    CHECK(decode(edges, &data, &num_bits) == MANCHESTER_OK && data == 0xA5);
+    edges[3].time_us += 1;
+    CHECK(decode(edges, &data, &num_bits) == MANCHESTER_TIMING_ERROR);
+}
+
+// Edges the receiver missed
+static void test_missing_edges()
+{
+    Edges frame = edges_of(halves_of(0x3C, 8));
+    uint32_t data;
+    uint8_t num_bits;
+    for (size_t i = 1; i + 1 < frame.size(); i++) {
+        // Two edges of the same level in a row
+        Edges edges = frame;
+        edges.erase(edges.begin() + i);
+        CHECK(decode(edges, &data, &num_bits) == MANCHESTER_TIMING_ERROR);
+        if (i + 2 < frame.size()) {
+            // Two edges gone leave an interval of three or four half bits
+            edges = frame;
+            edges.erase(edges.begin() + i, edges.begin() + i + 2);
+            CHECK(decode(edges, &data, &num_bits) != MANCHESTER_OK);
+        }
+    }
+    // Losing the last two edges leaves a valid frame, one bit shorter
+    Edges tail(frame.begin(), frame.end() - 2);
+    CHECK(decode(tail, &data, &num_bits) == MANCHESTER_OK && num_bits == 7);
+    // No stop edge, the line was left active
+    Edges edges = frame;
+    edges.pop_back();
+    CHECK(decode(edges, &data, &num_bits) == MANCHESTER_TIMING_ERROR);
+    // No start bit
+    edges = frame;
+    edges.erase(edges.begin());
+    CHECK(decode(edges, &data, &num_bits) == MANCHESTER_NO_FRAME);
+    CHECK(decode(Edges(frame.begin(), frame.begin() + 1), &data, &num_bits) ==
+          MANCHESTER_NO_FRAME);
+}
+
+// The bus is active while any unit drives it
+static Edges overlap(uint32_t a, uint32_t b, int offset_us)
+{
+    std::vector<int> ha = halves_of(a, 8);
+    std::vector<int> hb = halves_of(b, 8);
+    // Sample both waveforms every microsecond
+    int length = (ha.size() + 1) * HALF_BIT_US + offset_us;
+    Edges edges;
+    int level = 0;
+    for (int t = 0; t <= length; t++) {
+        int ia = t / HALF_BIT_US;
+        int ib = (t - offset_us) / HALF_BIT_US;
+        int la = ia < (int)ha.size() ? ha[ia] : 0;
+        int lb = t >= offset_us && ib < (int)hb.size() ? hb[ib] : 0;
+        int next = la || lb;
+        if (next != level) {
+            ManchesterEdge edge = {(uint32_t)(START_US + t), (uint8_t)next};
+            edges.push_back(edge);
+            level = next;
+        }
+    }
+    return edges;
+}
+
+// Several units answering a query at once
+static void test_overlapping_backward_frames()
+{
+    uint32_t data;
+    uint8_t num_bits;
+    // The same answer with the units a little apart still decodes, which is
+    // what yes/no queries rely on
+    CHECK(decode(overlap(0xFF, 0xFF, 0), &data, &num_bits) == MANCHESTER_OK &&
+          data == 0xFF && num_bits == 8);
+    CHECK(decode(overlap(0xFF, 0xFF, TOLERANCE_US / 2), &data, &num_bits) ==
+          MANCHESTER_OK);
+    CHECK(data == 0xFF && num_bits == 8);
+    // Different answers never decode as either of them
+    const uint32_t answers[][2] = {{0xFF, 0x00}, {0x12, 0x34}, {0xA5, 0x5A}};
+    for (size_t i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+        for (int offset = 0; offset <= HALF_BIT_US; offset += 50) {
+            CHECK(decode(overlap(answers[i][0], answers[i][1], offset), &data,
+                         &num_bits) != MANCHESTER_OK);
+        }
+    }
+}
+
+int main()
+{
+    test_lengths();
+    test_jitter();
+    test_missing_edges();
+    test_overlapping_backward_frames();
+    printf("decoder_test: %d failed\n", failures);
+    return failures;
+}
@@ -0,0 +1,349 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Host stand-in for the parts of Mbed OS the driver uses
+ *
+ * Everything runs on SimClock: waits advance virtual time, and timers and
+ * pin interrupts run as clock events from inside the wait, so a run is
+ * deterministic. Threads take turns, see sim_thread.h. Pins are connected
+ * to a SimBus by their PinName.
+ */
+#ifndef SIM_MBED_H
+#define SIM_MBED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+#include <vector>
+
+#include "sim_clock.h"
+
+typedef int PinName;
+#define NC ((PinName)-1)
+
+enum PinMode { PullNone, PullUp, PullDown };
+
+#define osWaitForever 0xFFFFFFFFU
+#define osFlagsError 0x80000000U
+#define osFlagsErrorTimeout 0xFFFFFFFEU
+#define osFlagsErrorResource 0xFFFFFFFDU
+
+typedef int32_t osStatus;
+#define osOK 0
+#define osErrorResource (-4)
+
+enum osPriority {
+    osPriorityLow = 8,
+    osPriorityBelowNormal = 16,
+    osPriorityNormal = 24,
+    osPriorityAboveNormal = 32,
+    osPriorityHigh = 40,
+    osPriorityRealtime = 48
+};
+
+#define OS_STACK_SIZE 4096
+
+#define MBED_ASSERT(expr)                                                      \
+    do {                                                                       \
+        if (!(expr)) {                                                         \
+            fprintf(stderr, "assert failed: %s\n", #expr);                    \
+        }                                                                      \
+    } while (0)
+
+namespace mbed {
+
+template <typename F> class Callback;
+
+template <typename R, typename... A> class Callback<R(A...)> {
+public:
+    Callback()
+    {
+    }
+
+    Callback(R (*func)(A...))
+    {
+        if (func) {
+            _func = func;
+        }
+    }
+
+    template <typename T> Callback(T *obj, R (T::*method)(A...))
+    {
+        _func = [obj, method](A... args) { return (obj->*method)(args...); };
+    }
+
+    R operator()(A... args) const
+    {
+        return _func(args...);
+    }
+
+    R call(A... args) const
+    {
+        return _func(args...);
+    }
+
+    operator bool() const
+    {
+        return (bool)_func;
+    }
+
+private:
+    std::function<R(A...)> _func;
+};
+
+template <typename R, typename... A>
+Callback<R(A...)> callback(R (*func)(A...))
+{
+    return Callback<R(A...)>(func);
+}
+
+template <typename T, typename R, typename... A>
+Callback<R(A...)> callback(T *obj, R (T::*method)(A...))
+{
+    return Callback<R(A...)>(obj, method);
+}
+
+class DigitalOut {
+public:
+    DigitalOut(PinName pin);
+    DigitalOut(PinName pin, int value);
+
+    void write(int value);
+
+    int read()
+    {
+        return _value;
+    }
+
+    DigitalOut &operator=(int value)
+    {
+        write(value);
+        return *this;
+    }
+
+    operator int()
+    {
+        return _value;
+    }
+
+private:
+    PinName _pin;
+    int _value;
+};
+
+class InterruptIn {
+public:
+    InterruptIn(PinName pin, PinMode mode = PullNone);
+    ~InterruptIn();
+
+    int read();
+
+    operator int()
+    {
+        return read();
+    }
+
+    void rise(Callback<void()> func)
+    {
+        _rise = func;
+    }
+
+    void fall(Callback<void()> func)
+    {
+        _fall = func;
+    }
+
+    // Called by the simulated bus when the level on the pin changes
+    void edge(int level);
+
+    PinName pin() const
+    {
+        return _pin;
+    }
+
+    // Pins created so far, for the bus to find its receivers
+    static std::vector<InterruptIn *> &all();
+
+private:
+    PinName _pin;
+    Callback<void()> _rise;
+    Callback<void()> _fall;
+};
+
+class Timeout {
+public:
+    Timeout();
+    ~Timeout();
+
+    void attach_us(Callback<void()> func, uint64_t delay_us);
+
+    void attach(Callback<void()> func, float delay_s)
+    {
+        attach_us(func, (uint64_t)(delay_s * 1000000.0f));
+    }
+
+    void detach();
+
+private:
+    SimClock::EventId _id;
+};
+
+class Ticker {
+public:
+    Ticker();
+    ~Ticker();
+
+    void attach_us(Callback<void()> func, uint64_t period_us);
+
+    void attach(Callback<void()> func, float period_s)
+    {
+        attach_us(func, (uint64_t)(period_s * 1000000.0f));
+    }
+
+    void detach();
+
+private:
+    void fire();
+
+    SimClock::EventId _id;
+    uint64_t _period;
+    uint64_t _next;
+    Callback<void()> _func;
+};
+
+class Timer {
+public:
+    Timer();
+
+    void start();
+    void stop();
+    void reset();
+    int read_us();
+    int read_ms();
+    float read();
+
+private:
+    bool _running;
+    uint64_t _start;
+    uint64_t _elapsed;
+};
+
+} // namespace mbed
+
+struct SimThreadState;
+
+namespace rtos {
+
+/** Thread on the virtual clock, see sim_thread.h
+ *
+ * Threads take turns: one runs until it waits. Priorities are ignored.
+ */
+class Thread {
+public:
+    Thread(osPriority priority = osPriorityNormal,
+           uint32_t stack_size = OS_STACK_SIZE, unsigned char *stack_mem = NULL,
+           const char *name = NULL);
+    ~Thread();
+
+    osStatus start(mbed::Callback<void()> task);
+    osStatus join();
+    osStatus terminate();
+    osStatus set_priority(osPriority priority);
+
+    static osStatus wait(uint32_t millisec);
+
+private:
+    SimThreadState *_state;
+};
+
+class EventFlags {
+public:
+    EventFlags();
+
+    uint32_t set(uint32_t flags);
+    uint32_t clear(uint32_t flags = 0x7fffffff);
+    uint32_t get() const;
+    uint32_t wait_all(uint32_t flags, uint32_t millisec = osWaitForever,
+                      bool clear = true);
+    uint32_t wait_any(uint32_t flags, uint32_t millisec = osWaitForever,
+                      bool clear = true);
+
+private:
+    uint32_t wait(uint32_t flags, uint32_t millisec, bool clear, bool all);
+
+    uint32_t _flags;
+};
+
+} // namespace rtos
+
+namespace events {
+
+class EventQueue {
+public:
+    EventQueue(unsigned size = 0, unsigned char *buffer = NULL);
+
+    template <typename T, typename R> int call(T *obj, R (T::*method)())
+    {
+        _pending.push_back([obj, method]() { (obj->*method)(); });
+        return (int)++_next_id;
+    }
+
+    template <typename F> int call(F func)
+    {
+        _pending.push_back(func);
+        return (int)++_next_id;
+    }
+
+    /** Run queued calls for ms of virtual time, -1 until nothing is left
+     * to run and no clock event is pending
+     */
+    void dispatch(int ms = -1);
+
+    void dispatch_forever()
+    {
+        dispatch(-1);
+    }
+
+private:
+    bool run_pending();
+
+    std::vector<std::function<void()> > _pending;
+    unsigned _next_id;
+};
+
+} // namespace events
+
+using namespace mbed;
+using namespace rtos;
+using namespace events;
+
+void wait_us(int us);
+void wait_ms(int ms);
+void wait(float s);
+uint32_t us_ticker_read();
+
+// Interrupts are clock events, nothing preempts the code under test
+inline void core_util_critical_section_enter()
+{
+}
+
+inline void core_util_critical_section_exit()
+{
+}
+
+#endif
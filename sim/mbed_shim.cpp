@@ -0,0 +1,358 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "mbed.h"
+#include "sim_bus.h"
+#include "sim_thread.h"
+#include <algorithm>
+
+namespace mbed {
+
+DigitalOut::DigitalOut(PinName pin) : _pin(pin), _value(0)
+{
+}
+
+DigitalOut::DigitalOut(PinName pin, int value) : _pin(pin), _value(0)
+{
+    write(value);
+}
+
+void DigitalOut::write(int value)
+{
+    _value = value ? 1 : 0;
+    SimBus *bus = SimBus::find(_pin);
+    if (bus) {
+        bus->controller_write(_value);
+    }
+}
+
+InterruptIn::InterruptIn(PinName pin, PinMode mode) : _pin(pin)
+{
+    all().push_back(this);
+}
+
+InterruptIn::~InterruptIn()
+{
+    std::vector<InterruptIn *> &pins = all();
+    pins.erase(std::remove(pins.begin(), pins.end(), this), pins.end());
+}
+
+std::vector<InterruptIn *> &InterruptIn::all()
+{
+    static std::vector<InterruptIn *> pins;
+    return pins;
+}
+
+int InterruptIn::read()
+{
+    SimBus *bus = SimBus::find(_pin);
+    return bus ? bus->controller_read() : 0;
+}
+
+void InterruptIn::edge(int level)
+{
+    if (level && _rise) {
+        _rise();
+    } else if (!level && _fall) {
+        _fall();
+    }
+}
+
+Timeout::Timeout() : _id(0)
+{
+}
+
+Timeout::~Timeout()
+{
+    detach();
+}
+
+void Timeout::attach_us(Callback<void()> func, uint64_t delay_us)
+{
+    detach();
+    _id = SimClock::instance().schedule_in(delay_us, [this, func]() {
+        _id = 0;
+        func();
+    });
+}
+
+void Timeout::detach()
+{
+    SimClock::instance().cancel(_id);
+    _id = 0;
+}
+
+Ticker::Ticker() : _id(0), _period(0), _next(0)
+{
+}
+
+Ticker::~Ticker()
+{
+    detach();
+}
+
+void Ticker::attach_us(Callback<void()> func, uint64_t period_us)
+{
+    detach();
+    _func = func;
+    _period = period_us;
+    _next = SimClock::instance().now() + period_us;
+    _id = SimClock::instance().schedule(_next, [this]() { fire(); });
+}
+
+void Ticker::detach()
+{
+    SimClock::instance().cancel(_id);
+    _id = 0;
+}
+
+void Ticker::fire()
+{
+    // Reschedule first, the callback may detach
+    _next += _period;
+    _id = SimClock::instance().schedule(_next, [this]() { fire(); });
+    _func();
+}
+
+Timer::Timer() : _running(false), _start(0), _elapsed(0)
+{
+}
+
+void Timer::start()
+{
+    if (!_running) {
+        _start = SimClock::instance().now();
+        _running = true;
+    }
+}
+
+void Timer::stop()
+{
+    if (_running) {
+        _elapsed += SimClock::instance().now() - _start;
+        _running = false;
+    }
+}
+
+void Timer::reset()
+{
+    _start = SimClock::instance().now();
+    _elapsed = 0;
+}
+
+int Timer::read_us()
+{
+    uint64_t total = _elapsed;
+    if (_running) {
+        total += SimClock::instance().now() - _start;
+    }
+    return (int)total;
+}
+
+int Timer::read_ms()
+{
+    return read_us() / 1000;
+}
+
+float Timer::read()
+{
+    return read_us() / 1000000.0f;
+}
+
+} // namespace mbed
+
+namespace rtos {
+
+EventFlags::EventFlags() : _flags(0)
+{
+}
+
+uint32_t EventFlags::set(uint32_t flags)
+{
+    _flags |= flags;
+    sim::wake(this);
+    return _flags;
+}
+
+uint32_t EventFlags::clear(uint32_t flags)
+{
+    uint32_t old = _flags;
+    _flags &= ~flags;
+    return old;
+}
+
+uint32_t EventFlags::get() const
+{
+    return _flags;
+}
+
+uint32_t EventFlags::wait_all(uint32_t flags, uint32_t millisec, bool clear)
+{
+    return wait(flags, millisec, clear, true);
+}
+
+uint32_t EventFlags::wait_any(uint32_t flags, uint32_t millisec, bool clear)
+{
+    return wait(flags, millisec, clear, false);
+}
+
+uint32_t EventFlags::wait(uint32_t flags, uint32_t millisec, bool clear,
+                          bool all)
+{
+    SimClock &clock = SimClock::instance();
+    bool forever = millisec == osWaitForever;
+    uint64_t deadline = forever ? UINT64_MAX : clock.now() + millisec * 1000ULL;
+    while (true) {
+        uint32_t match = _flags & flags;
+        if (all ? match == flags : match != 0) {
+            uint32_t result = _flags;
+            if (clear) {
+                _flags &= ~flags;
+            }
+            return result;
+        }
+        if (sim::in_thread()) {
+            // Let the main thread run the clock until the flags are set
+            if (clock.now() >= deadline) {
+                return osFlagsErrorTimeout;
+            }
+            sim::block(this, deadline);
+            continue;
+        }
+        if (!clock.run_next(deadline)) {
+            if (forever) {
+                // Nothing left that could ever set the flags
+                return osFlagsErrorResource;
+            }
+            clock.advance_to(deadline);
+            return osFlagsErrorTimeout;
+        }
+    }
+}
+
+Thread::Thread(osPriority priority, uint32_t stack_size,
+               unsigned char *stack_mem, const char *name)
+    : _state(NULL)
+{
+}
+
+Thread::~Thread()
+{
+    if (_state) {
+        sim::thread_destroy(_state);
+    }
+}
+
+osStatus Thread::start(mbed::Callback<void()> task)
+{
+    if (_state) {
+        return osErrorResource;
+    }
+    _state = sim::thread_create([task]() { task(); });
+    return osOK;
+}
+
+osStatus Thread::join()
+{
+    if (_state) {
+        sim::thread_join(_state);
+    }
+    return osOK;
+}
+
+osStatus Thread::terminate()
+{
+    if (_state) {
+        sim::thread_terminate(_state);
+    }
+    return osOK;
+}
+
+osStatus Thread::set_priority(osPriority priority)
+{
+    return osOK;
+}
+
+osStatus Thread::wait(uint32_t millisec)
+{
+    wait_us(millisec * 1000);
+    return osOK;
+}
+
+} // namespace rtos
+
+namespace events {
+
+EventQueue::EventQueue(unsigned size, unsigned char *buffer) : _next_id(0)
+{
+}
+
+bool EventQueue::run_pending()
+{
+    if (_pending.empty()) {
+        return false;
+    }
+    std::vector<std::function<void()> > calls;
+    calls.swap(_pending);
+    for (size_t i = 0; i < calls.size(); i++) {
+        calls[i]();
+    }
+    return true;
+}
+
+void EventQueue::dispatch(int ms)
+{
+    SimClock &clock = SimClock::instance();
+    uint64_t deadline = ms < 0 ? UINT64_MAX : clock.now() + ms * 1000ULL;
+    while (run_pending() || clock.run_next(deadline)) {
+    }
+    if (ms >= 0) {
+        clock.advance_to(deadline);
+    }
+}
+
+} // namespace events
+
+// Threads give up control while they wait, the main thread runs the clock
+static void wait_for(uint64_t delay_us)
+{
+    SimClock &clock = SimClock::instance();
+    if (sim::in_thread()) {
+        sim::block(NULL, clock.now() + delay_us);
+    } else {
+        clock.advance(delay_us);
+    }
+}
+
+void wait_us(int us)
+{
+    wait_for(us);
+}
+
+void wait_ms(int ms)
+{
+    wait_for(ms * 1000ULL);
+}
+
+void wait(float s)
+{
+    wait_for((uint64_t)(s * 1000000.0f));
+}
+
+uint32_t us_ticker_read()
+{
+    return (uint32_t)SimClock::instance().now();
+}
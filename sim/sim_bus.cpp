@@ -0,0 +1,352 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_bus.h"
+#include "sim_unit.h"
+#include <algorithm>
+
+// Source numbers of the controller and of the glitch injector
+#define SOURCE_CONTROLLER 0
+#define SOURCE_GLITCH 1
+// Settling time before an event frame, priority 4 of iec62386-101
+#define EVENT_SETTLE_US 17900
+// Time from a unit finding the bus free to its frame starting
+#define UNIT_START_US 100
+
+static std::vector<SimBus *> &buses()
+{
+    static std::vector<SimBus *> list;
+    return list;
+}
+
+SimBus::SimBus(PinName tx_pin, PinName rx_pin, int baud, bool idle_state)
+    : _tx_pin(tx_pin), _rx_pin(rx_pin), _idle_state(idle_state),
+      _half_bit(1000000 / (2 * baud)), _driving(2, false), _active_sources(0),
+      _frame_start(0), _last_edge(0), _frame_end(0), _frame_check_id(0), _free_at(0),
+      _reply_delay(7000), _reply_jitter(0), _edge_jitter(0),
+      _corrupt_next(false), _random(1), _trace(NULL)
+{
+    reset_stats();
+    buses().push_back(this);
+}
+
+SimBus::~SimBus()
+{
+    SimClock::instance().cancel(_frame_check_id);
+    for (size_t i = 0; i < _senders.size(); i++) {
+        SimClock::instance().cancel(_senders[i].next);
+    }
+    for (size_t i = 0; i < _units.size(); i++) {
+        _units[i]->_bus = NULL;
+    }
+    std::vector<SimBus *> &list = buses();
+    list.erase(std::remove(list.begin(), list.end(), this), list.end());
+}
+
+SimBus *SimBus::find(PinName pin)
+{
+    std::vector<SimBus *> &list = buses();
+    for (size_t i = 0; i < list.size(); i++) {
+        if (list[i]->_tx_pin == pin || list[i]->_rx_pin == pin) {
+            return list[i];
+        }
+    }
+    return NULL;
+}
+
+void SimBus::add(SimUnit *unit)
+{
+    if (unit->_bus) {
+        unit->_bus->remove(unit);
+    }
+    unit->_bus = this;
+    unit->_source = _driving.size();
+    _driving.push_back(false);
+    _units.push_back(unit);
+}
+
+void SimBus::remove(SimUnit *unit)
+{
+    std::vector<SimUnit *>::iterator it =
+        std::find(_units.begin(), _units.end(), unit);
+    if (it == _units.end()) {
+        return;
+    }
+    int sender = find_sender(unit);
+    if (sender >= 0) {
+        SimClock::instance().cancel(_senders[sender].next);
+        _senders.erase(_senders.begin() + sender);
+    }
+    // A unit unplugged mid frame releases the bus
+    drive(unit->_source, false);
+    _units.erase(it);
+    unit->_bus = NULL;
+}
+
+void SimBus::set_reply_delay(uint32_t delay_us, uint32_t jitter_us)
+{
+    _reply_delay = delay_us;
+    _reply_jitter = jitter_us;
+}
+
+void SimBus::set_edge_jitter(uint32_t jitter_us)
+{
+    _edge_jitter = jitter_us;
+}
+
+void SimBus::corrupt_next_reply()
+{
+    _corrupt_next = true;
+}
+
+void SimBus::seed(uint32_t seed)
+{
+    _random = seed ? seed : 1;
+}
+
+uint32_t SimBus::random()
+{
+    // xorshift32
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return _random;
+}
+
+int SimBus::jitter(uint32_t range)
+{
+    if (range == 0) {
+        return 0;
+    }
+    return (int)(random() % (2 * range + 1)) - (int)range;
+}
+
+void SimBus::reset_stats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+void SimBus::controller_write(int level)
+{
+    drive(SOURCE_CONTROLLER, (level != 0) != _idle_state);
+}
+
+int SimBus::controller_read()
+{
+    return active() ? 1 : 0;
+}
+
+void SimBus::drive(int source, bool on)
+{
+    if (_driving[source] == on) {
+        return;
+    }
+    bool was_active = active();
+    _driving[source] = on;
+    _active_sources += on ? 1 : -1;
+    if (active() == was_active) {
+        return;
+    }
+    SimClock &clock = SimClock::instance();
+    uint64_t now = clock.now();
+    if (_edges.empty()) {
+        _frame_start = now;
+    }
+    if (_edges.size() < MANCHESTER_MAX_EDGES) {
+        ManchesterEdge edge;
+        edge.time_us = (uint32_t)now;
+        edge.level = active() ? 1 : 0;
+        _edges.push_back(edge);
+    } else {
+        // Too long to be a frame, it fails to decode
+        _edges.back().level = 0xFF;
+    }
+    _last_edge = now;
+    // The controller's receiver sees every edge, its own included
+    std::vector<InterruptIn *> &pins = InterruptIn::all();
+    for (size_t i = 0; i < pins.size(); i++) {
+        if (pins[i]->pin() == _rx_pin) {
+            pins[i]->edge(active() ? 1 : 0);
+        }
+    }
+    // The frame ends after a stop condition of idle line
+    clock.cancel(_frame_check_id);
+    _frame_check_id = clock.schedule_in(
+        4 * _half_bit, std::bind(&SimBus::frame_check, this));
+}
+
+void SimBus::frame_check()
+{
+    _frame_check_id = 0;
+    if (active()) {
+        // Held active by colliding units, the frame is not over yet
+        _frame_check_id = SimClock::instance().schedule_in(
+            4 * _half_bit, std::bind(&SimBus::frame_check, this));
+        return;
+    }
+    uint64_t frame_end = _last_edge + _half_bit;
+    _stats.busy_us += frame_end - _frame_start;
+    uint32_t data = 0;
+    uint8_t num_bits = 0;
+    ManchesterDecodeStatus status =
+        manchester_decode(&_edges[0], _edges.size(), _half_bit, _half_bit / 4,
+                          &data, &num_bits);
+    _edges.clear();
+    if (_trace) {
+        if (status == MANCHESTER_OK) {
+            fprintf(_trace, "%10llu us %2d bits %06lX\n",
+                    (unsigned long long)_frame_start, num_bits,
+                    (unsigned long)data);
+        } else {
+            fprintf(_trace, "%10llu us bad frame\n",
+                    (unsigned long long)_frame_start);
+        }
+    }
+    _free_at = frame_end + EVENT_SETTLE_US;
+    if (status != MANCHESTER_OK) {
+        _stats.bad_frames++;
+        return;
+    }
+    if (num_bits == 8) {
+        _stats.backward_frames++;
+        return;
+    }
+    _stats.forward_frames++;
+    _frame_end = frame_end;
+    // Units may unplug themselves while handling the frame
+    std::vector<SimUnit *> units = _units;
+    for (size_t i = 0; i < units.size(); i++) {
+        units[i]->receive(data, num_bits);
+    }
+}
+
+void SimBus::send_backward(SimUnit *unit, uint8_t data)
+{
+    uint64_t start = _frame_end + _reply_delay;
+    start += jitter(_reply_jitter);
+    send_waveform(unit->_source, start, data, 8, true);
+    if (_corrupt_next) {
+        _corrupt_next = false;
+        // Fill a whole bit, one of its halves is always idle
+        SimClock &clock = SimClock::instance();
+        clock.schedule(start + 4 * _half_bit,
+                       std::bind(&SimBus::drive, this, SOURCE_GLITCH, true));
+        clock.schedule(start + 6 * _half_bit,
+                       std::bind(&SimBus::drive, this, SOURCE_GLITCH, false));
+    }
+}
+
+void SimBus::send_forward(SimUnit *unit, uint32_t data, uint8_t num_bits)
+{
+    SimClock &clock = SimClock::instance();
+    if (active() || !_edges.empty() || clock.now() < _free_at ||
+        find_sender(unit) >= 0) {
+        // Try again once the bus has settled
+        clock.schedule(std::max(_free_at, clock.now() + 4 * _half_bit),
+                       std::bind(&SimBus::send_forward, this, unit, data,
+                                 num_bits));
+        return;
+    }
+    Sender sender;
+    sender.unit = unit;
+    sender.data = data;
+    sender.num_bits = num_bits;
+    sender.half_bit = 0;
+    sender.sampling = false;
+    sender.start = clock.now() + UNIT_START_US;
+    sender.next = clock.schedule(
+        sender.start, std::bind(&SimBus::sender_step, this, unit));
+    _senders.push_back(sender);
+}
+
+int SimBus::find_sender(SimUnit *unit)
+{
+    for (size_t i = 0; i < _senders.size(); i++) {
+        if (_senders[i].unit == unit) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void SimBus::sender_step(SimUnit *unit)
+{
+    int index = find_sender(unit);
+    if (index < 0) {
+        return;
+    }
+    Sender &sender = _senders[index];
+    SimClock &clock = SimClock::instance();
+    if (sender.sampling) {
+        // Look at the bus in the middle of the half bit, like a receiver
+        sender.sampling = false;
+        if (active() && !_driving[unit->_source]) {
+            // Wait for the winning frame and the settling time after it
+            uint32_t data = sender.data;
+            uint8_t num_bits = sender.num_bits;
+            _senders.erase(_senders.begin() + index);
+            _stats.lost_frames++;
+            send_forward(unit, data, num_bits);
+            return;
+        }
+        uint64_t time = sender.start + sender.half_bit * _half_bit;
+        time += jitter(_edge_jitter);
+        sender.next = clock.schedule(
+            std::max(time, clock.now()),
+            std::bind(&SimBus::sender_step, this, unit));
+        return;
+    }
+    int num_half_bits = 2 * (1 + sender.num_bits);
+    if (sender.half_bit == num_half_bits) {
+        _senders.erase(_senders.begin() + index);
+        drive(unit->_source, false);
+        return;
+    }
+    // Start bit, then each bit MSb first, active half first for a one
+    int bit = sender.half_bit / 2 - 1;
+    bool level = bit < 0 ? true
+                         : (sender.data >> (sender.num_bits - 1 - bit)) & 1;
+    if (sender.half_bit & 1) {
+        level = !level;
+    }
+    sender.half_bit++;
+    sender.sampling = true;
+    sender.next = clock.schedule_in(
+        _half_bit / 2, std::bind(&SimBus::sender_step, this, unit));
+    drive(unit->_source, level);
+}
+
+void SimBus::send_waveform(int source, uint64_t start, uint32_t data,
+                           uint8_t num_bits, bool add_jitter)
+{
+    SimClock &clock = SimClock::instance();
+    // Start bit, then each bit MSb first, active half first for a one
+    int num_half_bits = 2 * (1 + num_bits);
+    for (int i = 0; i < num_half_bits; i++) {
+        int bit = i / 2 - 1;
+        bool level = bit < 0 ? true : (data >> (num_bits - 1 - bit)) & 1;
+        if (i & 1) {
+            level = !level;
+        }
+        uint64_t time = start + i * _half_bit;
+        if (add_jitter && i > 0) {
+            time += jitter(_edge_jitter);
+        }
+        clock.schedule(time, std::bind(&SimBus::drive, this, source, level));
+    }
+    clock.schedule(start + num_half_bits * _half_bit,
+                   std::bind(&SimBus::drive, this, source, false));
+}
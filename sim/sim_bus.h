@@ -0,0 +1,201 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_BUS_H
+#define SIM_BUS_H
+
+#include "manchester/decoder.h"
+#include "mbed.h"
+#include <vector>
+
+class SimUnit;
+
+// Bus traffic counters
+struct SimBusStats {
+    // Forward frames seen, from the controller and from input devices
+    uint32_t forward_frames;
+    // Backward frames seen
+    uint32_t backward_frames;
+    // Frames that did not decode, usually collisions
+    uint32_t bad_frames;
+    // Unit frames stopped because another transmitter won the bus
+    uint32_t lost_frames;
+    // Time from the first to the last edge of each frame, summed
+    uint64_t busy_us;
+};
+
+/** Simulated wired-AND DALI bus
+ *
+ * The bus is active (low on a real bus) while any unit or the controller
+ * drives it. The controller pins are the ones given to the ManchesterEncoder:
+ * the transmit pin is active when it differs from idle_state, and the receive
+ * pin reads 1 while the bus is active, the same as behind a transceiver.
+ *
+ * Frames on the bus are decoded with manchester_decode() and handed to every
+ * unit. Backward frames are sent by the units after the reply delay, and
+ * units answering together are ORed on the wire, so differing answers
+ * garble the frame like on a real bus.
+ *
+ * Units send event frames like an iec62386-101 transmitter: after the bus
+ * has settled for the event priority, and sampling the bus in the middle of
+ * each half bit. A unit that finds the bus active while it leaves it idle
+ * has lost, stops and tries again later.
+ */
+class SimBus {
+public:
+    /** Constructor
+     *
+     *   @param tx_pin      Controller transmit pin
+     *   @param rx_pin      Controller receive pin
+     *   @param baud        Bit rate
+     *   @param idle_state  Level of the transmit pin when the bus is idle
+     */
+    SimBus(PinName tx_pin, PinName rx_pin, int baud = 1200,
+           bool idle_state = 0);
+    ~SimBus();
+
+    /** Connect a unit to the bus
+     */
+    void add(SimUnit *unit);
+
+    /** Disconnect a unit from the bus
+     */
+    void remove(SimUnit *unit);
+
+    /** Set when units answer, from the end of the forward frame
+     *
+     *   @param delay_us    Nominal reply delay, 5500 - 10500 us is in spec
+     *   @param jitter_us   Each reply starts up to this much earlier or later
+     */
+    void set_reply_delay(uint32_t delay_us, uint32_t jitter_us = 0);
+
+    /** Move every edge a unit sends by up to jitter_us
+     */
+    void set_edge_jitter(uint32_t jitter_us);
+
+    /** Drive a glitch into the next backward frame, as a colliding unit
+     * would
+     */
+    void corrupt_next_reply();
+
+    /** Seed the random numbers used for jitter and random addresses
+     */
+    void seed(uint32_t seed);
+
+    /** Pseudo random number, deterministic for a given seed
+     */
+    uint32_t random();
+
+    /** Traffic so far
+     */
+    const SimBusStats &stats() const
+    {
+        return _stats;
+    }
+
+    void reset_stats();
+
+    /** Print every frame to out, NULL to stop
+     */
+    void trace(FILE *out)
+    {
+        _trace = out;
+    }
+
+    /** Check if anybody drives the bus
+     */
+    bool active() const
+    {
+        return _active_sources > 0;
+    }
+
+    int half_bit_us() const
+    {
+        return _half_bit;
+    }
+
+    /** Put a backward frame on the bus, after the reply delay
+     */
+    void send_backward(SimUnit *unit, uint8_t data);
+
+    /** Put a forward frame on the bus once it is free, for input device
+     * events
+     *
+     * The unit starts a little after it finds the bus free, so a frame
+     * starting meanwhile collides with it.
+     */
+    void send_forward(SimUnit *unit, uint32_t data, uint8_t num_bits);
+
+    /** Find the bus a controller pin is connected to
+     */
+    static SimBus *find(PinName pin);
+
+    // Called by the shim
+    void controller_write(int level);
+    int controller_read();
+
+private:
+    // A unit forward frame, put out a half bit at a time
+    struct Sender {
+        SimUnit *unit;
+        uint32_t data;
+        uint8_t num_bits;
+        // Half bits sent so far
+        int half_bit;
+        // The next step checks the bus rather than starting a half bit
+        bool sampling;
+        uint64_t start;
+        SimClock::EventId next;
+    };
+
+    // Drive the bus from a source, 0 is the controller and units count from 1
+    void drive(int source, bool active);
+    int find_sender(SimUnit *unit);
+    void sender_step(SimUnit *unit);
+    void frame_check();
+    void send_waveform(int source, uint64_t start, uint32_t data,
+                       uint8_t num_bits, bool jitter);
+    int jitter(uint32_t range);
+
+    PinName _tx_pin;
+    PinName _rx_pin;
+    bool _idle_state;
+    int _half_bit;
+    std::vector<SimUnit *> _units;
+    std::vector<bool> _driving;
+    int _active_sources;
+
+    // Edges of the frame on the bus, levels are 1 for active
+    std::vector<ManchesterEdge> _edges;
+    uint64_t _frame_start;
+    uint64_t _last_edge;
+    // End of the last forward frame, replies are timed from it
+    uint64_t _frame_end;
+    SimClock::EventId _frame_check_id;
+    // Earliest time the next unit frame may start
+    uint64_t _free_at;
+    std::vector<Sender> _senders;
+
+    uint32_t _reply_delay;
+    uint32_t _reply_jitter;
+    uint32_t _edge_jitter;
+    bool _corrupt_next;
+    uint32_t _random;
+    SimBusStats _stats;
+    FILE *_trace;
+};
+
+#endif
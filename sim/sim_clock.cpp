@@ -0,0 +1,81 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_clock.h"
+
+SimClock::SimClock() : _now(0), _next_id(1)
+{
+}
+
+SimClock &SimClock::instance()
+{
+    static SimClock clock;
+    return clock;
+}
+
+SimClock::EventId SimClock::schedule(uint64_t time_us,
+                                     const std::function<void()> &func)
+{
+    if (time_us < _now) {
+        time_us = _now;
+    }
+    Key key = {time_us, _next_id++};
+    _events[key] = func;
+    _times[key.id] = time_us;
+    return key.id;
+}
+
+void SimClock::cancel(EventId id)
+{
+    std::map<EventId, uint64_t>::iterator it = _times.find(id);
+    if (it == _times.end()) {
+        return;
+    }
+    Key key = {it->second, id};
+    _events.erase(key);
+    _times.erase(it);
+}
+
+bool SimClock::run_next(uint64_t deadline_us)
+{
+    if (_events.empty() || _events.begin()->first.time > deadline_us) {
+        return false;
+    }
+    // Take the event out first, it may schedule or cancel others
+    Key key = _events.begin()->first;
+    std::function<void()> func = _events.begin()->second;
+    _events.erase(_events.begin());
+    _times.erase(key.id);
+    _now = key.time;
+    func();
+    return true;
+}
+
+void SimClock::advance_to(uint64_t time_us)
+{
+    while (run_next(time_us)) {
+    }
+    if (time_us > _now) {
+        _now = time_us;
+    }
+}
+
+void SimClock::reset()
+{
+    _events.clear();
+    _times.clear();
+    _now = 0;
+}
@@ -0,0 +1,110 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_CLOCK_H
+#define SIM_CLOCK_H
+
+#include <stdint.h>
+#include <functional>
+#include <map>
+
+/** Deterministic virtual clock
+ *
+ * Time only moves when the code under test waits. Timers, tickers and bus
+ * waveforms are events on the clock, and they run in time order (then in
+ * the order they were scheduled) from inside the waiting call, the way
+ * interrupts would preempt it on target.
+ */
+class SimClock {
+public:
+    typedef uint64_t EventId;
+
+    /** The clock shared by the shim and the simulated bus
+     */
+    static SimClock &instance();
+
+    /** Current virtual time in microseconds
+     */
+    uint64_t now() const
+    {
+        return _now;
+    }
+
+    /** Run func at virtual time time_us
+     *
+     *   @returns    Id to cancel the event with
+     */
+    EventId schedule(uint64_t time_us, const std::function<void()> &func);
+
+    /** Run func delay_us from now
+     */
+    EventId schedule_in(uint64_t delay_us, const std::function<void()> &func)
+    {
+        return schedule(_now + delay_us, func);
+    }
+
+    /** Cancel an event that has not run yet, ids that already ran are ignored
+     */
+    void cancel(EventId id);
+
+    /** Run the next event if it is due at or before deadline_us
+     *
+     *   @returns    false if there is no such event, time is not moved then
+     */
+    bool run_next(uint64_t deadline_us);
+
+    /** Run every event up to time_us and move the clock there
+     */
+    void advance_to(uint64_t time_us);
+
+    /** Run every event in the next delay_us and move the clock past them
+     */
+    void advance(uint64_t delay_us)
+    {
+        advance_to(_now + delay_us);
+    }
+
+    /** Check if any event is scheduled
+     */
+    bool idle() const
+    {
+        return _events.empty();
+    }
+
+    /** Drop all events and go back to time zero
+     */
+    void reset();
+
+private:
+    SimClock();
+
+    struct Key {
+        uint64_t time;
+        EventId id;
+        bool operator<(const Key &other) const
+        {
+            return time != other.time ? time < other.time : id < other.id;
+        }
+    };
+
+    uint64_t _now;
+    EventId _next_id;
+    std::map<Key, std::function<void()> > _events;
+    // Time of each pending event, to find it from its id
+    std::map<EventId, uint64_t> _times;
+};
+
+#endif
@@ -0,0 +1,407 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_gear.h"
+#include <string.h>
+
+// No device type enabled
+#define DT_NONE 0xFF
+
+SimGear::SimGear(uint8_t device_type, uint8_t colour_features)
+    : device_type(device_type), actual_level(254), last_active_level(254),
+      min_level(1), max_level(254), phm(1), power_on_level(254),
+      fade_time(0), fade_rate(7), groups(0), lamp_failure(false),
+      gear_failure(false), power_cycle_seen(true),
+      colour_features(colour_features), colour_tc(250), temp_colour_tc(0xFFFF),
+      tc_coolest(153), tc_warmest(370), _enabled_device_type(DT_NONE),
+      _next_enabled_device_type(DT_NONE)
+{
+    memset(scenes, 0xFF, sizeof(scenes));
+    memset(rgbwaf, 0, sizeof(rgbwaf));
+    memset(temp_rgbwaf, 0xFF, sizeof(temp_rgbwaf));
+    memset(memory_bank0, 0, sizeof(memory_bank0));
+    // Last accessible memory location
+    memory_bank0[0] = sizeof(memory_bank0) - 1;
+}
+
+void SimGear::handle(uint32_t data, uint8_t num_bits)
+{
+    // Input device frames are 24 bits
+    if (num_bits != 16) {
+        return;
+    }
+    // ENABLE DEVICE TYPE lasts for the next command only
+    _enabled_device_type = _next_enabled_device_type;
+    _next_enabled_device_type = DT_NONE;
+
+    uint8_t addr = data >> 8;
+    uint8_t opcode = data & 0xFF;
+    // Special commands are 101xxxx1 and 110xxxx1
+    if ((addr & 0xE1) == 0xA1 || (addr & 0xE1) == 0xC1) {
+        special(addr, opcode);
+        return;
+    }
+    if (!addressed(addr)) {
+        return;
+    }
+    if (addr & 1) {
+        command(opcode);
+    } else if (opcode != 0xFF) {
+        // Direct arc power, 0xFF is MASK and leaves the level as is
+        set_level(opcode);
+    }
+}
+
+bool SimGear::addressed(uint8_t addr)
+{
+    if ((addr & 0x80) == 0) {
+        return short_addr != SIM_MASK && ((addr >> 1) & 0x3F) == short_addr;
+    }
+    if ((addr & 0xE0) == 0x80) {
+        return groups & (1 << ((addr >> 1) & 0x0F));
+    }
+    if ((addr & 0xFE) == 0xFE) {
+        return true;
+    }
+    if ((addr & 0xFE) == 0xFC) {
+        // Broadcast unaddressed
+        return short_addr == SIM_MASK;
+    }
+    return false;
+}
+
+bool SimGear::initialise_selects(uint8_t data)
+{
+    if (data == 0x00) {
+        return true;
+    }
+    if (data == 0xFF) {
+        return short_addr == SIM_MASK;
+    }
+    return (data & 0x81) == 0x01 && short_addr == ((data >> 1) & 0x3F);
+}
+
+int SimGear::decode_short(uint8_t data)
+{
+    if (data == 0xFF) {
+        return SIM_MASK;
+    }
+    if ((data & 0x81) != 0x01) {
+        return -1;
+    }
+    return (data >> 1) & 0x3F;
+}
+
+uint8_t SimGear::encode_short()
+{
+    return short_addr == SIM_MASK ? 0xFF : (short_addr << 1) | 1;
+}
+
+void SimGear::special(uint8_t addr, uint8_t data)
+{
+    switch (addr) {
+        case 0xA1:
+            addressing(SIM_ADDR_TERMINATE, data);
+            break;
+        case 0xA3:
+            dtr0 = data;
+            break;
+        case 0xA5:
+            addressing(SIM_ADDR_INITIALISE, data);
+            break;
+        case 0xA7:
+            addressing(SIM_ADDR_RANDOMISE, data);
+            break;
+        case 0xA9:
+            addressing(SIM_ADDR_COMPARE, data);
+            break;
+        case 0xAB:
+            addressing(SIM_ADDR_WITHDRAW, data);
+            break;
+        case 0xB1:
+            addressing(SIM_ADDR_SEARCH_H, data);
+            break;
+        case 0xB3:
+            addressing(SIM_ADDR_SEARCH_M, data);
+            break;
+        case 0xB5:
+            addressing(SIM_ADDR_SEARCH_L, data);
+            break;
+        case 0xB7:
+            addressing(SIM_ADDR_PROGRAM_SHORT, data);
+            break;
+        case 0xB9:
+            addressing(SIM_ADDR_VERIFY_SHORT, data);
+            break;
+        case 0xBB:
+            addressing(SIM_ADDR_QUERY_SHORT, data);
+            break;
+        case 0xC1:
+            _next_enabled_device_type = data;
+            break;
+        case 0xC3:
+            dtr1 = data;
+            break;
+        case 0xC5:
+            dtr2 = data;
+            break;
+    }
+}
+
+void SimGear::set_level(uint8_t level)
+{
+    // QUERY POWER FAILURE answers YES until the first arc power command
+    power_cycle_seen = false;
+    if (level == 0) {
+        actual_level = 0;
+        return;
+    }
+    if (level < min_level) {
+        level = min_level;
+    }
+    if (level > max_level) {
+        level = max_level;
+    }
+    actual_level = level;
+    last_active_level = level;
+}
+
+void SimGear::answer(bool yes)
+{
+    if (yes) {
+        reply(SIM_YES);
+    }
+}
+
+uint8_t SimGear::status()
+{
+    return (gear_failure ? 0x01 : 0) | (lamp_failure ? 0x02 : 0) |
+           (actual_level ? 0x04 : 0) | (short_addr == SIM_MASK ? 0x40 : 0) |
+           (power_cycle_seen ? 0x80 : 0);
+}
+
+void SimGear::command(uint8_t opcode)
+{
+    if (opcode >= 0xE0 && _enabled_device_type == device_type &&
+        device_type == SIM_DT_COLOUR) {
+        colour_command(opcode);
+        return;
+    }
+    // Configuration commands only act on the second of two frames
+    if (opcode >= 0x20 && opcode <= 0x81 && !repeated()) {
+        return;
+    }
+    if (opcode >= 0x10 && opcode <= 0x1F) {
+        // GO TO SCENE
+        uint8_t level = scenes[opcode & 0x0F];
+        if (level != 0xFF) {
+            set_level(level);
+        }
+        return;
+    }
+    if (opcode >= 0x40 && opcode <= 0x4F) {
+        scenes[opcode & 0x0F] = dtr0;
+        return;
+    }
+    if (opcode >= 0x50 && opcode <= 0x5F) {
+        scenes[opcode & 0x0F] = 0xFF;
+        return;
+    }
+    if (opcode >= 0x60 && opcode <= 0x6F) {
+        groups |= 1 << (opcode & 0x0F);
+        return;
+    }
+    if (opcode >= 0x70 && opcode <= 0x7F) {
+        groups &= ~(1 << (opcode & 0x0F));
+        return;
+    }
+    if (opcode >= 0xB0 && opcode <= 0xBF) {
+        reply(scenes[opcode & 0x0F]);
+        return;
+    }
+    switch (opcode) {
+        case 0x00:
+            // OFF
+            set_level(0);
+            break;
+        case 0x05:
+            set_level(max_level);
+            break;
+        case 0x06:
+            set_level(min_level);
+            break;
+        case 0x08:
+            // ON AND STEP UP
+            set_level(actual_level ? actual_level + 1 : min_level);
+            break;
+        case 0x2A:
+            max_level = dtr0 < min_level ? min_level : dtr0;
+            break;
+        case 0x2B:
+            min_level = dtr0 < phm ? phm : dtr0;
+            break;
+        case 0x2E:
+            fade_time = dtr0 & 0x0F;
+            break;
+        case 0x2F:
+            fade_rate = dtr0 & 0x0F;
+            break;
+        case 0x80:
+            // SET SHORT ADDRESS
+            if (decode_short(dtr0) >= 0) {
+                short_addr = decode_short(dtr0);
+            }
+            break;
+        case 0x90:
+            reply(status());
+            break;
+        case 0x91:
+            answer(true);
+            break;
+        case 0x92:
+            answer(lamp_failure);
+            break;
+        case 0x93:
+            answer(actual_level != 0);
+            break;
+        case 0x98:
+            reply(dtr0);
+            break;
+        case 0x99:
+            reply(device_type);
+            break;
+        case 0x9A:
+            reply(phm);
+            break;
+        case 0x9B:
+            answer(power_cycle_seen);
+            break;
+        case 0x9C:
+            reply(dtr1);
+            break;
+        case 0x9D:
+            reply(dtr2);
+            break;
+        case 0xA0:
+            reply(actual_level);
+            break;
+        case 0xA1:
+            reply(max_level);
+            break;
+        case 0xA2:
+            reply(min_level);
+            break;
+        case 0xA3:
+            reply(power_on_level);
+            break;
+        case 0xA5:
+            reply((fade_time << 4) | fade_rate);
+            break;
+        case 0xAA:
+            answer(gear_failure);
+            break;
+        case 0xC0:
+            reply(groups & 0xFF);
+            break;
+        case 0xC1:
+            reply(groups >> 8);
+            break;
+        case 0xC2:
+            reply(random_addr >> 16);
+            break;
+        case 0xC3:
+            reply((random_addr >> 8) & 0xFF);
+            break;
+        case 0xC4:
+            reply(random_addr & 0xFF);
+            break;
+        case 0xC5:
+            // READ MEMORY LOCATION, bank 0 only
+            if (dtr1 == 0 && dtr0 < sizeof(memory_bank0)) {
+                reply(memory_bank0[dtr0]);
+                dtr0++;
+            }
+            break;
+    }
+}
+
+void SimGear::colour_command(uint8_t opcode)
+{
+    switch (opcode) {
+        case 0xE2:
+            // ACTIVATE
+            if (temp_colour_tc != 0xFFFF) {
+                colour_tc = temp_colour_tc;
+                temp_colour_tc = 0xFFFF;
+            }
+            for (int i = 0; i < 6; i++) {
+                if (temp_rgbwaf[i] != 0xFF) {
+                    rgbwaf[i] = temp_rgbwaf[i];
+                    temp_rgbwaf[i] = 0xFF;
+                }
+            }
+            break;
+        case 0xE7: {
+            // SET TEMPORARY COLOUR TEMPERATURE Tc
+            uint16_t tc = ((uint16_t)dtr1 << 8) | dtr0;
+            if (tc < tc_coolest) {
+                tc = tc_coolest;
+            }
+            if (tc > tc_warmest) {
+                tc = tc_warmest;
+            }
+            temp_colour_tc = tc;
+            break;
+        }
+        case 0xEB:
+            // SET TEMPORARY RGB DIMLEVEL
+            temp_rgbwaf[0] = dtr0;
+            temp_rgbwaf[1] = dtr1;
+            temp_rgbwaf[2] = dtr2;
+            break;
+        case 0xEC:
+            // SET TEMPORARY WAF DIMLEVEL
+            temp_rgbwaf[3] = dtr0;
+            temp_rgbwaf[4] = dtr1;
+            temp_rgbwaf[5] = dtr2;
+            break;
+        case 0xF9:
+            reply(colour_features);
+            break;
+        case 0xFA: {
+            // QUERY COLOUR VALUE, MSB answered and LSB left in DTR0
+            uint16_t value;
+            switch (dtr0) {
+                case 2:
+                    value = colour_tc;
+                    break;
+                case 128:
+                case 129:
+                    value = tc_coolest;
+                    break;
+                case 130:
+                case 131:
+                    value = tc_warmest;
+                    break;
+                default:
+                    return;
+            }
+            dtr0 = value & 0xFF;
+            reply(value >> 8);
+            break;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_GEAR_H
+#define SIM_GEAR_H
+
+#include "sim_unit.h"
+
+// Device type of LED gear, and of colour control gear
+#define SIM_DT_LED 6
+#define SIM_DT_COLOUR 8
+
+/** iec62386-102 control gear, optionally with iec62386-209 (DT8) colour
+ * temperature or RGBWAF control
+ *
+ * Levels change at once, fades are not modelled, and the initialisation
+ * state does not time out.
+ */
+class SimGear : public SimUnit {
+public:
+    /** Constructor
+     *
+     *   @param device_type     SIM_DT_LED, SIM_DT_COLOUR, ...
+     *   @param colour_features QUERY COLOUR TYPE FEATURES answer for DT8
+     * gear: bit 1 for colour temperature, bits 5-7 RGBWAF channels
+     */
+    SimGear(uint8_t device_type = SIM_DT_LED, uint8_t colour_features = 0);
+
+    // State, public so scenarios can set it up and check it
+    uint8_t device_type;
+    uint8_t actual_level;
+    uint8_t last_active_level;
+    uint8_t min_level;
+    uint8_t max_level;
+    uint8_t phm;
+    uint8_t power_on_level;
+    uint8_t fade_time;
+    uint8_t fade_rate;
+    uint16_t groups;
+    uint8_t scenes[16];
+    bool lamp_failure;
+    bool gear_failure;
+    bool power_cycle_seen;
+
+    // DT8
+    uint8_t colour_features;
+    // Colour temperature in mirek, active and temporary
+    uint16_t colour_tc;
+    uint16_t temp_colour_tc;
+    uint16_t tc_coolest;
+    uint16_t tc_warmest;
+    // RGBWAF levels, active and temporary
+    uint8_t rgbwaf[6];
+    uint8_t temp_rgbwaf[6];
+    uint8_t memory_bank0[0x1B];
+
+protected:
+    virtual void handle(uint32_t data, uint8_t num_bits);
+    virtual bool initialise_selects(uint8_t data);
+    virtual int decode_short(uint8_t data);
+    virtual uint8_t encode_short();
+
+private:
+    bool addressed(uint8_t addr);
+    void special(uint8_t addr, uint8_t data);
+    void command(uint8_t opcode);
+    void colour_command(uint8_t opcode);
+    void set_level(uint8_t level);
+    void answer(bool yes);
+    uint8_t status();
+
+    // Device type enabled for the next command only
+    uint8_t _enabled_device_type;
+    uint8_t _next_enabled_device_type;
+};
+
+#endif
@@ -0,0 +1,253 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_input_device.h"
+#include <string.h>
+
+// Instance byte addressing the device itself, and every instance
+#define INSTANCE_DEVICE 0xFE
+#define INSTANCE_ALL 0xFF
+
+SimInputDevice::SimInputDevice()
+    : num_instances(0), operating_mode(0), quiescent(false), groups_l(0),
+      groups_h(0), _latch_len(0), _latch_pos(0)
+{
+    memset(instances, 0, sizeof(instances));
+    memset(_latch, 0, sizeof(_latch));
+}
+
+int SimInputDevice::add_instance(uint8_t type, uint8_t num_bytes)
+{
+    if (num_instances == SIM_MAX_INSTANCES) {
+        return -1;
+    }
+    SimInstance &inst = instances[num_instances];
+    inst.type = type;
+    inst.enabled = true;
+    inst.num_bytes = num_bytes < 1 ? 1 : num_bytes > 4 ? 4 : num_bytes;
+    return num_instances++;
+}
+
+void SimInputDevice::set_value(int instance, uint32_t value)
+{
+    SimInstance &inst = instances[instance];
+    for (int i = 0; i < inst.num_bytes; i++) {
+        inst.value[i] = value >> (8 * (inst.num_bytes - 1 - i));
+    }
+}
+
+bool SimInputDevice::trigger(int instance, uint16_t info)
+{
+    SimInstance &inst = instances[instance];
+    if (!inst.enabled || quiescent || short_addr == SIM_MASK) {
+        return false;
+    }
+    send(((uint32_t)short_addr << 17) | ((uint32_t)(inst.type & 0x1F) << 10) |
+             (info & 0x3FF),
+         24);
+    return true;
+}
+
+void SimInputDevice::handle(uint32_t data, uint8_t num_bits)
+{
+    // Control gear frames are 16 bits
+    if (num_bits != 24) {
+        return;
+    }
+    uint8_t addr = data >> 16;
+    uint8_t instance = (data >> 8) & 0xFF;
+    uint8_t opcode = data & 0xFF;
+    if (addr == 0xC1) {
+        special(instance, opcode);
+        return;
+    }
+    // Event frames from other devices have the LSb clear
+    if (!(addr & 1) || !addressed(addr)) {
+        return;
+    }
+    if (instance == INSTANCE_DEVICE) {
+        device_command(opcode);
+        return;
+    }
+    for (int i = 0; i < num_instances; i++) {
+        SimInstance &inst = instances[i];
+        if (instance == INSTANCE_ALL || instance == i ||
+            instance == (0x80 | inst.type)) {
+            instance_command(inst, opcode);
+        }
+    }
+}
+
+bool SimInputDevice::addressed(uint8_t addr)
+{
+    if ((addr & 0x80) == 0) {
+        return short_addr != SIM_MASK && ((addr >> 1) & 0x3F) == short_addr;
+    }
+    if ((addr & 0xC0) == 0x80) {
+        int group = (addr >> 1) & 0x1F;
+        return group < 8 ? (groups_l >> group) & 1
+                         : group < 16 ? (groups_h >> (group - 8)) & 1 : false;
+    }
+    if (addr == 0xFF) {
+        return true;
+    }
+    if (addr == 0xFD) {
+        return short_addr == SIM_MASK;
+    }
+    return false;
+}
+
+bool SimInputDevice::initialise_selects(uint8_t data)
+{
+    if (data == 0xFF) {
+        return true;
+    }
+    if (data == 0x7F) {
+        return short_addr == SIM_MASK;
+    }
+    return data < 64 && short_addr == data;
+}
+
+int SimInputDevice::decode_short(uint8_t data)
+{
+    if (data == 0xFF) {
+        return SIM_MASK;
+    }
+    return data < 64 ? data : -1;
+}
+
+uint8_t SimInputDevice::encode_short()
+{
+    return short_addr;
+}
+
+void SimInputDevice::special(uint8_t cmd, uint8_t data)
+{
+    // TERMINATE ... QUERY SHORT ADDRESS are 0x00 - 0x0A
+    static const int addressing_cmds[] = {
+        SIM_ADDR_TERMINATE,     SIM_ADDR_INITIALISE, SIM_ADDR_RANDOMISE,
+        SIM_ADDR_COMPARE,       SIM_ADDR_WITHDRAW,   SIM_ADDR_SEARCH_H,
+        SIM_ADDR_SEARCH_M,      SIM_ADDR_SEARCH_L,   SIM_ADDR_PROGRAM_SHORT,
+        SIM_ADDR_VERIFY_SHORT,  SIM_ADDR_QUERY_SHORT};
+    if (cmd <= 0x0A) {
+        addressing(addressing_cmds[cmd], data);
+        return;
+    }
+    switch (cmd) {
+        case 0x30:
+            dtr0 = data;
+            break;
+        case 0x31:
+            dtr1 = data;
+            break;
+        case 0x32:
+            dtr2 = data;
+            break;
+    }
+}
+
+void SimInputDevice::device_command(uint8_t opcode)
+{
+    // Configuration commands only act on the second of two frames
+    if (opcode >= 0x10 && opcode <= 0x1C && !repeated()) {
+        return;
+    }
+    switch (opcode) {
+        case 0x14:
+            // SET SHORT ADDRESS (DTR0)
+            if (decode_short(dtr0) >= 0) {
+                short_addr = decode_short(dtr0);
+            }
+            break;
+        case 0x18:
+            // SET OPERATING MODE (DTR0)
+            operating_mode = dtr0;
+            break;
+        case 0x1D:
+            quiescent = true;
+            break;
+        case 0x1E:
+            quiescent = false;
+            break;
+        case 0x30:
+            // QUERY DEVICE STATUS
+            reply((short_addr == SIM_MASK ? 0x04 : 0) | (quiescent ? 0x02 : 0));
+            break;
+        case 0x35:
+            reply(num_instances);
+            break;
+        case 0x36:
+            reply(dtr0);
+            break;
+        case 0x37:
+            reply(dtr1);
+            break;
+        case 0x38:
+            reply(dtr2);
+            break;
+        case 0x39:
+            reply(random_addr >> 16);
+            break;
+        case 0x3A:
+            reply((random_addr >> 8) & 0xFF);
+            break;
+        case 0x3B:
+            reply(random_addr & 0xFF);
+            break;
+    }
+}
+
+void SimInputDevice::instance_command(SimInstance &inst, uint8_t opcode)
+{
+    // Configuration commands only act on the second of two frames
+    if (opcode >= 0x61 && opcode <= 0x6F && !repeated()) {
+        return;
+    }
+    switch (opcode) {
+        case 0x62:
+            inst.enabled = true;
+            break;
+        case 0x63:
+            inst.enabled = false;
+            break;
+        case 0x67:
+            inst.event_scheme = dtr0;
+            break;
+        case 0x68:
+            inst.event_filter = dtr0;
+            break;
+        case 0x80:
+            reply(inst.type);
+            break;
+        case 0x86:
+            // QUERY INSTANCE ENABLED
+            reply(inst.enabled ? SIM_YES : 0);
+            break;
+        case 0x8C:
+            // QUERY INPUT VALUE, the other bytes are latched
+            memcpy(_latch, inst.value, inst.num_bytes);
+            _latch_len = inst.num_bytes;
+            _latch_pos = 1;
+            reply(_latch[0]);
+            break;
+        case 0x8D:
+            // QUERY INPUT VALUE LATCH
+            if (_latch_pos < _latch_len) {
+                reply(_latch[_latch_pos++]);
+            }
+            break;
+    }
+}
@@ -0,0 +1,97 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_INPUT_DEVICE_H
+#define SIM_INPUT_DEVICE_H
+
+#include "sim_unit.h"
+
+// Instances kept per device
+#define SIM_MAX_INSTANCES 8
+
+// Instance types, as in iec62386-103 and DALIDriver's InstanceType
+#define SIM_INSTANCE_BUTTON 1
+#define SIM_INSTANCE_OCCUPANCY 3
+#define SIM_INSTANCE_LIGHT 4
+
+struct SimInstance {
+    uint8_t type;
+    bool enabled;
+    uint8_t event_scheme;
+    uint8_t event_filter;
+    // Input value, MSB first, num_bytes long
+    uint8_t value[4];
+    uint8_t num_bytes;
+};
+
+/** iec62386-103 input device with a few instances (PIR, light sensor,
+ * button, ...)
+ */
+class SimInputDevice : public SimUnit {
+public:
+    SimInputDevice();
+
+    /** Add an instance
+     *
+     *   @param type        SIM_INSTANCE_OCCUPANCY, ...
+     *   @param num_bytes   Bytes in the input value
+     *   @returns           The instance number, -1 if full
+     */
+    int add_instance(uint8_t type, uint8_t num_bytes = 1);
+
+    /** Set the input value of an instance, right aligned
+     */
+    void set_value(int instance, uint32_t value);
+
+    /** Send an event from an instance, as the device would on input
+     *
+     *   @param instance    Instance number
+     *   @param info        10 bit event information
+     *   @returns           true if the event was put on the bus, false if the
+     * instance is disabled or the device is quiet
+     *
+     *   NOTE: The frame is device short address, instance type and event
+     *   info, the layout DALIDriver::parse_event() expects
+     */
+    bool trigger(int instance, uint16_t info);
+
+    // State, public so scenarios can set it up and check it
+    SimInstance instances[SIM_MAX_INSTANCES];
+    int num_instances;
+    uint8_t operating_mode;
+    bool quiescent;
+    uint8_t groups_l;
+    uint8_t groups_h;
+
+protected:
+    virtual void handle(uint32_t data, uint8_t num_bits);
+    virtual bool initialise_selects(uint8_t data);
+    virtual int decode_short(uint8_t data);
+    virtual uint8_t encode_short();
+
+private:
+    bool addressed(uint8_t addr);
+    void special(uint8_t cmd, uint8_t data);
+    void device_command(uint8_t opcode);
+    void instance_command(SimInstance &inst, uint8_t opcode);
+
+    // Input value bytes still to be read with QUERY INPUT VALUE LATCH
+    uint8_t _latch[4];
+    uint8_t _latch_len;
+    uint8_t _latch_pos;
+};
+
+#endif
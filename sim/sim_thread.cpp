@@ -0,0 +1,216 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_thread.h"
+#include "sim_clock.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Unwinds a terminated thread
+struct SimThreadExit {
+};
+
+struct SimThreadState {
+    std::thread thread;
+    std::condition_variable cv;
+    // Set when this thread may run
+    bool go;
+    bool started;
+    bool finished;
+    bool exit;
+    std::function<void()> task;
+    // Thread that last handed control to this one, it gets it back
+    SimThreadState *resumer;
+    // What the thread waits for while blocked, and the event that resumes it
+    const void *blocked_on;
+    bool blocked;
+    SimClock::EventId resume_event;
+
+    SimThreadState()
+        : go(false), started(false), finished(false), exit(false),
+          resumer(NULL), blocked_on(NULL), blocked(false), resume_event(0)
+    {
+    }
+};
+
+static std::mutex &lock()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static SimThreadState &main_state()
+{
+    static SimThreadState state;
+    return state;
+}
+
+static SimThreadState *current = &main_state();
+
+// blocked_on of a thread already woken
+static const char woken = 0;
+
+static std::vector<SimThreadState *> &blocked()
+{
+    static std::vector<SimThreadState *> list;
+    return list;
+}
+
+// Hand control from the running thread to next and wait to get it back
+static void switch_to(SimThreadState *next)
+{
+    SimThreadState *self = current;
+    std::unique_lock<std::mutex> guard(lock());
+    self->go = false;
+    if (next != self->resumer) {
+        next->resumer = self;
+    }
+    current = next;
+    next->go = true;
+    next->cv.notify_one();
+    self->cv.wait(guard, [self]() { return self->go; });
+    current = self;
+}
+
+// Clock event that runs a thread until it waits again
+static void resume(SimThreadState *state)
+{
+    state->resume_event = 0;
+    if (!state->finished) {
+        switch_to(state);
+    }
+}
+
+static void thread_main(SimThreadState *state)
+{
+    {
+        std::unique_lock<std::mutex> guard(lock());
+        state->cv.wait(guard, [state]() { return state->go; });
+    }
+    try {
+        if (!state->exit) {
+            state->task();
+        }
+    } catch (SimThreadExit &) {
+    }
+    state->finished = true;
+    sim::wake(state);
+    // Back for good
+    std::unique_lock<std::mutex> guard(lock());
+    state->go = false;
+    current = state->resumer;
+    current->go = true;
+    current->cv.notify_one();
+}
+
+namespace sim {
+
+bool in_thread()
+{
+    return current != &main_state();
+}
+
+void block(const void *object, uint64_t deadline_us)
+{
+    SimThreadState *self = current;
+    SimClock &clock = SimClock::instance();
+    self->blocked_on = object;
+    self->blocked = true;
+    if (deadline_us != UINT64_MAX) {
+        self->resume_event =
+            clock.schedule(deadline_us, [self]() { resume(self); });
+    }
+    blocked().push_back(self);
+    switch_to(self->resumer);
+    std::vector<SimThreadState *> &list = blocked();
+    list.erase(std::remove(list.begin(), list.end(), self), list.end());
+    self->blocked = false;
+    clock.cancel(self->resume_event);
+    self->resume_event = 0;
+    if (self->exit) {
+        throw SimThreadExit();
+    }
+}
+
+void wake(const void *object)
+{
+    SimClock &clock = SimClock::instance();
+    std::vector<SimThreadState *> &list = blocked();
+    for (size_t i = 0; i < list.size(); i++) {
+        SimThreadState *state = list[i];
+        if (state->blocked_on != object) {
+            continue;
+        }
+        // Once is enough
+        state->blocked_on = &woken;
+        clock.cancel(state->resume_event);
+        state->resume_event = clock.schedule_in(0, [state]() { resume(state); });
+    }
+}
+
+SimThreadState *thread_create(const std::function<void()> &task)
+{
+    SimThreadState *state = new SimThreadState();
+    state->task = task;
+    state->started = true;
+    state->thread = std::thread(thread_main, state);
+    // Runs once the caller waits, as a new thread of the same priority would
+    state->resume_event =
+        SimClock::instance().schedule_in(0, [state]() { resume(state); });
+    return state;
+}
+
+bool thread_finished(SimThreadState *state)
+{
+    return state->finished;
+}
+
+void thread_join(SimThreadState *state)
+{
+    SimClock &clock = SimClock::instance();
+    while (!state->finished) {
+        if (in_thread()) {
+            block(state, UINT64_MAX);
+        } else if (!clock.run_next(UINT64_MAX)) {
+            // Blocked for good, nothing will finish it
+            return;
+        }
+    }
+}
+
+void thread_terminate(SimThreadState *state)
+{
+    if (state->finished || state == current) {
+        return;
+    }
+    state->exit = true;
+    SimClock::instance().cancel(state->resume_event);
+    state->resume_event = 0;
+    // Let it unwind from where it waits
+    switch_to(state);
+}
+
+void thread_destroy(SimThreadState *state)
+{
+    thread_terminate(state);
+    state->thread.join();
+    delete state;
+}
+
+} // namespace sim
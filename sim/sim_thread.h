@@ -0,0 +1,57 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_THREAD_H
+#define SIM_THREAD_H
+
+#include <stdint.h>
+#include <functional>
+
+struct SimThreadState;
+
+/** Cooperative threads on SimClock
+ *
+ * Each rtos::Thread gets a host thread, but only one thread runs at a time.
+ * The main thread runs the clock. A Thread runs from inside a clock event
+ * until it waits, then control goes back to the main thread, so runs stay
+ * deterministic and virtual time still only moves while everything waits.
+ */
+namespace sim {
+
+/** Check if the caller is an rtos::Thread rather than the main thread
+ */
+bool in_thread();
+
+/** Give up control until woken for object, or until deadline_us
+ *
+ * Only for rtos::Thread callers, the main thread runs the clock instead.
+ */
+void block(const void *object, uint64_t deadline_us);
+
+/** Make the threads blocked on object run next
+ */
+void wake(const void *object);
+
+// rtos::Thread internals
+SimThreadState *thread_create(const std::function<void()> &task);
+bool thread_finished(SimThreadState *state);
+void thread_join(SimThreadState *state);
+void thread_terminate(SimThreadState *state);
+void thread_destroy(SimThreadState *state);
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,133 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sim_unit.h"
+#include "sim_bus.h"
+
+// Send-twice commands must repeat within this time
+#define SEND_TWICE_US 100000
+
+SimUnit::SimUnit()
+    : short_addr(SIM_MASK), random_addr(0xFFFFFF), search_addr(0xFFFFFF),
+      init_state(SIM_INIT_DISABLED), dtr0(0), dtr1(0), dtr2(0),
+      forced_random_addr(0), forced_randomises(0), _bus(NULL),
+      _source(0), _last_frame(0), _last_bits(0), _last_time(0),
+      _repeated(false)
+{
+}
+
+SimUnit::~SimUnit()
+{
+    if (_bus) {
+        _bus->remove(this);
+    }
+}
+
+void SimUnit::receive(uint32_t data, uint8_t num_bits)
+{
+    uint64_t now = SimClock::instance().now();
+    // A third copy starts a new pair
+    _repeated = !_repeated && _last_bits == num_bits && _last_frame == data &&
+                now - _last_time <= SEND_TWICE_US;
+    handle(data, num_bits);
+    _last_frame = data;
+    _last_bits = num_bits;
+    _last_time = now;
+}
+
+void SimUnit::reply(uint8_t data)
+{
+    if (_bus) {
+        _bus->send_backward(this, data);
+    }
+}
+
+void SimUnit::send(uint32_t data, uint8_t num_bits)
+{
+    if (_bus) {
+        _bus->send_forward(this, data, num_bits);
+    }
+}
+
+bool SimUnit::addressing(int cmd, uint8_t data)
+{
+    bool searching = init_state != SIM_INIT_DISABLED;
+    bool selected = searching && random_addr == search_addr;
+    if (!searching && cmd != SIM_ADDR_TERMINATE &&
+        cmd != SIM_ADDR_INITIALISE) {
+        // Only initialisation opens up the rest
+        return true;
+    }
+    switch (cmd) {
+        case SIM_ADDR_TERMINATE:
+            init_state = SIM_INIT_DISABLED;
+            break;
+        case SIM_ADDR_INITIALISE:
+            // Withdrawn units take part again, like after power up
+            if (repeated() && initialise_selects(data)) {
+                init_state = SIM_INIT_ENABLED;
+            }
+            break;
+        case SIM_ADDR_RANDOMISE:
+            if (repeated() && forced_randomises > 0) {
+                random_addr = forced_random_addr;
+                forced_randomises--;
+            } else if (repeated() && _bus) {
+                random_addr = _bus->random() & 0xFFFFFF;
+            }
+            break;
+        case SIM_ADDR_COMPARE:
+            if (init_state == SIM_INIT_ENABLED && random_addr <= search_addr) {
+                reply(SIM_YES);
+            }
+            break;
+        case SIM_ADDR_WITHDRAW:
+            if (init_state == SIM_INIT_ENABLED && random_addr == search_addr) {
+                init_state = SIM_INIT_WITHDRAWN;
+            }
+            break;
+        case SIM_ADDR_SEARCH_H:
+            search_addr = (search_addr & 0x00FFFF) | ((uint32_t)data << 16);
+            break;
+        case SIM_ADDR_SEARCH_M:
+            search_addr = (search_addr & 0xFF00FF) | ((uint32_t)data << 8);
+            break;
+        case SIM_ADDR_SEARCH_L:
+            search_addr = (search_addr & 0xFFFF00) | data;
+            break;
+        case SIM_ADDR_PROGRAM_SHORT:
+            if (selected) {
+                int addr = decode_short(data);
+                if (addr >= 0) {
+                    short_addr = addr;
+                }
+            }
+            break;
+        case SIM_ADDR_VERIFY_SHORT:
+            if (short_addr != SIM_MASK && decode_short(data) == short_addr) {
+                reply(SIM_YES);
+            }
+            break;
+        case SIM_ADDR_QUERY_SHORT:
+            if (selected) {
+                reply(encode_short());
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
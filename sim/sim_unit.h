@@ -0,0 +1,132 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SIM_UNIT_H
+#define SIM_UNIT_H
+
+#include <stdint.h>
+
+class SimBus;
+
+// Short address of a unit that has none
+#define SIM_MASK 0xFF
+// Answer to yes/no queries
+#define SIM_YES 0xFF
+
+// Initialisation state of the addressing commands
+enum SimInitState { SIM_INIT_DISABLED, SIM_INIT_ENABLED, SIM_INIT_WITHDRAWN };
+
+/** A unit on the simulated bus, control gear or an input device
+ *
+ * Holds what the addressing commands of iec62386-102 and -103 have in
+ * common: short and random addresses, the search address, the
+ * initialisation state and the DTRs.
+ */
+class SimUnit {
+public:
+    SimUnit();
+    virtual ~SimUnit();
+
+    /** Called by the bus for every forward frame
+     */
+    void receive(uint32_t data, uint8_t num_bits);
+
+    SimBus *bus()
+    {
+        return _bus;
+    }
+
+    // State, public so scenarios can set it up and check it
+    uint8_t short_addr;
+    uint32_t random_addr;
+    uint32_t search_addr;
+    SimInitState init_state;
+    uint8_t dtr0;
+    uint8_t dtr1;
+    uint8_t dtr2;
+    // The next forced_randomises RANDOMISE commands give forced_random_addr,
+    // e.g. to make units pick the same random address
+    uint32_t forced_random_addr;
+    int forced_randomises;
+
+protected:
+    /** Handle a forward frame
+     */
+    virtual void handle(uint32_t data, uint8_t num_bits) = 0;
+
+    /** Answer the frame being handled with a backward frame
+     */
+    void reply(uint8_t data);
+
+    /** Send a forward frame of our own
+     */
+    void send(uint32_t data, uint8_t num_bits);
+
+    /** Check if the frame being handled repeats the previous one within
+     * 100 ms, which is when a send-twice command takes effect
+     */
+    bool repeated() const
+    {
+        return _repeated;
+    }
+
+    /** Handle the addressing commands shared by both standards
+     *
+     *   @param cmd     INITIALISE, RANDOMISE, ... in the SIM_ADDR_* numbering
+     *   @param data    Data byte of the command
+     *   @returns       true if the command was one of them
+     */
+    bool addressing(int cmd, uint8_t data);
+
+    /** Check if INITIALISE data selects this unit
+     */
+    virtual bool initialise_selects(uint8_t data) = 0;
+
+    /** Short address as sent in PROGRAM SHORT ADDRESS and VERIFY SHORT
+     * ADDRESS, SIM_MASK if the data deletes it, -1 if it is not valid
+     */
+    virtual int decode_short(uint8_t data) = 0;
+
+    /** Short address as answered to QUERY SHORT ADDRESS
+     */
+    virtual uint8_t encode_short() = 0;
+
+    enum {
+        SIM_ADDR_TERMINATE,
+        SIM_ADDR_INITIALISE,
+        SIM_ADDR_RANDOMISE,
+        SIM_ADDR_COMPARE,
+        SIM_ADDR_WITHDRAW,
+        SIM_ADDR_SEARCH_H,
+        SIM_ADDR_SEARCH_M,
+        SIM_ADDR_SEARCH_L,
+        SIM_ADDR_PROGRAM_SHORT,
+        SIM_ADDR_VERIFY_SHORT,
+        SIM_ADDR_QUERY_SHORT
+    };
+
+private:
+    friend class SimBus;
+
+    SimBus *_bus;
+    int _source;
+    uint32_t _last_frame;
+    uint8_t _last_bits;
+    uint64_t _last_time;
+    bool _repeated;
+};
+
+#endif
@@ -0,0 +1,140 @@
+/* DALI bus simulator
+ * Copyright (c) 2018 ARM Limited
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Tests of the ManchesterEncoder transmit engines on a simulated bus
+ *
+ * Runs the timer and the bit-bang engine through the same frames, and
+ * through a frame that loses the bus to an input device event. Exits with
+ * the number of failed checks.
+ */
+
+#include "manchester/encoder.h"
+#include "mbed.h"
+#include "sim_bus.h"
+#include "sim_gear.h"
+#include "sim_input_device.h"
+#include <functional>
+
+#define TX_PIN 1
+#define RX_PIN 2
+#define GEAR_ADDR 0
+#define INPUT_ADDR 1
+// Direct arc power and QUERY ACTUAL LEVEL to GEAR_ADDR
+#define DAPC(level) ((GEAR_ADDR << 9) | (level))
+#define QUERY_ACTUAL_LEVEL ((GEAR_ADDR << 9) | 0x100 | 0xA0)
+// Stop condition, after which the gear acts on a frame
+#define STOP_MS 2
+// Bus settled after everything on it
+#define IDLE_MS 100
+// The event frame, the settling time after it and the frame sent again
+#define RETRY_MS 60
+
+static int failures = 0;
+static int events_received = 0;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            printf("%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,       \
+                   mode_name, #cond);                                          \
+            failures++;                                                        \
+        }                                                                      \
+    } while (0)
+
+static void on_event(uint32_t data)
+{
+    (void)data;
+    events_received++;
+}
+
+static void run(ManchesterEncoder::TxMode mode, const char *mode_name)
+{
+    SimClock::instance().reset();
+    events_received = 0;
+    SimBus bus(TX_PIN, RX_PIN);
+    SimGear gear;
+    gear.short_addr = GEAR_ADDR;
+    SimInputDevice pir;
+    pir.add_instance(SIM_INSTANCE_OCCUPANCY);
+    pir.short_addr = INPUT_ADDR;
+    pir.instances[0].enabled = true;
+    pir.quiescent = false;
+    bus.add(&gear);
+    bus.add(&pir);
+    ManchesterEncoder encoder(TX_PIN, RX_PIN, 1200);
+    encoder.set_tx_mode(mode);
+    encoder.attach(on_event);
+
+    // A frame on its own
+    encoder.send(DAPC(100));
+    if (mode == ManchesterEncoder::TX_BITBANG) {
+        // The frame is on the wire when send() returns
+        CHECK(!encoder.tx_busy());
+    } else {
+        // send() returns while the timer shifts the frame out
+        CHECK(encoder.tx_busy());
+    }
+    encoder.flush();
+    CHECK(!encoder.tx_busy());
+    wait_ms(STOP_MS);
+    CHECK(gear.actual_level == 100);
+
+    // A query and its backward frame
+    encoder.send(QUERY_ACTUAL_LEVEL);
+    CHECK(encoder.recv() == 100);
+
+    // Lose the bus to an event starting at the same time
+    wait_ms(IDLE_MS);
+    uint32_t collisions = encoder.collisions();
+    SimClock::instance().schedule_in(
+        0, std::bind(&SimInputDevice::trigger, &pir, 0, 1));
+    wait_us(50);
+    encoder.send(DAPC(50));
+    wait_ms(RETRY_MS);
+    CHECK(encoder.collisions() == collisions + 1);
+    CHECK(events_received == 1);
+    if (mode == ManchesterEncoder::TX_BITBANG) {
+        // The receive interrupt leaves the frame to the next flush()
+        CHECK(encoder.tx_busy());
+        CHECK(gear.actual_level == 100);
+    } else {
+        // Sent again from the timer once the event was over
+        CHECK(!encoder.tx_busy());
+        CHECK(gear.actual_level == 50);
+    }
+    encoder.flush();
+    CHECK(!encoder.tx_busy());
+    wait_ms(STOP_MS);
+    CHECK(gear.actual_level == 50);
+    encoder.send(QUERY_ACTUAL_LEVEL);
+    CHECK(encoder.recv() == 50);
+
+    // Our four frames, the event and both replies, each once
+    wait_ms(STOP_MS);
+    const SimBusStats &stats = bus.stats();
+    CHECK(stats.bad_frames == 0);
+    CHECK(stats.forward_frames == 5);
+    CHECK(stats.backward_frames == 2);
+    encoder.detach();
+}
+
+int main()
+{
+    run(ManchesterEncoder::TX_TIMER, "timer");
+    run(ManchesterEncoder::TX_BITBANG, "bit-bang");
+    printf("tx_test: %d failed\n", failures);
+    return failures;
+}